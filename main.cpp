@@ -1,47 +1,110 @@
 
 
-#include <fstream>
 #include <memory>
 
 #include "vm/VM.h"
 #include "vm/library.h"
 #include "vm/exceptions.h"
+#include "jit/IRDriver.h"
 
 using namespace jit;
 
-std::vector<u8> read_file(const char* filename) {
-	std::ifstream file(filename, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
-	if(!file.is_open()) {
-		fatal("Bytecode file not found.");
-	}
-	usize size = file.tellg();
-	file.seekg(0, file.beg);
-
-	std::vector<u8> data(size, 0x00);
-	file.read(reinterpret_cast<char*>(data.data()), size);
-	return data;
+static bool is_source_file(std::string_view filename) {
+	std::string_view ext = ".lua";
+	return filename.size() >= ext.size() && filename.substr(filename.size() - ext.size()) == ext;
 }
 
+static Program load_program(const char* filename) {
+	const bool optimize = true;
+	if(is_source_file(filename)) {
+		// compiled sources are cached in $JIT_CODE_CACHE if set
+		if(const char* cache_dir = std::getenv("JIT_CODE_CACHE")) {
+			CodeCache cache(cache_dir);
+			return Program::from_source_file(filename, &cache, optimize);
+		}
+		return Program::from_source_file(filename, nullptr, optimize);
+	}
+	return Program::from_luac_file(filename, optimize);
+}
 
-void lua_main() {
-	auto luac = read_file("../../luac.out");
+static void write_profile(const Profiler& profiler, const char* profile_file, const char* folded_file) {
+	if(profile_file) {
+		if(std::FILE* file = std::fopen(profile_file, "w")) {
+			profiler.write_flat(file);
+			std::fprintf(file, "\n\n");
+			profiler.write_call_graph(file);
+			std::fclose(file);
+		}
+	}
+	if(folded_file) {
+		if(std::FILE* file = std::fopen(folded_file, "w")) {
+			profiler.write_collapsed(file);
+			std::fclose(file);
+		}
+	}
+}
 
-	Program program = Program::from_luac(ArrayView<u8>(luac.data(), luac.size()));
+void lua_main(const char* filename) {
+	Program program;
+	try {
+		program = load_program(filename);
+	} catch(SyntaxErrorException& e) {
+		std::printf("SYNTAX ERROR: %s at line %u\n", e.what(), e.line);
+		return;
+	}
 
 	Table env = lib::default_env();
 
+	// size of the stdout buffer in bytes
+	if(const char* size = std::getenv("JIT_OUTPUT_BUFFER")) {
+		lib::output().set_capacity(usize(std::strtoull(size, nullptr, 10)));
+	}
+
 	VM vm(&env);
 
+	// JIT_PROFILE receives the flat profile and call graph, JIT_PROFILE_FOLDED the stacks for flame graphs
+	const char* profile_file = std::getenv("JIT_PROFILE");
+	const char* folded_file = std::getenv("JIT_PROFILE_FOLDED");
+	std::unique_ptr<Profiler> profiler;
+	if(profile_file || folded_file) {
+		const char* interval = std::getenv("JIT_PROFILE_INTERVAL");
+		profiler = interval ? std::make_unique<Profiler>(u32(std::strtoul(interval, nullptr, 10))) : std::make_unique<Profiler>();
+		vm.set_profiler(profiler.get());
+	}
+
+	// JIT_DUMP_IR prints the optimized IR of every function once it has been called that many times,
+	// JIT_CHECK_IR runs the IR from then on and compares it with the interpreter
+	const char* dump_ir = std::getenv("JIT_DUMP_IR");
+	const char* check_ir = std::getenv("JIT_CHECK_IR");
+	std::unique_ptr<ir::Driver> ir_driver;
+	if(dump_ir || check_ir) {
+		const char* hot_calls = check_ir ? check_ir : dump_ir;
+		ir_driver = std::make_unique<ir::Driver>(u32(std::strtoul(hot_calls, nullptr, 10)), dump_ir != nullptr, check_ir != nullptr);
+		vm.set_call_handler(ir_driver.get());
+		// type feedback is what the passes specialize and inline on
+		vm.set_profiling(true);
+	}
+
 	Value ret;
 	try {
 		vm.eval(program, &ret);
 	} catch(ExecutionException& e) {
+		lib::output().flush();
 		std::printf("ERROR: %s at instruction %s\n", e.what(), op_name(OpCode(e.instruction->opcode)));
 	}
+
+	if(check_ir) {
+		lib::output().flush();
+		ir_driver->print_summary(stderr);
+	}
+
+	if(profiler) {
+		write_profile(*profiler, profile_file, folded_file);
+	}
 }
 
-int main() {
-	lua_main();
+int main(int argc, char** argv) {
+	lua_main(argc > 1 ? argv[1] : "../../luac.out");
 
 	return 0;
 }
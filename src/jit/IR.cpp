@@ -0,0 +1,1319 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "IR.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdio>
+#include <unordered_map>
+
+namespace jit {
+namespace ir {
+
+const char* op_name(Op op) {
+	static const char* names[] = {
+		"Param", "Nil", "Bool", "Constant", "Phi",
+		"GetUpval", "GetTabUp", "GetTable", "Len",
+		"SetUpval", "SetTabUp", "SetTable", "SetList", "NewTable",
+		"Add", "Sub", "Mul", "Mod", "Pow", "Div", "Unm", "Not",
+		"Eq", "Lt", "Le", "ForCond", "ForLimit", "ForStep",
+		"Call", "CallResult",
+		"Sqrt", "Abs", "Floor", "Ceil", "Min", "Max", "Exp", "Log", "Sin", "Cos", "Fmod",
+		"GuardNumber", "GuardTable", "GuardTarget"
+	};
+	static_assert(sizeof(names) / sizeof(names[0]) == usize(Op::GuardTarget) + 1);
+	return names[usize(op)];
+}
+
+const char* type_name(Type type) {
+	static const char* names[] = {"unknown", "nil", "bool", "number", "string", "table", "function", "any"};
+	return names[usize(type)];
+}
+
+bool Node::is_pure() const {
+	switch(op) {
+		case Op::Param:
+		case Op::Nil:
+		case Op::Bool:
+		case Op::Constant:
+		case Op::Add:
+		case Op::Sub:
+		case Op::Mul:
+		case Op::Mod:
+		case Op::Pow:
+		case Op::Div:
+		case Op::Unm:
+		case Op::Not:
+		case Op::Eq:
+		case Op::Lt:
+		case Op::Le:
+		case Op::ForCond:
+		case Op::ForStep:
+		case Op::Sqrt:
+		case Op::Abs:
+		case Op::Floor:
+		case Op::Ceil:
+		case Op::Min:
+		case Op::Max:
+		case Op::Exp:
+		case Op::Log:
+		case Op::Sin:
+		case Op::Cos:
+		case Op::Fmod:
+		case Op::GuardNumber:
+		case Op::GuardTable:
+		case Op::GuardTarget:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool Node::is_load() const {
+	switch(op) {
+		case Op::GetUpval:
+		case Op::GetTabUp:
+		case Op::GetTable:
+		case Op::Len:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool Node::has_side_effects() const {
+	switch(op) {
+		case Op::SetUpval:
+		case Op::SetTabUp:
+		case Op::SetTable:
+		case Op::SetList:
+		case Op::Call:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool Node::is_guard() const {
+	return op == Op::GuardNumber || op == Op::GuardTable || op == Op::GuardTarget;
+}
+
+
+
+Graph::Graph(const Function& function) : _function(function), _constants(function.constants) {
+}
+
+const Function& Graph::function() const {
+	return _function;
+}
+
+Node& Graph::node(NodeId id) {
+	return _nodes[id];
+}
+
+const Node& Graph::node(NodeId id) const {
+	return _nodes[id];
+}
+
+usize Graph::node_count() const {
+	return _nodes.size();
+}
+
+Block& Graph::block(BlockId id) {
+	return _blocks[id];
+}
+
+const Block& Graph::block(BlockId id) const {
+	return _blocks[id];
+}
+
+usize Graph::block_count() const {
+	return _blocks.size();
+}
+
+NodeId Graph::add_node(Op op, BlockId block, u32 pc, std::vector<NodeId> operands, u32 imm) {
+	NodeId id = NodeId(_nodes.size());
+	Node& n = _nodes.emplace_back();
+	n.op = op;
+	n.block = block;
+	n.pc = pc;
+	n.imm = imm;
+	n.operands = std::move(operands);
+	return id;
+}
+
+BlockId Graph::add_block() {
+	_blocks.emplace_back();
+	return BlockId(_blocks.size() - 1);
+}
+
+const Constant& Graph::constant(u32 index) const {
+	return _constants[index];
+}
+
+u32 Graph::add_constant(const Constant& constant) {
+	_constants.push_back(constant);
+	return u32(_constants.size() - 1);
+}
+
+const void* Graph::target(u32 index) const {
+	return _targets[index];
+}
+
+u32 Graph::add_target(const void* target) {
+	auto it = std::find(_targets.begin(), _targets.end(), target);
+	if(it != _targets.end()) {
+		return u32(it - _targets.begin());
+	}
+	_targets.push_back(target);
+	return u32(_targets.size() - 1);
+}
+
+const FrameState& Graph::frame_state(u32 index) const {
+	return _frame_states[index];
+}
+
+usize Graph::frame_state_count() const {
+	return _frame_states.size();
+}
+
+void Graph::replace_uses(NodeId from, NodeId to) {
+	auto replace = [=](NodeId& id) {
+		if(id == from) {
+			id = to;
+		}
+	};
+	for(Node& n : _nodes) {
+		std::for_each(n.operands.begin(), n.operands.end(), replace);
+	}
+	for(Block& b : _blocks) {
+		replace(b.condition);
+		std::for_each(b.values.begin(), b.values.end(), replace);
+	}
+	for(FrameState& state : _frame_states) {
+		std::for_each(state.registers.begin(), state.registers.end(), replace);
+	}
+}
+
+const std::vector<BlockId>& Graph::reverse_post_order() const {
+	return _rpo;
+}
+
+bool Graph::dominates(BlockId a, BlockId b) const {
+	for(;;) {
+		if(a == b) {
+			return true;
+		}
+		if(!b) {
+			return false;
+		}
+		b = _blocks[b].dominator;
+	}
+}
+
+void Graph::analyze() {
+	// reverse post order, only reachable blocks are kept
+	_rpo.clear();
+	{
+		std::vector<bool> visited(_blocks.size(), false);
+		std::vector<std::pair<BlockId, usize>> stack = {{0, 0}};
+		visited[0] = true;
+		while(!stack.empty()) {
+			auto& [id, next] = stack.back();
+			const auto& succs = _blocks[id].successors;
+			if(next < succs.size()) {
+				BlockId succ = succs[next++];
+				if(!visited[succ]) {
+					visited[succ] = true;
+					stack.push_back({succ, 0});
+				}
+			} else {
+				_rpo.push_back(id);
+				stack.pop_back();
+			}
+		}
+		std::reverse(_rpo.begin(), _rpo.end());
+	}
+
+	_rpo_index.assign(_blocks.size(), u32(-1));
+	for(usize i = 0; i != _rpo.size(); ++i) {
+		_rpo_index[_rpo[i]] = u32(i);
+	}
+
+	// "A Simple, Fast Dominance Algorithm" (Cooper, Harvey, Kennedy)
+	const BlockId undefined = BlockId(-1);
+	for(Block& b : _blocks) {
+		b.dominator = undefined;
+		b.loop_depth = 0;
+	}
+	_blocks[0].dominator = 0;
+
+	auto intersect = [&](BlockId a, BlockId b) {
+		while(a != b) {
+			while(_rpo_index[a] > _rpo_index[b]) {
+				a = _blocks[a].dominator;
+			}
+			while(_rpo_index[b] > _rpo_index[a]) {
+				b = _blocks[b].dominator;
+			}
+		}
+		return a;
+	};
+
+	for(bool changed = true; changed;) {
+		changed = false;
+		for(BlockId id : _rpo) {
+			if(!id) {
+				continue;
+			}
+			BlockId dom = undefined;
+			for(BlockId pred : _blocks[id].predecessors) {
+				if(_blocks[pred].dominator == undefined) {
+					continue;
+				}
+				dom = dom == undefined ? pred : intersect(pred, dom);
+			}
+			if(_blocks[id].dominator != dom) {
+				_blocks[id].dominator = dom;
+				changed = true;
+			}
+		}
+	}
+
+	// natural loops, back edges to the same header share one loop body
+	std::vector<std::vector<bool>> loops(_blocks.size());
+	for(BlockId id : _rpo) {
+		for(BlockId header : _blocks[id].successors) {
+			if(!dominates(header, id)) {
+				continue;
+			}
+			std::vector<bool>& in_loop = loops[header];
+			if(in_loop.empty()) {
+				in_loop.resize(_blocks.size(), false);
+				in_loop[header] = true;
+			}
+			std::vector<BlockId> stack = {id};
+			while(!stack.empty()) {
+				BlockId b = stack.back();
+				stack.pop_back();
+				if(in_loop[b]) {
+					continue;
+				}
+				in_loop[b] = true;
+				for(BlockId pred : _blocks[b].predecessors) {
+					stack.push_back(pred);
+				}
+			}
+		}
+	}
+	for(const std::vector<bool>& in_loop : loops) {
+		for(usize b = 0; b != in_loop.size(); ++b) {
+			_blocks[b].loop_depth += in_loop[b];
+		}
+	}
+}
+
+void Graph::print() const {
+	auto print_node = [&](NodeId id) {
+		const Node& n = _nodes[id];
+		std::printf("\t%%%u = %s", id, ir::op_name(n.op));
+		if(n.op == Op::Param || n.op == Op::Bool || n.op == Op::Constant || n.op == Op::CallResult || n.imm) {
+			std::printf(" #%u", n.imm);
+		}
+		for(NodeId op : n.operands) {
+			std::printf(" %%%u", op);
+		}
+		std::printf(" : %s", type_name(n.type));
+		if(n.is_guard() && n.frame_state != no_frame_state) {
+			const FrameState& state = _frame_states[n.frame_state];
+			std::printf(" [pc %u", state.pc);
+			for(usize r = 0; r != state.registers.size(); ++r) {
+				if(state.registers[r] != no_node) {
+					std::printf(" r%u=%%%u", u32(r), state.registers[r]);
+				}
+			}
+			std::printf("]");
+		}
+		std::printf("\n");
+	};
+
+	for(BlockId id : _rpo) {
+		const Block& b = _blocks[id];
+		std::printf("block %u (pc %u to %u, depth %u, idom %u):", id, b.first_pc, b.last_pc, b.loop_depth, b.dominator);
+		for(BlockId pred : b.predecessors) {
+			std::printf(" %u", pred);
+		}
+		std::printf("\n");
+		std::for_each(b.phis.begin(), b.phis.end(), print_node);
+		std::for_each(b.nodes.begin(), b.nodes.end(), print_node);
+		switch(b.exit) {
+			case Exit::Jump:
+				std::printf("\tjump %u\n", b.successors.front());
+			break;
+
+			case Exit::Branch:
+				std::printf("\tbranch %%%u %u %u\n", b.condition, b.successors[0], b.successors[1]);
+			break;
+
+			case Exit::Return:
+				std::printf("\treturn");
+				for(NodeId v : b.values) {
+					std::printf(" %%%u", v);
+				}
+				std::printf("\n");
+			break;
+		}
+	}
+}
+
+
+
+// calls use for the registers read by the instruction and def for the ones it always writes
+template<typename U, typename D>
+static void visit_registers(Instruction i, U&& use, D&& def) {
+	auto use_rk = [&](u32 rk) {
+		if(!(rk & Instruction::max_k)) {
+			use(rk);
+		}
+	};
+
+	switch(OpCode(i.opcode)) {
+		case OpCode::Move:
+		case OpCode::Unm:
+		case OpCode::Not:
+		case OpCode::Len:
+			use(i.B);
+			def(i.A);
+		break;
+
+		case OpCode::Loadk:
+		case OpCode::Loadbool:
+		case OpCode::Getupval:
+		case OpCode::Newtable:
+			def(i.A);
+		break;
+
+		case OpCode::Loadnil:
+			for(u32 r = 0; r <= i.B; ++r) {
+				def(i.A + r);
+			}
+		break;
+
+		case OpCode::Gettabup:
+			use_rk(i.C);
+			def(i.A);
+		break;
+
+		case OpCode::Gettable:
+			use(i.B);
+			use_rk(i.C);
+			def(i.A);
+		break;
+
+		case OpCode::Settabup:
+			use_rk(i.B);
+			use_rk(i.C);
+		break;
+
+		case OpCode::Setupval:
+		case OpCode::Test:
+			use(i.A);
+		break;
+
+		case OpCode::Settable:
+			use(i.A);
+			use_rk(i.B);
+			use_rk(i.C);
+		break;
+
+		case OpCode::Self:
+			use(i.B);
+			use_rk(i.C);
+			def(i.A);
+			def(i.A + 1);
+		break;
+
+		case OpCode::Add:
+		case OpCode::Sub:
+		case OpCode::Mul:
+		case OpCode::Mod:
+		case OpCode::Pow:
+		case OpCode::Div:
+			use_rk(i.B);
+			use_rk(i.C);
+			def(i.A);
+		break;
+
+		case OpCode::Eq:
+		case OpCode::Lt:
+		case OpCode::Le:
+			use_rk(i.B);
+			use_rk(i.C);
+		break;
+
+		// Testset only writes R(A) on one path
+		case OpCode::Testset:
+			use(i.B);
+		break;
+
+		case OpCode::Call:
+			for(u32 r = 0; r != i.B; ++r) {
+				use(i.A + r);
+			}
+			for(u32 r = 0; r + 1 < i.C; ++r) {
+				def(i.A + r);
+			}
+		break;
+
+		case OpCode::Tforcall:
+			for(u32 r = 0; r != 3; ++r) {
+				use(i.A + r);
+			}
+			for(u32 r = 0; r != i.C; ++r) {
+				def(i.A + 3 + r);
+			}
+		break;
+
+		case OpCode::Return:
+			for(u32 r = 0; r + 1 < i.B; ++r) {
+				use(i.A + r);
+			}
+		break;
+
+		case OpCode::Forloop:
+		case OpCode::Forloopup:
+		case OpCode::Forloopdown:
+			for(u32 r = 0; r != 3; ++r) {
+				use(i.A + r);
+			}
+			def(i.A);
+		break;
+
+		case OpCode::Forprep:
+			for(u32 r = 0; r != 3; ++r) {
+				use(i.A + r);
+			}
+			def(i.A);
+			def(i.A + 1);
+		break;
+
+		case OpCode::Tforloop:
+			use(i.A + 1);
+		break;
+
+		case OpCode::Setlist:
+			for(u32 r = 0; r <= i.B; ++r) {
+				use(i.A + r);
+			}
+		break;
+
+		default:
+		break;
+	}
+}
+
+// instructions whose nodes can be guarded, calls are guarded when inlined
+static bool can_deoptimize(Instruction i) {
+	switch(OpCode(i.opcode)) {
+		case OpCode::Call:
+		case OpCode::Gettable:
+		case OpCode::Settable:
+		case OpCode::Self:
+		case OpCode::Add:
+		case OpCode::Sub:
+		case OpCode::Mul:
+		case OpCode::Mod:
+		case OpCode::Pow:
+		case OpCode::Div:
+		case OpCode::Unm:
+		case OpCode::Len:
+		case OpCode::Forloop:
+		case OpCode::Forloopup:
+		case OpCode::Forloopdown:
+		case OpCode::Forprep:
+		case OpCode::Setlist:
+			return true;
+		default:
+			return false;
+	}
+}
+
+
+
+// SSA construction follows "Simple and Efficient Construction of Static Single Assignment Form" (Braun et al.)
+class GraphBuilder {
+	public:
+		GraphBuilder(Graph& graph) : _graph(graph), _function(graph.function()), _code(_function.instructions.begin(), _function.instructions.end()) {
+			// superinstructions are built like the instructions they are made of
+			for(Instruction& i : _code) {
+				i.opcode = u32(unfused(OpCode(i.opcode)));
+			}
+		}
+
+		bool build();
+
+	private:
+		static bool is_supported(Instruction i);
+		static bool is_test(Instruction i);
+
+		using Registers = std::bitset<Instruction::max_k>;
+
+		bool build_blocks();
+		void compute_liveness();
+		void fill_block(BlockId id);
+		u32 add_frame_state(u32 pc, BlockId block);
+		void seal_block(BlockId id);
+
+		NodeId read(u32 reg, BlockId block);
+		NodeId read_recursive(u32 reg, BlockId block);
+		void write(u32 reg, BlockId block, NodeId value);
+		NodeId add_phi_operands(u32 reg, NodeId phi);
+		NodeId try_remove_trivial_phi(NodeId phi);
+		NodeId resolve(NodeId id) const;
+
+		NodeId constant(u32 index);
+		NodeId rk(u32 rk, BlockId block);
+
+		// 1 for loops going up, -1 for loops going down, 0 if the sign of the step is unknown
+		i32 loop_direction(Instruction i, NodeId step) const;
+
+		void remove_trivial_phis();
+
+		Graph& _graph;
+		const Function& _function;
+		std::vector<Instruction> _code;
+
+		std::vector<BlockId> _block_of;
+		std::vector<std::vector<NodeId>> _defs;
+		std::vector<std::vector<std::pair<u32, NodeId>>> _incomplete_phis;
+		std::vector<bool> _sealed;
+		std::vector<bool> _filled;
+		std::vector<NodeId> _forward;
+
+		// Testset assigns its register only when execution continues to the next instruction
+		std::vector<std::pair<u32, u32>> _entry_copies;
+
+		// registers live before each instruction, only those are part of frame states
+		std::vector<Registers> _live;
+		std::vector<u32> _frame_state_at;
+
+		std::vector<NodeId> _params;
+		NodeId _nil = no_node;
+		std::unordered_map<u32, NodeId> _constants;
+		NodeId _bools[2] = {no_node, no_node};
+};
+
+bool GraphBuilder::is_supported(Instruction i) {
+	switch(OpCode(i.opcode)) {
+		case OpCode::Loadkx:
+		case OpCode::Idiv:
+		case OpCode::Band:
+		case OpCode::Bor:
+		case OpCode::Bxor:
+		case OpCode::Shl:
+		case OpCode::Shr:
+		case OpCode::Bnot:
+		case OpCode::Concat:
+		case OpCode::Tailcall:
+		case OpCode::Closure:
+		case OpCode::Vararg:
+		case OpCode::Extraarg:
+			return false;
+
+		case OpCode::Call:
+			return i.B && i.C;
+
+		case OpCode::Return:
+			return i.B;
+
+		case OpCode::Tforcall:
+		case OpCode::Setlist:
+			return i.C;
+
+		default:
+			return true;
+	}
+}
+
+bool GraphBuilder::is_test(Instruction i) {
+	switch(OpCode(i.opcode)) {
+		case OpCode::Eq:
+		case OpCode::Lt:
+		case OpCode::Le:
+		case OpCode::Test:
+		case OpCode::Testset:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool GraphBuilder::build_blocks() {
+	const auto& code = _code;
+	const u32 size = u32(code.size());
+	if(!size) {
+		return false;
+	}
+
+	auto target = [&](u32 pc) { return u32(i32(pc) + code[pc].sBx() + 2); };
+
+	std::vector<bool> leaders(size + 2, false);
+	leaders[0] = true;
+	for(u32 pc = 0; pc != size; ++pc) {
+		Instruction i = code[pc];
+		if(!is_supported(i)) {
+			return false;
+		}
+		switch(OpCode(i.opcode)) {
+			case OpCode::Jmp:
+			case OpCode::Forloop:
+			case OpCode::Forloopup:
+			case OpCode::Forloopdown:
+			case OpCode::Forprep:
+			case OpCode::Tforloop:
+				if(target(pc) >= size) {
+					return false;
+				}
+				leaders[target(pc)] = true;
+				leaders[pc + 1] = true;
+			break;
+
+			case OpCode::Loadbool:
+				if(i.C) {
+					leaders[pc + 1] = true;
+					leaders[pc + 2] = true;
+				}
+			break;
+
+			case OpCode::Return:
+				leaders[pc + 1] = true;
+			break;
+
+			default:
+				if(is_test(i)) {
+					leaders[pc + 1] = true;
+					leaders[pc + 2] = true;
+				}
+		}
+	}
+
+	// block 0 is an empty entry block, so the first instruction can be a jump target
+	_graph._blocks.emplace_back();
+	_block_of.resize(size);
+	for(u32 pc = 0; pc != size; ++pc) {
+		if(leaders[pc]) {
+			Block& b = _graph._blocks.emplace_back();
+			b.first_pc = pc;
+		}
+		_block_of[pc] = BlockId(_graph._blocks.size() - 1);
+		_graph._blocks.back().last_pc = pc;
+	}
+	_graph._blocks[0].successors.push_back(1);
+
+	for(BlockId id = 1; id != _graph._blocks.size(); ++id) {
+		Block& b = _graph._blocks[id];
+		u32 pc = b.last_pc;
+		Instruction i = code[pc];
+		auto block_at = [&](u32 at) -> BlockId { return at < size ? _block_of[at] : no_node; };
+
+		switch(OpCode(i.opcode)) {
+			case OpCode::Jmp:
+			case OpCode::Forprep:
+				b.successors = {block_at(target(pc))};
+			break;
+
+			case OpCode::Forloop:
+			case OpCode::Forloopup:
+			case OpCode::Forloopdown:
+				b.exit = Exit::Branch;
+				b.successors = {block_at(target(pc)), block_at(pc + 1)};
+			break;
+
+			case OpCode::Tforloop:
+				b.exit = Exit::Branch;
+				b.successors = {block_at(pc + 1), block_at(target(pc))};
+			break;
+
+			case OpCode::Return:
+				b.exit = Exit::Return;
+			break;
+
+			default:
+				if(is_test(i)) {
+					bool expected = OpCode(i.opcode) == OpCode::Test || OpCode(i.opcode) == OpCode::Testset ? i.C : i.A;
+					b.exit = Exit::Branch;
+					b.successors = {block_at(pc + 1), block_at(pc + 2)};
+					if(!expected) {
+						std::swap(b.successors[0], b.successors[1]);
+					}
+				} else if(OpCode(i.opcode) == OpCode::Loadbool && i.C) {
+					b.successors = {block_at(pc + 2)};
+				} else {
+					b.successors = {block_at(pc + 1)};
+				}
+		}
+
+		// falling off the end of the function
+		if(std::find(b.successors.begin(), b.successors.end(), no_node) != b.successors.end()) {
+			return false;
+		}
+	}
+
+	for(BlockId id = 0; id != _graph._blocks.size(); ++id) {
+		for(BlockId succ : _graph._blocks[id].successors) {
+			_graph._blocks[succ].predecessors.push_back(id);
+		}
+	}
+
+	// unreachable blocks are never filled, they must not feed phis
+	_graph.analyze();
+	for(Block& b : _graph._blocks) {
+		auto& preds = b.predecessors;
+		preds.erase(std::remove_if(preds.begin(), preds.end(), [&](BlockId p) { return _graph._rpo_index[p] == u32(-1); }), preds.end());
+	}
+
+	_entry_copies.assign(_graph._blocks.size(), {u32(-1), 0});
+	for(BlockId id : _graph._rpo) {
+		const Block& b = _graph._blocks[id];
+		Instruction i = code[b.last_pc];
+		if(id && OpCode(i.opcode) == OpCode::Testset) {
+			BlockId next = _block_of[b.last_pc + 1];
+			if(_graph._blocks[next].predecessors.size() != 1) {
+				return false;
+			}
+			_entry_copies[next] = {u32(i.A), u32(i.B)};
+		}
+	}
+
+	compute_liveness();
+
+	return true;
+}
+
+void GraphBuilder::compute_liveness() {
+	const auto& code = _code;
+	std::vector<Registers> live_in(_graph._blocks.size());
+
+	auto transfer = [&](u32 pc, Registers& live) {
+		Registers uses;
+		Registers defs;
+		auto set = [](Registers& regs) {
+			return [&regs](u32 r) {
+				if(r < regs.size()) {
+					regs.set(r);
+				}
+			};
+		};
+		visit_registers(code[pc], set(uses), set(defs));
+		live = (live & ~defs) | uses;
+	};
+
+	for(bool changed = true; changed;) {
+		changed = false;
+		for(auto it = _graph._rpo.rbegin(); it != _graph._rpo.rend(); ++it) {
+			if(!*it) {
+				continue;
+			}
+			const Block& b = _graph._blocks[*it];
+			Registers live;
+			for(BlockId succ : b.successors) {
+				live |= live_in[succ];
+			}
+			for(u32 pc = b.last_pc + 1; pc-- != b.first_pc;) {
+				transfer(pc, live);
+			}
+			if(live != live_in[*it]) {
+				live_in[*it] = live;
+				changed = true;
+			}
+		}
+	}
+
+	_live.resize(code.size());
+	for(BlockId id : _graph._rpo) {
+		if(!id) {
+			continue;
+		}
+		const Block& b = _graph._blocks[id];
+		Registers live;
+		for(BlockId succ : b.successors) {
+			live |= live_in[succ];
+		}
+		for(u32 pc = b.last_pc + 1; pc-- != b.first_pc;) {
+			transfer(pc, live);
+			_live[pc] = live;
+		}
+	}
+	_frame_state_at.assign(code.size(), no_frame_state);
+}
+
+NodeId GraphBuilder::resolve(NodeId id) const {
+	while(id != no_node && _forward[id] != no_node) {
+		id = _forward[id];
+	}
+	return id;
+}
+
+void GraphBuilder::write(u32 reg, BlockId block, NodeId value) {
+	_defs[block][reg] = value;
+}
+
+NodeId GraphBuilder::read(u32 reg, BlockId block) {
+	if(reg >= _defs[block].size()) {
+		return _nil;
+	}
+	if(NodeId def = _defs[block][reg]; def != no_node) {
+		return resolve(def);
+	}
+	return read_recursive(reg, block);
+}
+
+NodeId GraphBuilder::read_recursive(u32 reg, BlockId block) {
+	const Block& b = _graph._blocks[block];
+	NodeId value = no_node;
+	if(!_sealed[block]) {
+		value = _graph.add_node(Op::Phi, block, b.first_pc);
+		_forward.push_back(no_node);
+		_graph._blocks[block].phis.push_back(value);
+		_incomplete_phis[block].push_back({reg, value});
+	} else if(b.predecessors.empty()) {
+		value = reg < _params.size() ? _params[reg] : _nil;
+	} else if(b.predecessors.size() == 1) {
+		value = read(reg, b.predecessors.front());
+	} else {
+		value = _graph.add_node(Op::Phi, block, b.first_pc);
+		_forward.push_back(no_node);
+		_graph._blocks[block].phis.push_back(value);
+		write(reg, block, value);
+		value = add_phi_operands(reg, value);
+	}
+	write(reg, block, value);
+	return value;
+}
+
+NodeId GraphBuilder::add_phi_operands(u32 reg, NodeId phi) {
+	BlockId block = _graph._nodes[phi].block;
+	for(BlockId pred : _graph._blocks[block].predecessors) {
+		NodeId value = read(reg, pred);
+		_graph._nodes[phi].operands.push_back(value);
+	}
+	return try_remove_trivial_phi(phi);
+}
+
+NodeId GraphBuilder::try_remove_trivial_phi(NodeId phi) {
+	NodeId same = no_node;
+	for(NodeId op : _graph._nodes[phi].operands) {
+		op = resolve(op);
+		if(op == same || op == phi) {
+			continue;
+		}
+		if(same != no_node) {
+			return phi;
+		}
+		same = op;
+	}
+	if(same == no_node) {
+		same = _nil;
+	}
+	_forward[phi] = same;
+	return same;
+}
+
+void GraphBuilder::seal_block(BlockId id) {
+	for(auto [reg, phi] : _incomplete_phis[id]) {
+		add_phi_operands(reg, phi);
+	}
+	_incomplete_phis[id].clear();
+	_sealed[id] = true;
+}
+
+// the entry block has no instruction, its state is the one in which the function starts
+u32 GraphBuilder::add_frame_state(u32 pc, BlockId block) {
+	if(block && _frame_state_at[pc] != no_frame_state) {
+		return _frame_state_at[pc];
+	}
+	FrameState state;
+	state.pc = pc;
+	state.registers.assign(_function.regs, no_node);
+	for(u32 r = 0; r != _function.regs; ++r) {
+		if(_live[pc][r]) {
+			state.registers[r] = read(r, block);
+		}
+	}
+	u32 index = u32(_graph._frame_states.size());
+	_graph._frame_states.push_back(std::move(state));
+	if(block) {
+		_frame_state_at[pc] = index;
+	}
+	return index;
+}
+
+NodeId GraphBuilder::constant(u32 index) {
+	if(auto it = _constants.find(index); it != _constants.end()) {
+		return it->second;
+	}
+	NodeId id = _graph.add_node(Op::Constant, 0, 0, {}, index);
+	_forward.push_back(no_node);
+	_graph._blocks[0].nodes.push_back(id);
+	_constants[index] = id;
+	return id;
+}
+
+i32 GraphBuilder::loop_direction(Instruction i, NodeId step) const {
+	switch(OpCode(i.opcode)) {
+		case OpCode::Forloopup:
+			return 1;
+		case OpCode::Forloopdown:
+			return -1;
+		default:
+		break;
+	}
+	// Forprep only converts the step, it keeps its sign
+	const NodeId original = _graph._nodes[step].op == Op::ForStep ? _graph._nodes[step].operands[1] : step;
+	const Node& n = _graph._nodes[original];
+	if(n.op != Op::Constant) {
+		return 0;
+	}
+	const Constant& cst = _graph.constant(n.imm);
+	double value = cst.type == ConstantType::Integer ? double(cst.integer) : cst.type == ConstantType::Number ? cst.number : 0.0;
+	return value > 0.0 ? 1 : value < 0.0 ? -1 : 0;
+}
+
+NodeId GraphBuilder::rk(u32 rk, BlockId block) {
+	if(rk & Instruction::max_k) {
+		return constant(rk & Instruction::r_mask);
+	}
+	return read(rk, block);
+}
+
+void GraphBuilder::fill_block(BlockId id) {
+	const u32 regs = std::max(_function.regs, 1u);
+	_defs[id].assign(regs, no_node);
+
+	if(!id) {
+		_graph._blocks[id].exit_state = add_frame_state(0, id);
+		return;
+	}
+
+	const Block& b = _graph._blocks[id];
+	if(auto [dst, src] = _entry_copies[id]; dst != u32(-1)) {
+		write(dst, id, read(src, id));
+	}
+
+	u32 state = no_frame_state;
+	auto add = [&](Op op, u32 pc, std::vector<NodeId> operands, u32 imm = 0) {
+		NodeId n = _graph.add_node(op, id, pc, std::move(operands), imm);
+		_graph._nodes[n].frame_state = state;
+		_forward.push_back(no_node);
+		_graph._blocks[id].nodes.push_back(n);
+		return n;
+	};
+	auto R = [&](u32 reg) { return read(reg, id); };
+	auto RK = [&](u32 reg) { return rk(reg, id); };
+	auto W = [&](u32 reg, NodeId value) { write(reg, id, value); };
+
+	for(u32 pc = b.first_pc; pc <= b.last_pc; ++pc) {
+		Instruction i = _code[pc];
+		state = can_deoptimize(i) || pc == b.last_pc ? add_frame_state(pc, id) : no_frame_state;
+		if(pc == b.last_pc) {
+			_graph._blocks[id].exit_state = state;
+		}
+
+		switch(OpCode(i.opcode)) {
+			case OpCode::Move:
+				W(i.A, R(i.B));
+			break;
+
+			case OpCode::Loadk:
+				W(i.A, constant(i.Bx()));
+			break;
+
+			case OpCode::Loadbool:
+				W(i.A, _bools[i.B ? 1 : 0]);
+			break;
+
+			case OpCode::Loadnil:
+				for(u32 r = 0; r <= i.B; ++r) {
+					W(i.A + r, _nil);
+				}
+			break;
+
+			case OpCode::Getupval:
+				W(i.A, add(Op::GetUpval, pc, {}, i.B));
+			break;
+
+			case OpCode::Gettabup:
+				W(i.A, add(Op::GetTabUp, pc, {RK(i.C)}, i.B));
+			break;
+
+			case OpCode::Gettable:
+				W(i.A, add(Op::GetTable, pc, {R(i.B), RK(i.C)}));
+			break;
+
+			case OpCode::Settabup:
+				add(Op::SetTabUp, pc, {RK(i.B), RK(i.C)}, i.A);
+			break;
+
+			case OpCode::Setupval:
+				add(Op::SetUpval, pc, {R(i.A)}, i.B);
+			break;
+
+			case OpCode::Settable:
+				add(Op::SetTable, pc, {R(i.A), RK(i.B), RK(i.C)});
+			break;
+
+			case OpCode::Newtable:
+				W(i.A, add(Op::NewTable, pc, {}));
+			break;
+
+			case OpCode::Self: {
+				NodeId table = R(i.B);
+				NodeId method = add(Op::GetTable, pc, {table, RK(i.C)});
+				W(i.A + 1, table);
+				W(i.A, method);
+			} break;
+
+			case OpCode::Add:
+			case OpCode::Sub:
+			case OpCode::Mul:
+			case OpCode::Mod:
+			case OpCode::Pow:
+			case OpCode::Div: {
+				Op op = Op(u32(Op::Add) + u32(i.opcode) - u32(OpCode::Add));
+				W(i.A, add(op, pc, {RK(i.B), RK(i.C)}));
+			} break;
+
+			case OpCode::Unm:
+				W(i.A, add(Op::Unm, pc, {R(i.B)}));
+			break;
+
+			case OpCode::Not:
+				W(i.A, add(Op::Not, pc, {R(i.B)}));
+			break;
+
+			case OpCode::Len:
+				W(i.A, add(Op::Len, pc, {R(i.B)}));
+			break;
+
+			case OpCode::Jmp:
+			break;
+
+			case OpCode::Eq:
+			case OpCode::Lt:
+			case OpCode::Le: {
+				Op op = Op(u32(Op::Eq) + u32(i.opcode) - u32(OpCode::Eq));
+				_graph._blocks[id].condition = add(op, pc, {RK(i.B), RK(i.C)});
+			} break;
+
+			case OpCode::Test:
+				_graph._blocks[id].condition = R(i.A);
+			break;
+
+			case OpCode::Testset:
+				_graph._blocks[id].condition = R(i.B);
+			break;
+
+			case OpCode::Call:
+			case OpCode::Tforcall: {
+				bool is_call = OpCode(i.opcode) == OpCode::Call;
+				u32 args = is_call ? i.B - 1 : 2;
+				u32 results = is_call ? i.C - 1 : i.C;
+				u32 first_result = is_call ? i.A : i.A + 3;
+
+				std::vector<NodeId> operands;
+				for(u32 r = 0; r <= args; ++r) {
+					operands.push_back(R(i.A + r));
+				}
+				NodeId call = add(Op::Call, pc, std::move(operands), results);
+				for(u32 r = 0; r != results; ++r) {
+					W(first_result + r, add(Op::CallResult, pc, {call}, r));
+				}
+			} break;
+
+			case OpCode::Return: {
+				Block& block = _graph._blocks[id];
+				for(u32 r = 0; r + 1 < i.B; ++r) {
+					block.values.push_back(R(i.A + r));
+				}
+			} break;
+
+			case OpCode::Forloop:
+			case OpCode::Forloopup:
+			case OpCode::Forloopdown: {
+				NodeId step = R(i.A + 2);
+				NodeId limit = R(i.A + 1);
+				NodeId index = add(Op::Add, pc, {R(i.A), step});
+				// with a known direction the exit test is a plain comparison
+				switch(loop_direction(i, step)) {
+					case 1:
+						_graph._blocks[id].condition = add(Op::Le, pc, {index, limit});
+					break;
+					case -1:
+						_graph._blocks[id].condition = add(Op::Le, pc, {limit, index});
+					break;
+					default:
+						_graph._blocks[id].condition = add(Op::ForCond, pc, {index, limit, step});
+				}
+				W(i.A, index);
+				W(i.A + 3, index);
+			} break;
+
+			// like the interpreter, the limit is checked and the registers converted once before the loop
+			case OpCode::Forprep: {
+				W(i.A + 1, add(Op::ForLimit, pc, {R(i.A), R(i.A + 1), R(i.A + 2)}));
+				NodeId step = add(Op::ForStep, pc, {R(i.A), R(i.A + 2)});
+				W(i.A, add(Op::Sub, pc, {R(i.A), step}));
+				W(i.A + 2, step);
+			} break;
+
+			case OpCode::Tforloop: {
+				NodeId control = R(i.A + 1);
+				_graph._blocks[id].condition = add(Op::Eq, pc, {control, _nil});
+				W(i.A, control);
+			} break;
+
+			case OpCode::Setlist: {
+				std::vector<NodeId> operands;
+				for(u32 r = 0; r <= i.B; ++r) {
+					operands.push_back(R(i.A + r));
+				}
+				add(Op::SetList, pc, std::move(operands), i.C);
+			} break;
+
+			default:
+				// rejected by is_supported
+				assert(false);
+		}
+	}
+}
+
+void GraphBuilder::remove_trivial_phis() {
+	for(bool changed = true; changed;) {
+		changed = false;
+		for(Block& b : _graph._blocks) {
+			for(usize i = 0; i != b.phis.size(); ++i) {
+				NodeId phi = b.phis[i];
+				NodeId same = no_node;
+				bool trivial = true;
+				for(NodeId op : _graph._nodes[phi].operands) {
+					if(op == phi || op == same) {
+						continue;
+					}
+					if(same != no_node) {
+						trivial = false;
+						break;
+					}
+					same = op;
+				}
+				if(trivial) {
+					_graph.replace_uses(phi, same == no_node ? _nil : same);
+					b.phis.erase(b.phis.begin() + i--);
+					changed = true;
+				}
+			}
+		}
+	}
+}
+
+bool GraphBuilder::build() {
+	if(_function.varargs || !build_blocks()) {
+		return false;
+	}
+
+	const usize block_count = _graph._blocks.size();
+	_defs.resize(block_count);
+	_incomplete_phis.resize(block_count);
+	_sealed.assign(block_count, false);
+	_filled.assign(block_count, false);
+
+	auto entry_node = [&](Op op, u32 imm) {
+		NodeId n = _graph.add_node(op, 0, 0, {}, imm);
+		_forward.push_back(no_node);
+		_graph._blocks[0].nodes.push_back(n);
+		return n;
+	};
+	_nil = entry_node(Op::Nil, 0);
+	_bools[0] = entry_node(Op::Bool, 0);
+	_bools[1] = entry_node(Op::Bool, 1);
+	for(u32 i = 0; i != _function.params; ++i) {
+		_params.push_back(entry_node(Op::Param, i));
+	}
+
+	auto all_preds_filled = [&](BlockId id) {
+		const auto& preds = _graph._blocks[id].predecessors;
+		return std::all_of(preds.begin(), preds.end(), [&](BlockId p) { return bool(_filled[p]); });
+	};
+
+	for(BlockId id : _graph._rpo) {
+		if(!_sealed[id] && all_preds_filled(id)) {
+			seal_block(id);
+		}
+		fill_block(id);
+		_filled[id] = true;
+		for(BlockId succ : _graph._blocks[id].successors) {
+			if(!_sealed[succ] && _filled[succ] && all_preds_filled(succ)) {
+				seal_block(succ);
+			}
+		}
+	}
+	for(BlockId id : _graph._rpo) {
+		if(!_sealed[id]) {
+			seal_block(id);
+		}
+	}
+
+	// drop forwarded phis and point everything to the final values
+	for(Block& b : _graph._blocks) {
+		b.phis.erase(std::remove_if(b.phis.begin(), b.phis.end(), [&](NodeId phi) { return _forward[phi] != no_node; }), b.phis.end());
+		b.condition = resolve(b.condition);
+		for(NodeId& v : b.values) {
+			v = resolve(v);
+		}
+	}
+	for(Node& n : _graph._nodes) {
+		for(NodeId& op : n.operands) {
+			op = resolve(op);
+		}
+	}
+	for(FrameState& state : _graph._frame_states) {
+		for(NodeId& reg : state.registers) {
+			reg = resolve(reg);
+		}
+	}
+	remove_trivial_phis();
+
+	return true;
+}
+
+std::unique_ptr<Graph> Graph::build(const Function& function) {
+	std::unique_ptr<Graph> graph(new Graph(function));
+	GraphBuilder builder(*graph);
+	if(!builder.build()) {
+		return nullptr;
+	}
+	graph->analyze();
+	return graph;
+}
+
+}
+}
@@ -0,0 +1,223 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_IR_H
+#define JIT_IR_H
+
+#include <vm/bytecode.h>
+
+#include <vector>
+#include <memory>
+
+namespace jit {
+namespace ir {
+
+using NodeId = u32;
+using BlockId = u32;
+
+static constexpr NodeId no_node = u32(-1);
+static constexpr u32 no_frame_state = u32(-1);
+
+enum class Op : u8 {
+	Param,			// imm = parameter index
+	Nil,
+	Bool,			// imm = value
+	Constant,		// imm = constant index
+	Phi,			// one operand per predecessor
+
+	GetUpval,		// imm = upvalue
+	GetTabUp,		// imm = upvalue				key
+	GetTable,		//								table key
+	Len,			//								table
+
+	SetUpval,		// imm = upvalue				value
+	SetTabUp,		// imm = upvalue				key value
+	SetTable,		//								table key value
+	SetList,		// imm = block of 50 entries	table values...
+	NewTable,
+
+	Add,			//								a b
+	Sub,
+	Mul,
+	Mod,
+	Pow,
+	Div,
+	Unm,			//								a
+	Not,			//								a
+
+	Eq,				//								a b
+	Lt,
+	Le,
+	ForCond,		//								index limit step
+	ForLimit,		// limit as set by Forprep		index limit step
+	ForStep,		// step as set by Forprep		index step
+
+	Call,			// imm = result count			function args...
+	CallResult,		// imm = result index			call
+
+	Sqrt,			// inlined math.sqrt			a
+	Abs,			// inlined math.abs				a
+	Floor,			// inlined math.floor			a
+	Ceil,			// inlined math.ceil			a
+	Min,			// inlined math.min				values...
+	Max,			// inlined math.max				values...
+	Exp,			// inlined math.exp				a
+	Log,			// inlined math.log				a [base]
+	Sin,			// inlined math.sin				a
+	Cos,			// inlined math.cos				a
+	Fmod,			// inlined math.fmod			a b
+
+	GuardNumber,	//								value
+	GuardTable,		//								value
+	GuardTarget,	// imm = target					value
+};
+
+const char* op_name(Op op);
+
+enum class Type : u8 {
+	Unknown,
+	Nil,
+	Bool,
+	Number,
+	String,
+	Table,
+	Function,
+	Any
+};
+
+const char* type_name(Type type);
+
+struct Node {
+	Op op = Op::Nil;
+	Type type = Type::Unknown;
+	BlockId block = 0;
+	u32 imm = 0;
+
+	// bytecode instruction this node comes from
+	u32 pc = 0;
+
+	// interpreter frame to rebuild if this node, or a guard on its operands, fails
+	u32 frame_state = no_frame_state;
+
+	std::vector<NodeId> operands;
+
+	bool is_pure() const;
+	bool is_load() const;
+	bool has_side_effects() const;
+	bool is_guard() const;
+};
+
+// Deoptimization metadata: where the interpreter resumes and what goes in its registers
+struct FrameState {
+	u32 pc = 0;
+
+	// value of each register that is live before the instruction at pc, no_node for dead ones
+	std::vector<NodeId> registers;
+};
+
+enum class Exit : u8 {
+	Jump,		// successors[0]
+	Branch,		// successors[0] if condition is true, successors[1] otherwise
+	Return		// returns values
+};
+
+struct Block {
+	u32 first_pc = 0;
+	u32 last_pc = 0;
+
+	std::vector<NodeId> phis;
+	std::vector<NodeId> nodes;
+
+	std::vector<BlockId> predecessors;
+	std::vector<BlockId> successors;
+
+	Exit exit = Exit::Jump;
+	NodeId condition = no_node;
+	std::vector<NodeId> values;
+
+	// filled by Graph::analyze
+	BlockId dominator = 0;
+	u32 loop_depth = 0;
+
+	// state before the last instruction, nodes moved at the end of the block resume there
+	u32 exit_state = no_frame_state;
+};
+
+// SSA form of a single function, Lua registers are promoted to values.
+// Functions using varargs, variable argument or result counts, or creating closures (which can write to the frame) are not supported.
+class Graph {
+	public:
+		static std::unique_ptr<Graph> build(const Function& function);
+
+		const Function& function() const;
+
+		Node& node(NodeId id);
+		const Node& node(NodeId id) const;
+		usize node_count() const;
+
+		Block& block(BlockId id);
+		const Block& block(BlockId id) const;
+		usize block_count() const;
+
+		NodeId add_node(Op op, BlockId block, u32 pc, std::vector<NodeId> operands = {}, u32 imm = 0);
+		BlockId add_block();
+
+		// starts as the constants of the function, grows when other functions are inlined
+		const Constant& constant(u32 index) const;
+		u32 add_constant(const Constant& constant);
+
+		// functions or tables expected by GuardTarget
+		const void* target(u32 index) const;
+		u32 add_target(const void* target);
+
+		const FrameState& frame_state(u32 index) const;
+		usize frame_state_count() const;
+
+		// replaces every use of from by to, including frame states, from is not removed
+		void replace_uses(NodeId from, NodeId to);
+
+		// computes the reverse post order, dominators and loop depths
+		void analyze();
+
+		const std::vector<BlockId>& reverse_post_order() const;
+		bool dominates(BlockId a, BlockId b) const;
+
+		void print() const;
+
+	private:
+		friend class GraphBuilder;
+
+		Graph(const Function& function);
+
+		const Function& _function;
+		std::vector<Node> _nodes;
+		std::vector<Block> _blocks;
+		std::vector<FrameState> _frame_states;
+		std::vector<Constant> _constants;
+		std::vector<const void*> _targets;
+		std::vector<BlockId> _rpo;
+		std::vector<u32> _rpo_index;
+};
+
+}
+}
+
+#endif // JIT_IR_H
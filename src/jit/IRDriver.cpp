@@ -0,0 +1,152 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "IRDriver.h"
+#include "IRPasses.h"
+#include "IREvaluator.h"
+
+#include <vm/library.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+namespace jit {
+namespace ir {
+
+// tables can be created by the call, so only their types are compared
+static bool same_value(const Value& a, const Value& b) {
+	if(a.type != b.type) {
+		return false;
+	}
+	switch(a.type) {
+		case ValueType::Number:
+			if(a.subtype != b.subtype) {
+				return false;
+			}
+			return a.subtype == NumberType::Integer ? a.integer == b.integer : (a.number == b.number || (a.number != a.number && b.number != b.number));
+		case ValueType::Table:
+			return true;
+		default:
+			return a == b;
+	}
+}
+
+static std::string value_string(const Value& value) {
+	switch(value.type) {
+		case ValueType::None:
+			return "nil";
+		case ValueType::Bool:
+			return value.integer ? "true" : "false";
+		case ValueType::Number: {
+			char buffer[32];
+			return std::string(buffer, number_to_string(value, buffer));
+		}
+		case ValueType::String:
+			return "\"" + std::string(value.string().view()) + "\"";
+		default:
+			return value.type_str();
+	}
+}
+
+Driver::Driver(u32 hot_calls, bool dump, bool check) : _hot_calls(std::max(hot_calls, 1u)), _dump(dump), _check(check) {
+}
+
+void Driver::compile(const Function& function, Entry& entry) {
+	entry.graph = Graph::build(function);
+	if(entry.graph) {
+		optimize(*entry.graph);
+		++_compiled;
+		for(BlockId id : entry.graph->reverse_post_order()) {
+			for(NodeId n : entry.graph->block(id).nodes) {
+				entry.side_effects |= entry.graph->node(n).has_side_effects();
+			}
+		}
+	} else {
+		++_unsupported;
+	}
+	if(_dump) {
+		// graphs are printed with printf, after what the program already wrote
+		lib::output().flush();
+		std::printf("==== %s%s\n", function_name(function).c_str(), entry.graph ? "" : ": not supported");
+		if(entry.graph) {
+			entry.graph->print();
+		}
+	}
+}
+
+u32 Driver::check(VM& vm, const Function& function, const Entry& entry, Span<Value> args, MutableSpan<Value> results) {
+	// the interpreter passes arguments and results in the same registers
+	const std::vector<Value> arg_values(args.begin(), args.end());
+	const Span<Value> in(arg_values.data(), arg_values.size());
+
+	bool deoptimized = false;
+	if(entry.side_effects) {
+		++_replaced_calls;
+		const u32 count = evaluate(*entry.graph, vm, in, results, deoptimized);
+		_deoptimizations += deoptimized;
+		return count;
+	}
+
+	++_checked_calls;
+	std::vector<Value> ir_results(results.size());
+	const u32 ir_count = evaluate(*entry.graph, vm, in, MutableSpan<Value>(ir_results.data(), ir_results.size()), deoptimized);
+	_deoptimizations += deoptimized;
+
+	const u32 count = vm.call(Value(&function), in, results);
+	if(ir_count != count) {
+		++_mismatches;
+		std::fprintf(stderr, "IR mismatch in %s: %u results, the interpreter returned %u\n", function_name(function).c_str(), ir_count, count);
+		return count;
+	}
+	for(u32 i = 0; i != count; ++i) {
+		if(!same_value(ir_results[i], results[i])) {
+			++_mismatches;
+			std::fprintf(stderr, "IR mismatch in %s: result %u is %s, the interpreter returned %s\n", function_name(function).c_str(), i + 1,
+				value_string(ir_results[i]).c_str(), value_string(results[i]).c_str());
+			break;
+		}
+	}
+	return count;
+}
+
+bool Driver::call(VM& vm, const Function& function, Span<Value> args, MutableSpan<Value> results, u32& count) {
+	Entry& entry = _functions[&function];
+	if(entry.calls < _hot_calls && ++entry.calls == _hot_calls) {
+		compile(function, entry);
+	}
+	if(!_check || !entry.graph) {
+		return false;
+	}
+	count = check(vm, function, entry, args, results);
+	return true;
+}
+
+void Driver::print_summary(std::FILE* file) const {
+	std::fprintf(file, "IR check: %llu functions compiled, %llu not supported, %llu calls checked, %llu calls replaced, %llu deoptimizations, %llu mismatches\n",
+		static_cast<unsigned long long>(_compiled), static_cast<unsigned long long>(_unsupported),
+		static_cast<unsigned long long>(_checked_calls), static_cast<unsigned long long>(_replaced_calls),
+		static_cast<unsigned long long>(_deoptimizations), static_cast<unsigned long long>(_mismatches));
+}
+
+}
+}
@@ -0,0 +1,75 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_IRDRIVER_H
+#define JIT_IRDRIVER_H
+
+#include "IR.h"
+
+#include <vm/VM.h>
+
+#include <cstdio>
+#include <unordered_map>
+
+namespace jit {
+namespace ir {
+
+// Builds and optimizes the graph of functions once they are hot, to try the IR on real programs.
+// With check set the graphs then run in place of the interpreter (see evaluate):
+// calls to graphs without side effects also run in the interpreter and both results are compared,
+// the other graphs only run through the IR, the output of the program shows if they behave differently.
+class Driver : public CallHandler {
+	public:
+		// functions are compiled on their hot_calls-th call, dump prints their graphs
+		Driver(u32 hot_calls, bool dump, bool check);
+
+		bool call(VM& vm, const Function& function, Span<Value> args, MutableSpan<Value> results, u32& count) override;
+
+		// Counts of compiled functions, calls that ran through the IR and mismatches
+		void print_summary(std::FILE* file) const;
+
+	private:
+		struct Entry {
+			u32 calls = 0;
+			std::unique_ptr<Graph> graph;
+			bool side_effects = false;
+		};
+
+		void compile(const Function& function, Entry& entry);
+		u32 check(VM& vm, const Function& function, const Entry& entry, Span<Value> args, MutableSpan<Value> results);
+
+		std::unordered_map<const Function*, Entry> _functions;
+		u32 _hot_calls = 1;
+		bool _dump = false;
+		bool _check = false;
+
+		u64 _compiled = 0;
+		u64 _unsupported = 0;
+		u64 _checked_calls = 0;
+		u64 _replaced_calls = 0;
+		u64 _deoptimizations = 0;
+		u64 _mismatches = 0;
+};
+
+}
+}
+
+#endif // JIT_IRDRIVER_H
@@ -0,0 +1,358 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "IREvaluator.h"
+#include "IRPasses.h"
+
+#include <vm/Table.h>
+#include <vm/library.h>
+#include <vm/operators.h>
+
+#include <algorithm>
+
+namespace jit {
+namespace ir {
+
+// like the interpreter, strings find their methods in the string library (GetTable also comes from Self)
+static Value get_table(const Value& object, const Value& key) {
+	if(object.type == ValueType::String) {
+		return lib::string_library()->get(key);
+	}
+	if(object.type == ValueType::Userdata) {
+		return object.userdata().methods->get(key);
+	}
+	if(object.type != ValueType::Table) {
+		throw TypeErrorException(ValueType::Table, object.type);
+	}
+	return object.table().get(key);
+}
+
+static Table& table_operand(const Value& value) {
+	if(value.type != ValueType::Table) {
+		throw TypeErrorException(ValueType::Table, value.type);
+	}
+	return value.table();
+}
+
+class Evaluator {
+	public:
+		Evaluator(const Graph& graph, VM& vm) : _graph(graph), _vm(vm), _values(graph.node_count()), _calls(graph.node_count()) {
+		}
+
+		u32 run(Span<Value> args, MutableSpan<Value> results, bool& deoptimized) {
+			_args = args;
+			deoptimized = false;
+
+			BlockId prev = 0;
+			BlockId id = 0;
+			for(;;) {
+				const Block& block = _graph.block(id);
+
+				// phis take the values of the edge they come from, all at once
+				if(!block.phis.empty()) {
+					const usize edge = usize(std::find(block.predecessors.begin(), block.predecessors.end(), prev) - block.predecessors.begin());
+					std::vector<Value> incoming;
+					for(NodeId phi : block.phis) {
+						incoming.push_back(_values[_graph.node(phi).operands[edge]]);
+					}
+					for(usize i = 0; i != incoming.size(); ++i) {
+						_values[block.phis[i]] = incoming[i];
+					}
+				}
+
+				for(NodeId node : block.nodes) {
+					if(!eval(node)) {
+						deoptimized = true;
+						return deoptimize(_graph.node(node), results);
+					}
+				}
+
+				prev = id;
+				switch(block.exit) {
+					case Exit::Jump:
+						id = block.successors[0];
+					break;
+
+					case Exit::Branch:
+						id = block.successors[_values[block.condition].to_bool() ? 0 : 1];
+					break;
+
+					case Exit::Return: {
+						const u32 count = u32(std::min(results.size(), block.values.size()));
+						for(u32 i = 0; i != count; ++i) {
+							results[i] = _values[block.values[i]];
+						}
+						return count;
+					}
+				}
+			}
+		}
+
+	private:
+		const Value& operand(const Node& node, usize index) const {
+			return _values[node.operands[index]];
+		}
+
+		// returns false if the node failed and the interpreter has to take over
+		bool eval(NodeId id) {
+			const Node& node = _graph.node(id);
+			try {
+				return eval(node, _values[id], _calls[id]);
+			} catch(ExecutionException& e) {
+				if(!e.instruction) {
+					e.instruction = _graph.function().instructions.begin() + node.pc;
+				}
+				throw;
+			}
+		}
+
+		bool eval(const Node& node, Value& value, std::vector<Value>& call_results) {
+			auto a = [&]() -> const Value& { return operand(node, 0); };
+			auto b = [&]() -> const Value& { return operand(node, 1); };
+
+			switch(node.op) {
+				case Op::Param:
+					value = node.imm < _args.size() ? _args[node.imm] : Value();
+				break;
+
+				case Op::Nil:
+					value = Value();
+				break;
+
+				case Op::Bool:
+					value = Value::from_bool(node.imm);
+				break;
+
+				case Op::Constant:
+					value = Value(_graph.constant(node.imm));
+				break;
+
+				case Op::Phi:
+				break;
+
+				case Op::GetUpval:
+					value = _vm.callee_upvalue(_graph.function().upvalues[node.imm]);
+				break;
+
+				case Op::GetTabUp:
+					value = table_operand(_vm.callee_upvalue(_graph.function().upvalues[node.imm])).get(a());
+				break;
+
+				case Op::GetTable:
+					value = get_table(a(), b());
+				break;
+
+				case Op::Len:
+					if(a().type == ValueType::String) {
+						set_integer(value, i64(a().string_size()));
+					} else {
+						set_integer(value, i64(table_operand(a()).size()));
+					}
+				break;
+
+				case Op::SetUpval:
+					_vm.callee_upvalue(_graph.function().upvalues[node.imm]) = a();
+				break;
+
+				// the table is created on first use, like in the interpreter
+				case Op::SetTabUp: {
+					Value& up = _vm.callee_upvalue(_graph.function().upvalues[node.imm]);
+					if(up.type == ValueType::None) {
+						up = new Table();
+					}
+					table_operand(up).set(a(), b());
+				} break;
+
+				case Op::SetTable:
+					table_operand(a()).set(b(), operand(node, 2));
+				break;
+
+				case Op::SetList: {
+					Table& list = table_operand(a());
+					const i64 start = (i64(node.imm) - 1) * 50;
+					for(usize i = 1; i != node.operands.size(); ++i) {
+						list.set(Value::from_integer(start + i64(i)), operand(node, i));
+					}
+				} break;
+
+				case Op::NewTable:
+					value = new Table();
+				break;
+
+				case Op::Add:
+					arithmetic(value, a(), b(), int_add, [](double x, double y) { return x + y; });
+				break;
+
+				case Op::Sub:
+					arithmetic(value, a(), b(), int_sub, [](double x, double y) { return x - y; });
+				break;
+
+				case Op::Mul:
+					arithmetic(value, a(), b(), int_mul, [](double x, double y) { return x * y; });
+				break;
+
+				case Op::Mod:
+					arithmetic(value, a(), b(), [](i64 x, i64 y) { return int_mod(x, nonzero(y)); }, float_mod);
+				break;
+
+				case Op::Pow:
+					set_number(value, std::pow(float_value(a()), float_value(b())));
+				break;
+
+				case Op::Div:
+					set_number(value, float_value(a()) / float_value(b()));
+				break;
+
+				case Op::Unm:
+					if(is_integer(a())) {
+						set_integer(value, int_sub(0, a().integer));
+					} else {
+						set_number(value, -float_value(a()));
+					}
+				break;
+
+				case Op::Not:
+					value = Value::from_bool(!a().to_bool());
+				break;
+
+				case Op::Eq:
+					value = Value::from_bool(a() == b());
+				break;
+
+				case Op::Lt:
+					value = Value::from_bool(less_than(a(), b()));
+				break;
+
+				case Op::Le:
+					value = Value::from_bool(less_equal(a(), b()));
+				break;
+
+				// same test as Forloop, the step was checked by Forprep
+				case Op::ForCond: {
+					const Value& step = operand(node, 2);
+					const bool up = is_integer(step) ? step.integer > 0 : float_value(step) > 0.0;
+					value = Value::from_bool(up ? less_equal(a(), b()) : less_equal(b(), a()));
+				} break;
+
+				case Op::ForLimit: {
+					Value index = a();
+					Value limit = b();
+					Value step = operand(node, 2);
+					if(!prepare_loop(index, limit, step)) {
+						return false;
+					}
+					value = limit;
+				} break;
+
+				case Op::ForStep:
+					if(is_integer(a()) && is_integer(b())) {
+						value = b();
+					} else {
+						set_number(value, float_value(b()));
+					}
+				break;
+
+				case Op::Call: {
+					std::vector<Value> args;
+					for(usize i = 1; i != node.operands.size(); ++i) {
+						args.push_back(operand(node, i));
+					}
+					call_results.assign(node.imm, Value());
+					_vm.call(a(), Span<Value>(args.data(), args.size()), MutableSpan<Value>(call_results.data(), call_results.size()));
+				} break;
+
+				case Op::CallResult:
+					value = _calls[node.operands.front()][node.imm];
+				break;
+
+				case Op::Sqrt:
+				case Op::Abs:
+				case Op::Floor:
+				case Op::Ceil:
+				case Op::Min:
+				case Op::Max:
+				case Op::Exp:
+				case Op::Log:
+				case Op::Sin:
+				case Op::Cos:
+				case Op::Fmod: {
+					std::vector<Value> args;
+					for(usize i = 0; i != node.operands.size(); ++i) {
+						args.push_back(operand(node, i));
+					}
+					value = Value();
+					builtin_function(node.op)(MutableSpan<Value>(&value, 1), Span<Value>(args.data(), args.size()));
+				} break;
+
+				case Op::GuardNumber:
+					if(a().type != ValueType::Number) {
+						return false;
+					}
+					value = a();
+				break;
+
+				case Op::GuardTable:
+					if(a().type != ValueType::Table) {
+						return false;
+					}
+					value = a();
+				break;
+
+				case Op::GuardTarget:
+					if(a().c_ptr != _graph.target(node.imm)) {
+						return false;
+					}
+					value = a();
+				break;
+			}
+			return true;
+		}
+
+		u32 deoptimize(const Node& node, MutableSpan<Value> results) {
+			const Function& function = _graph.function();
+			if(node.frame_state == no_frame_state) {
+				fatal("Failing node without frame state.");
+			}
+			const FrameState& state = _graph.frame_state(node.frame_state);
+			std::vector<Value> registers(function.regs);
+			for(usize r = 0; r != std::min(registers.size(), state.registers.size()); ++r) {
+				if(state.registers[r] != no_node) {
+					registers[r] = _values[state.registers[r]];
+				}
+			}
+			return _vm.deoptimize(function, state.pc, Span<Value>(registers.data(), registers.size()), results);
+		}
+
+		const Graph& _graph;
+		VM& _vm;
+		Span<Value> _args;
+		std::vector<Value> _values;
+		// results of Call nodes
+		std::vector<std::vector<Value>> _calls;
+};
+
+u32 evaluate(const Graph& graph, VM& vm, Span<Value> args, MutableSpan<Value> results, bool& deoptimized) {
+	return Evaluator(graph, vm).run(args, results, deoptimized);
+}
+
+}
+}
@@ -0,0 +1,41 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_IREVALUATOR_H
+#define JIT_IREVALUATOR_H
+
+#include "IR.h"
+
+#include <vm/VM.h>
+
+namespace jit {
+namespace ir {
+
+// Runs a graph on values with the semantics of the interpreter, to check the IR without a backend.
+// vm must be about to call the graph's function (see CallHandler), args are the arguments of the call.
+// A failing guard rebuilds the frame from its FrameState and the interpreter finishes the call, deoptimized is then set.
+// Returns the number of results written, like VM::call.
+u32 evaluate(const Graph& graph, VM& vm, Span<Value> args, MutableSpan<Value> results, bool& deoptimized);
+
+}
+}
+
+#endif // JIT_IREVALUATOR_H
@@ -0,0 +1,858 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "IRPasses.h"
+
+#include <vm/Value.h>
+#include <vm/library.h>
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+namespace jit {
+namespace ir {
+
+static Type join(Type a, Type b) {
+	if(a == Type::Unknown) {
+		return b;
+	}
+	if(b == Type::Unknown || a == b) {
+		return a;
+	}
+	return Type::Any;
+}
+
+static Type constant_type(const Constant& cst) {
+	switch(cst.type) {
+		case ConstantType::None:
+			return Type::Nil;
+		case ConstantType::Number:
+		case ConstantType::Integer:
+			return Type::Number;
+		case ConstantType::String:
+		case ConstantType::LongString:
+			return Type::String;
+	}
+	return Type::Any;
+}
+
+static bool is_arithmetic(Op op) {
+	switch(op) {
+		case Op::Add:
+		case Op::Sub:
+		case Op::Mul:
+		case Op::Mod:
+		case Op::Pow:
+		case Op::Div:
+		case Op::Unm:
+		case Op::ForCond:
+		case Op::ForLimit:
+		case Op::ForStep:
+		case Op::Sqrt:
+		case Op::Abs:
+		case Op::Floor:
+		case Op::Ceil:
+		case Op::Min:
+		case Op::Max:
+		case Op::Exp:
+		case Op::Log:
+		case Op::Sin:
+		case Op::Cos:
+		case Op::Fmod:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// the first operand of these must be a table
+static bool has_table_operand(Op op) {
+	switch(op) {
+		case Op::GetTable:
+		case Op::SetTable:
+		case Op::SetList:
+		case Op::Len:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool is_number(const Graph& graph, NodeId id) {
+	return graph.node(id).type == Type::Number;
+}
+
+static bool can_fail(const Graph& graph, const Node& n) {
+	if((is_arithmetic(n.op) && n.op != Op::ForLimit) || n.op == Op::Lt || n.op == Op::Le) {
+		return !std::all_of(n.operands.begin(), n.operands.end(), [&](NodeId op) { return is_number(graph, op); });
+	}
+	if(has_table_operand(n.op)) {
+		return graph.node(n.operands.front()).type != Type::Table;
+	}
+	// ForLimit fails when the interpreter would skip the loop
+	return n.op == Op::GetTabUp || n.op == Op::ForLimit || n.is_guard() || n.has_side_effects();
+}
+
+static Type node_type(const Graph& graph, const Node& n) {
+	switch(n.op) {
+		case Op::Nil:
+			return Type::Nil;
+
+		case Op::Bool:
+		case Op::Not:
+		case Op::Eq:
+		case Op::Lt:
+		case Op::Le:
+		case Op::ForCond:
+			return Type::Bool;
+
+		case Op::Constant:
+			return constant_type(graph.constant(n.imm));
+
+		case Op::Phi: {
+			Type type = Type::Unknown;
+			for(NodeId op : n.operands) {
+				type = join(type, graph.node(op).type);
+			}
+			return type;
+		}
+
+		case Op::Add:
+		case Op::Sub:
+		case Op::Mul:
+		case Op::Mod:
+		case Op::Pow:
+		case Op::Div:
+		case Op::Unm:
+		case Op::Len:
+		case Op::Sqrt:
+		case Op::Abs:
+		case Op::Floor:
+		case Op::Ceil:
+		case Op::Min:
+		case Op::Max:
+		case Op::Exp:
+		case Op::Log:
+		case Op::Sin:
+		case Op::Cos:
+		case Op::Fmod:
+		case Op::ForLimit:
+		case Op::ForStep:
+		case Op::GuardNumber:
+			return Type::Number;
+
+		case Op::GuardTarget:
+			return Type::Function;
+
+		case Op::NewTable:
+		case Op::GuardTable:
+			return Type::Table;
+
+		case Op::Param:
+		case Op::GetUpval:
+		case Op::GetTabUp:
+		case Op::GetTable:
+		case Op::CallResult:
+			return Type::Any;
+
+		default:
+			return Type::Unknown;
+	}
+}
+
+void infer_types(Graph& graph) {
+	for(usize i = 0; i != graph.node_count(); ++i) {
+		graph.node(NodeId(i)).type = Type::Unknown;
+	}
+
+	// types only go up the lattice, so this terminates
+	for(bool changed = true; changed;) {
+		changed = false;
+		for(BlockId id : graph.reverse_post_order()) {
+			const Block& b = graph.block(id);
+			for(const auto* list : {&b.phis, &b.nodes}) {
+				for(NodeId n : *list) {
+					Type type = node_type(graph, graph.node(n));
+					if(type != graph.node(n).type) {
+						graph.node(n).type = type;
+						changed = true;
+					}
+				}
+			}
+		}
+	}
+}
+
+// Type feedback operands are numbered like the node operands for these
+static bool has_matching_feedback(const Node& n, OpCode op) {
+	switch(op) {
+		case OpCode::Add:
+		case OpCode::Sub:
+		case OpCode::Mul:
+		case OpCode::Mod:
+		case OpCode::Pow:
+		case OpCode::Div:
+		case OpCode::Unm:
+			return is_arithmetic(n.op) && n.op != Op::ForCond;
+		case OpCode::Gettable:
+		case OpCode::Self:
+			return n.op == Op::GetTable;
+		case OpCode::Settable:
+			return n.op == Op::SetTable;
+		case OpCode::Len:
+			return n.op == Op::Len;
+		case OpCode::Lt:
+		case OpCode::Le:
+			return n.op == Op::Lt || n.op == Op::Le;
+		default:
+			return false;
+	}
+}
+
+// true if the interpreter saw the operand with another type, a guard would always end up failing
+static bool is_polymorphic(const Graph& graph, const Node& n, usize operand, ValueType expected) {
+	const Function& function = graph.function();
+	if(function.feedback.empty() || operand >= TypeFeedback::max_operands) {
+		return false;
+	}
+	if(!has_matching_feedback(n, unfused(OpCode(function.instructions[n.pc].opcode)))) {
+		return false;
+	}
+	u16 seen = function.feedback[n.pc].types[operand];
+	return seen & ~u16(1 << u32(expected));
+}
+
+void specialize_types(Graph& graph) {
+	infer_types(graph);
+
+	for(BlockId id : graph.reverse_post_order()) {
+		for(usize i = 0; i != graph.block(id).nodes.size(); ++i) {
+			NodeId n = graph.block(id).nodes[i];
+			auto guard = [&](usize operand, Op op, Type type) {
+				NodeId value = graph.node(n).operands[operand];
+				if(graph.node(value).type == type) {
+					return;
+				}
+				ValueType expected = type == Type::Number ? ValueType::Number : ValueType::Table;
+				if(is_polymorphic(graph, graph.node(n), operand, expected)) {
+					return;
+				}
+				NodeId g = graph.add_node(op, id, graph.node(n).pc, {value});
+				graph.node(g).type = type;
+				graph.node(g).frame_state = graph.node(n).frame_state;
+				graph.node(n).operands[operand] = g;
+				auto& nodes = graph.block(id).nodes;
+				nodes.insert(nodes.begin() + i++, g);
+			};
+
+			Op op = graph.node(n).op;
+			if(is_arithmetic(op) || op == Op::Lt || op == Op::Le) {
+				for(usize k = 0; k != graph.node(n).operands.size(); ++k) {
+					guard(k, Op::GuardNumber, Type::Number);
+				}
+			} else if(has_table_operand(op)) {
+				guard(0, Op::GuardTable, Type::Table);
+			}
+		}
+	}
+
+	infer_types(graph);
+}
+
+// Library functions that are a single node
+struct Builtin {
+	FunctionPtr function;
+	Op op;
+	u32 min_args;
+	u32 max_args;
+};
+
+static const Builtin builtins[] = {
+	{&lib::math_sqrt, Op::Sqrt, 1, 1},
+	{&lib::math_abs, Op::Abs, 1, 1},
+	{&lib::math_floor, Op::Floor, 1, 1},
+	{&lib::math_ceil, Op::Ceil, 1, 1},
+	{&lib::math_min, Op::Min, 1, u32(-1)},
+	{&lib::math_max, Op::Max, 1, u32(-1)},
+	{&lib::math_exp, Op::Exp, 1, 1},
+	{&lib::math_log, Op::Log, 1, 2},
+	{&lib::math_sin, Op::Sin, 1, 1},
+	{&lib::math_cos, Op::Cos, 1, 1},
+	{&lib::math_fmod, Op::Fmod, 2, 2},
+};
+
+FunctionPtr builtin_function(Op op) {
+	for(const Builtin& builtin : builtins) {
+		if(builtin.op == op) {
+			return builtin.function;
+		}
+	}
+	return nullptr;
+}
+
+static constexpr usize max_inlined_nodes = 32;
+
+// Callee seen by the interpreter at a call, if there ever was only one
+static const void* call_target(const Graph& graph, const Node& call, ValueType type) {
+	const Function& function = graph.function();
+	if(function.feedback.empty() || OpCode(function.instructions[call.pc].opcode) != OpCode::Call) {
+		return nullptr;
+	}
+	const TypeFeedback& feedback = function.feedback[call.pc];
+	if(feedback.polymorphic || feedback.types[0] != u16(1 << u32(type))) {
+		return nullptr;
+	}
+	return feedback.target;
+}
+
+// Failing guards of an inlined function resume at the call, and run it again in the interpreter.
+// This is only correct if nothing visible happened in the callee, so functions with side effects or loops are not inlined.
+static std::unique_ptr<Graph> build_inlined(const Graph& graph, const Function& callee, usize args) {
+	if(&callee == &graph.function() || callee.varargs || callee.params != args) {
+		return nullptr;
+	}
+	std::unique_ptr<Graph> inlined = Graph::build(callee);
+	if(!inlined) {
+		return nullptr;
+	}
+	usize node_count = 0;
+	for(BlockId id : inlined->reverse_post_order()) {
+		const Block& b = inlined->block(id);
+		if(b.loop_depth) {
+			return nullptr;
+		}
+		for(NodeId n : b.nodes) {
+			const Node& node = inlined->node(n);
+			// upvalues are relative to the callee frame, which doesn't exist anymore
+			if(node.has_side_effects() || node.op == Op::GetUpval || node.op == Op::GetTabUp) {
+				return nullptr;
+			}
+		}
+		node_count += id ? b.phis.size() + b.nodes.size() : 0;
+	}
+	if(node_count > max_inlined_nodes) {
+		return nullptr;
+	}
+	specialize_types(*inlined);
+	return inlined;
+}
+
+static NodeId add_entry_node(Graph& graph, Op op, u32 imm = 0) {
+	NodeId n = graph.add_node(op, 0, 0, {}, imm);
+	graph.block(0).nodes.push_back(n);
+	return n;
+}
+
+// Replaces the call at nodes[index] of block id, the rest of the block moves to a new block which is returned
+static BlockId inline_call(Graph& graph, BlockId id, usize index, u32 target, const Graph* inlined, const Builtin* builtin) {
+	const NodeId call_id = graph.block(id).nodes[index];
+	const Node call = graph.node(call_id);
+	const NodeId nil = add_entry_node(graph, Op::Nil);
+
+	auto add = [&](Op op, BlockId block, std::vector<NodeId> operands, u32 imm = 0) {
+		NodeId n = graph.add_node(op, block, call.pc, std::move(operands), imm);
+		graph.node(n).frame_state = call.frame_state;
+		return n;
+	};
+
+	// the call and its results are removed
+	std::vector<NodeId> results(call.imm, no_node);
+	std::vector<NodeId> rest;
+	{
+		auto& nodes = graph.block(id).nodes;
+		for(usize i = index + 1; i != nodes.size(); ++i) {
+			const Node& n = graph.node(nodes[i]);
+			if(n.op == Op::CallResult && n.operands.front() == call_id) {
+				results[n.imm] = nodes[i];
+				graph.node(nodes[i]).operands.clear();
+			} else {
+				rest.push_back(nodes[i]);
+			}
+		}
+		nodes.resize(index);
+		nodes.push_back(add(Op::GuardTarget, id, {call.operands.front()}, target));
+		graph.node(call_id).operands.clear();
+	}
+
+	std::vector<NodeId> values(call.imm, nil);
+	BlockId next = id;
+
+	if(builtin) {
+		std::vector<NodeId> args(call.operands.begin() + 1, call.operands.end());
+		for(NodeId& arg : args) {
+			if(graph.node(arg).type != Type::Number) {
+				arg = add(Op::GuardNumber, id, {arg});
+				graph.node(arg).type = Type::Number;
+				graph.block(id).nodes.push_back(arg);
+			}
+		}
+		NodeId value = add(builtin->op, id, std::move(args));
+		graph.block(id).nodes.push_back(value);
+		if(!values.empty()) {
+			values[0] = value;
+		}
+		auto& nodes = graph.block(id).nodes;
+		nodes.insert(nodes.end(), rest.begin(), rest.end());
+	} else {
+		next = graph.add_block();
+		std::vector<BlockId> block_map(inlined->block_count(), no_node);
+		for(BlockId b : inlined->reverse_post_order()) {
+			block_map[b] = b ? graph.add_block() : id;
+		}
+
+		// the continuation takes the exit of the calling block
+		{
+			Block& from = graph.block(id);
+			Block& to = graph.block(next);
+			to.first_pc = call.pc;
+			to.last_pc = from.last_pc;
+			to.nodes = std::move(rest);
+			to.exit = from.exit;
+			to.condition = from.condition;
+			to.values = std::move(from.values);
+			to.successors = std::move(from.successors);
+			to.exit_state = from.exit_state;
+			for(NodeId n : to.nodes) {
+				graph.node(n).block = next;
+			}
+			for(BlockId succ : to.successors) {
+				auto& preds = graph.block(succ).predecessors;
+				std::replace(preds.begin(), preds.end(), id, next);
+			}
+
+			from.last_pc = call.pc;
+			from.exit = Exit::Jump;
+			from.condition = no_node;
+			from.values.clear();
+			from.successors.clear();
+			from.exit_state = call.frame_state;
+		}
+
+		std::vector<NodeId> node_map(inlined->node_count(), no_node);
+		for(NodeId n : inlined->block(0).nodes) {
+			const Node& node = inlined->node(n);
+			switch(node.op) {
+				case Op::Param:
+					node_map[n] = call.operands[node.imm + 1];
+				break;
+
+				case Op::Constant:
+					node_map[n] = add_entry_node(graph, Op::Constant, graph.add_constant(inlined->constant(node.imm)));
+				break;
+
+				default:
+					node_map[n] = add_entry_node(graph, node.op, node.imm);
+			}
+		}
+
+		std::vector<std::vector<NodeId>> returned;
+		for(BlockId b : inlined->reverse_post_order()) {
+			if(!b) {
+				continue;
+			}
+			const Block& src = inlined->block(b);
+			const BlockId dst_id = block_map[b];
+			for(const auto* list : {&src.phis, &src.nodes}) {
+				for(NodeId n : *list) {
+					const Node& node = inlined->node(n);
+					NodeId copy = add(node.op, dst_id, node.operands, node.imm);
+					graph.node(copy).type = node.type;
+					node_map[n] = copy;
+					auto& dst_list = list == &src.phis ? graph.block(dst_id).phis : graph.block(dst_id).nodes;
+					dst_list.push_back(copy);
+				}
+			}
+
+			Block& dst = graph.block(dst_id);
+			dst.first_pc = call.pc;
+			dst.last_pc = call.pc;
+			dst.exit_state = call.frame_state;
+			for(BlockId pred : src.predecessors) {
+				dst.predecessors.push_back(block_map[pred]);
+			}
+			if(src.exit == Exit::Return) {
+				dst.exit = Exit::Jump;
+				dst.successors = {next};
+				graph.block(next).predecessors.push_back(dst_id);
+				returned.push_back(src.values);
+			} else {
+				dst.exit = src.exit;
+				dst.condition = src.condition;
+				for(BlockId succ : src.successors) {
+					dst.successors.push_back(block_map[succ]);
+				}
+			}
+		}
+		graph.block(id).successors = {block_map[inlined->block(0).successors.front()]};
+
+		auto remap = [&](NodeId& n) {
+			if(n != no_node) {
+				n = node_map[n];
+			}
+		};
+		for(BlockId b : inlined->reverse_post_order()) {
+			Block& dst = graph.block(block_map[b]);
+			if(!b) {
+				continue;
+			}
+			remap(dst.condition);
+			for(const auto* list : {&dst.phis, &dst.nodes}) {
+				for(NodeId n : *list) {
+					std::for_each(graph.node(n).operands.begin(), graph.node(n).operands.end(), remap);
+				}
+			}
+		}
+		for(auto& ret : returned) {
+			std::for_each(ret.begin(), ret.end(), remap);
+		}
+
+		// results of functions with several returns are joined by phis
+		for(usize r = 0; r != values.size(); ++r) {
+			auto value_of = [&](const std::vector<NodeId>& ret) { return r < ret.size() ? ret[r] : nil; };
+			if(returned.size() == 1) {
+				values[r] = value_of(returned.front());
+				continue;
+			}
+			std::vector<NodeId> operands;
+			std::transform(returned.begin(), returned.end(), std::back_inserter(operands), value_of);
+			values[r] = graph.add_node(Op::Phi, next, call.pc, std::move(operands));
+			graph.block(next).phis.push_back(values[r]);
+		}
+	}
+
+	for(usize r = 0; r != results.size(); ++r) {
+		if(results[r] != no_node) {
+			graph.replace_uses(results[r], values[r]);
+		}
+	}
+	return next;
+}
+
+void inline_calls(Graph& graph) {
+	infer_types(graph);
+
+	std::vector<bool> reachable(graph.block_count(), false);
+	for(BlockId id : graph.reverse_post_order()) {
+		reachable[id] = true;
+	}
+
+	bool changed = false;
+	for(BlockId id = 0; id != graph.block_count(); ++id) {
+		if(id >= reachable.size() || !reachable[id]) {
+			continue;
+		}
+		for(usize i = 0; i != graph.block(id).nodes.size(); ++i) {
+			const Node& call = graph.node(graph.block(id).nodes[i]);
+			if(call.op != Op::Call) {
+				continue;
+			}
+			const usize args = call.operands.size() - 1;
+
+			const Builtin* builtin = nullptr;
+			std::unique_ptr<Graph> inlined;
+			const void* native = nullptr;
+			const void* target = call_target(graph, call, ValueType::ExternalFunction);
+			if(target) {
+				native = target;
+			} else if((target = call_target(graph, call, ValueType::FastFunction))) {
+				native = reinterpret_cast<const void*>(static_cast<const FastFunction*>(target)->function);
+			} else if((target = call_target(graph, call, ValueType::Closure))) {
+				inlined = build_inlined(graph, *static_cast<const Function*>(target), args);
+			}
+			if(native) {
+				auto it = std::find_if(std::begin(builtins), std::end(builtins), [&](const Builtin& b) {
+					return reinterpret_cast<const void*>(b.function) == native && args >= b.min_args && args <= b.max_args;
+				});
+				builtin = it != std::end(builtins) && call.imm <= 1 ? it : nullptr;
+			}
+			if(!builtin && !inlined) {
+				continue;
+			}
+
+			BlockId next = inline_call(graph, id, i, graph.add_target(target), inlined.get(), builtin);
+			changed = true;
+			if(next != id) {
+				// the rest of the block is visited with the continuation
+				reachable.resize(graph.block_count(), false);
+				reachable[next] = true;
+				break;
+			}
+		}
+	}
+
+	if(!changed) {
+		return;
+	}
+
+	graph.analyze();
+	infer_types(graph);
+
+	// guards of the inlined functions can be redundant with the ones of the caller
+	for(BlockId id : graph.reverse_post_order()) {
+		auto& nodes = graph.block(id).nodes;
+		for(usize i = 0; i != nodes.size(); ++i) {
+			const Node& n = graph.node(nodes[i]);
+			if(n.is_guard() && n.op != Op::GuardTarget && graph.node(n.operands.front()).type == n.type) {
+				graph.replace_uses(nodes[i], n.operands.front());
+				graph.node(nodes[i]).operands.clear();
+				nodes.erase(nodes.begin() + i--);
+			}
+		}
+	}
+}
+
+void eliminate_common_subexpressions(Graph& graph) {
+	std::vector<std::vector<BlockId>> children(graph.block_count());
+	for(BlockId id : graph.reverse_post_order()) {
+		if(id) {
+			children[graph.block(id).dominator].push_back(id);
+		}
+	}
+
+	using Key = std::tuple<Op, u32, std::vector<NodeId>>;
+	std::map<Key, NodeId> available;
+
+	auto key = [&](NodeId id) {
+		const Node& n = graph.node(id);
+		return Key{n.op, n.imm, n.operands};
+	};
+
+	// dominator tree walk, pure nodes stay available in dominated blocks
+	std::vector<std::pair<BlockId, usize>> stack = {{0, 0}};
+	std::vector<std::vector<Key>> scopes(graph.block_count());
+	while(!stack.empty()) {
+		auto [id, next] = stack.back();
+		if(next == 0) {
+			std::map<Key, NodeId> loads;
+			auto& nodes = graph.block(id).nodes;
+			for(usize i = 0; i != nodes.size(); ++i) {
+				const Node& n = graph.node(nodes[i]);
+				if(n.has_side_effects()) {
+					loads.clear();
+					continue;
+				}
+				if(!n.is_pure() && !n.is_load()) {
+					continue;
+				}
+				Key k = key(nodes[i]);
+				auto& table = n.is_pure() ? available : loads;
+				if(auto it = table.find(k); it != table.end()) {
+					graph.replace_uses(nodes[i], it->second);
+					nodes.erase(nodes.begin() + i--);
+					continue;
+				}
+				table[k] = nodes[i];
+				if(n.is_pure()) {
+					scopes[id].push_back(std::move(k));
+				}
+			}
+		}
+		if(next < children[id].size()) {
+			++stack.back().second;
+			stack.push_back({children[id][next], 0});
+		} else {
+			for(const Key& k : scopes[id]) {
+				available.erase(k);
+			}
+			stack.pop_back();
+		}
+	}
+}
+
+void hoist_loop_invariants(Graph& graph) {
+	graph.analyze();
+
+	struct Loop {
+		BlockId header = 0;
+		std::vector<bool> body;
+		std::vector<BlockId> latches;
+		usize size = 0;
+	};
+
+	std::vector<Loop> loops;
+	for(BlockId id : graph.reverse_post_order()) {
+		for(BlockId header : graph.block(id).successors) {
+			if(!graph.dominates(header, id)) {
+				continue;
+			}
+			auto it = std::find_if(loops.begin(), loops.end(), [&](const Loop& l) { return l.header == header; });
+			if(it == loops.end()) {
+				it = loops.insert(loops.end(), Loop{header, std::vector<bool>(graph.block_count(), false), {}, 0});
+				it->body[header] = true;
+			}
+			it->latches.push_back(id);
+			std::vector<BlockId> stack = {id};
+			while(!stack.empty()) {
+				BlockId b = stack.back();
+				stack.pop_back();
+				if(it->body[b]) {
+					continue;
+				}
+				it->body[b] = true;
+				const auto& preds = graph.block(b).predecessors;
+				stack.insert(stack.end(), preds.begin(), preds.end());
+			}
+		}
+	}
+	for(Loop& loop : loops) {
+		loop.size = usize(std::count(loop.body.begin(), loop.body.end(), true));
+	}
+
+	// inner loops first, so invariants can bubble up to outer loops
+	std::sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) { return a.size < b.size; });
+
+	for(const Loop& loop : loops) {
+		const auto& preds = graph.block(loop.header).predecessors;
+		if(std::count_if(preds.begin(), preds.end(), [&](BlockId p) { return !loop.body[p]; }) != 1) {
+			continue;
+		}
+		BlockId preheader = *std::find_if(preds.begin(), preds.end(), [&](BlockId p) { return !loop.body[p]; });
+		if(graph.block(preheader).successors.size() != 1) {
+			continue;
+		}
+
+		bool has_side_effects = false;
+		for(BlockId id : graph.reverse_post_order()) {
+			if(loop.body[id]) {
+				const auto& nodes = graph.block(id).nodes;
+				has_side_effects |= std::any_of(nodes.begin(), nodes.end(), [&](NodeId n) { return graph.node(n).has_side_effects(); });
+			}
+		}
+
+		// hoisted nodes go before the last instruction of the preheader, and resume there if a guard fails
+		const u32 resume_pc = graph.block(preheader).last_pc;
+		const u32 resume_state = graph.block(preheader).exit_state;
+		auto& pre_nodes = graph.block(preheader).nodes;
+		usize insert_at = pre_nodes.size();
+		if(preheader) {
+			auto it = std::find_if(pre_nodes.begin(), pre_nodes.end(), [&](NodeId n) { return graph.node(n).pc == resume_pc; });
+			insert_at = usize(it - pre_nodes.begin());
+		}
+		std::vector<bool> defined_after(graph.node_count(), false);
+		for(usize i = insert_at; i != pre_nodes.size(); ++i) {
+			defined_after[pre_nodes[i]] = true;
+		}
+
+		for(BlockId id : graph.reverse_post_order()) {
+			if(!loop.body[id]) {
+				continue;
+			}
+			const bool always_executed = std::all_of(loop.latches.begin(), loop.latches.end(), [&](BlockId l) { return graph.dominates(id, l); });
+
+			auto& nodes = graph.block(id).nodes;
+			for(usize i = 0; i != nodes.size(); ++i) {
+				NodeId id_n = nodes[i];
+				const Node& n = graph.node(id_n);
+
+				bool hoistable = n.is_guard() ? always_executed
+							   : n.is_pure() ? !can_fail(graph, n)
+							   : n.is_load() && !has_side_effects && !can_fail(graph, n);
+				if(!hoistable) {
+					continue;
+				}
+				bool invariant = std::all_of(n.operands.begin(), n.operands.end(), [&](NodeId op) {
+					return !loop.body[graph.node(op).block] && !defined_after[op];
+				});
+				if(!invariant) {
+					continue;
+				}
+
+				graph.node(id_n).block = preheader;
+				if(graph.node(id_n).is_guard()) {
+					graph.node(id_n).frame_state = resume_state;
+				}
+				nodes.erase(nodes.begin() + i--);
+				pre_nodes.insert(pre_nodes.begin() + insert_at++, id_n);
+			}
+		}
+	}
+}
+
+void remove_dead_nodes(Graph& graph) {
+	for(bool changed = true; changed;) {
+		changed = false;
+
+		std::vector<u32> uses(graph.node_count(), 0);
+		for(usize i = 0; i != graph.node_count(); ++i) {
+			for(NodeId op : graph.node(NodeId(i)).operands) {
+				++uses[op];
+			}
+		}
+		for(usize i = 0; i != graph.block_count(); ++i) {
+			const Block& b = graph.block(BlockId(i));
+			if(b.condition != no_node) {
+				++uses[b.condition];
+			}
+			for(NodeId v : b.values) {
+				++uses[v];
+			}
+			// values needed to rebuild the interpreter frame when a guard fails
+			for(NodeId n : b.nodes) {
+				if(graph.node(n).is_guard() && graph.node(n).frame_state != no_frame_state) {
+					for(NodeId reg : graph.frame_state(graph.node(n).frame_state).registers) {
+						if(reg != no_node) {
+							++uses[reg];
+						}
+					}
+				}
+			}
+		}
+
+		auto is_dead = [&](NodeId id) {
+			const Node& n = graph.node(id);
+			if(uses[id] || n.has_side_effects() || n.is_guard()) {
+				return false;
+			}
+			return n.op == Op::Phi || n.op == Op::CallResult || n.op == Op::NewTable || !can_fail(graph, n);
+		};
+
+		for(BlockId id : graph.reverse_post_order()) {
+			Block& b = graph.block(id);
+			for(auto* list : {&b.phis, &b.nodes}) {
+				auto end = std::remove_if(list->begin(), list->end(), [&](NodeId n) {
+					if(is_dead(n)) {
+						// dead nodes don't count as uses anymore
+						graph.node(n).operands.clear();
+						return true;
+					}
+					return false;
+				});
+				changed |= end != list->end();
+				list->erase(end, list->end());
+			}
+		}
+	}
+}
+
+void optimize(Graph& graph) {
+	specialize_types(graph);
+	inline_calls(graph);
+	eliminate_common_subexpressions(graph);
+	hoist_loop_invariants(graph);
+	eliminate_common_subexpressions(graph);
+	remove_dead_nodes(graph);
+	infer_types(graph);
+}
+
+}
+}
@@ -0,0 +1,60 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_IRPASSES_H
+#define JIT_IRPASSES_H
+
+#include "IR.h"
+
+#include <vm/Value.h>
+
+namespace jit {
+namespace ir {
+
+// Forward type propagation, phis join the types of their operands
+void infer_types(Graph& graph);
+
+// Guards operands of arithmetic and table accesses, so that the guarded operations can't fail.
+// Operands the interpreter has seen with other types (see VM::set_profiling) are left generic.
+void specialize_types(Graph& graph);
+
+// Replaces monomorphic calls to known library functions, and to small Lua functions without loops or side effects,
+// by their body behind a check of the callee identity. Needs type feedback to find the callees.
+void inline_calls(Graph& graph);
+
+// Merges pure nodes dominated by an identical node, and identical loads with no store or call in between
+void eliminate_common_subexpressions(Graph& graph);
+
+// Moves invariant nodes and guards out of loops that have a single entering block
+void hoist_loop_invariants(Graph& graph);
+
+// Removes nodes whose values are never used and that can't fail
+void remove_dead_nodes(Graph& graph);
+
+void optimize(Graph& graph);
+
+// Library function computed by a node that inline_calls made from a call, nullptr for other nodes
+FunctionPtr builtin_function(Op op);
+
+}
+}
+
+#endif // JIT_IRPASSES_H
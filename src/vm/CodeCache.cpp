@@ -0,0 +1,134 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "CodeCache.h"
+
+#include <cstdio>
+
+#ifdef __WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace jit {
+
+static constexpr u32 cache_magic = 0x4354494a; // "JITC"
+
+struct CacheHeader {
+	u32 magic;
+	u32 version;
+	u64 key;
+	u64 size;
+	u64 checksum;
+};
+
+CodeCache::CodeCache(std::string directory) : _directory(std::move(directory)) {
+	if(!_directory.empty() && _directory.back() != '/' && _directory.back() != '\\') {
+		_directory += '/';
+	}
+}
+
+// FNV-1a
+u64 CodeCache::hash(ArrayView<u8> data, u64 seed) {
+	u64 h = 0xcbf29ce484222325 ^ seed;
+	for(u8 b : data) {
+		h = (h ^ b) * 0x100000001b3;
+	}
+	return h;
+}
+
+u64 CodeCache::hash(std::string_view data, u64 seed) {
+	return hash(ArrayView<u8>(reinterpret_cast<const u8*>(data.data()), data.size()), seed);
+}
+
+static unsigned long process_id() {
+#ifdef __WIN32
+	return static_cast<unsigned long>(_getpid());
+#else
+	return static_cast<unsigned long>(getpid());
+#endif
+}
+
+std::string CodeCache::entry_name(u64 key) const {
+	char name[32] = {};
+	std::snprintf(name, sizeof(name), "%016llx.jitc", static_cast<unsigned long long>(key));
+	return _directory + name;
+}
+
+bool CodeCache::find(u64 key, std::vector<u8>& data) const {
+	std::FILE* file = std::fopen(entry_name(key).c_str(), "rb");
+	if(!file) {
+		return false;
+	}
+	SCOPE_EXIT(std::fclose(file));
+
+	CacheHeader header = {};
+	if(std::fread(&header, sizeof(header), 1, file) != 1) {
+		return false;
+	}
+	if(header.magic != cache_magic || header.version != format_version || header.key != key) {
+		return false;
+	}
+
+	// a truncated or corrupted size is a miss, not an allocation
+	const long begin = std::ftell(file);
+	if(begin < 0 || std::fseek(file, 0, SEEK_END)) {
+		return false;
+	}
+	const long end = std::ftell(file);
+	if(end < begin || u64(end - begin) != header.size || std::fseek(file, begin, SEEK_SET)) {
+		return false;
+	}
+
+	std::vector<u8> content(header.size);
+	if(std::fread(content.data(), 1, content.size(), file) != content.size()) {
+		return false;
+	}
+	if(hash(ArrayView<u8>(content.data(), content.size())) != header.checksum) {
+		return false;
+	}
+
+	data = std::move(content);
+	return true;
+}
+
+void CodeCache::store(u64 key, ArrayView<u8> data) const {
+	// write to a temporary file first so other processes never see partial entries, each process has its own
+	std::string name = entry_name(key);
+	std::string tmp_name = name + "." + std::to_string(process_id()) + ".tmp";
+
+	std::FILE* file = std::fopen(tmp_name.c_str(), "wb");
+	if(!file) {
+		return;
+	}
+
+	CacheHeader header = {cache_magic, format_version, key, data.size(), hash(data)};
+	bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+				   std::fwrite(data.data(), 1, data.size(), file) == data.size();
+
+	if(std::fclose(file) || !written || std::rename(tmp_name.c_str(), name.c_str())) {
+		std::remove(tmp_name.c_str());
+	}
+}
+
+}
@@ -0,0 +1,60 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_CODECACHE_H
+#define JIT_CODECACHE_H
+
+#include "Compiler.h"
+
+#include <utils.h>
+
+#include <vector>
+#include <string>
+#include <string_view>
+
+namespace jit {
+
+// Stores compiled chunks on disk, one file per key.
+// Entries are versioned and checksummed: anything that doesn't validate is treated as a miss.
+class CodeCache {
+	public:
+		// Bump when the layout of the entries changes
+		static constexpr u32 layout_version = 1;
+		// Entries hold compile_lua's output, so a new compiler revision invalidates them too
+		static constexpr u32 format_version = (layout_version << 16) | compiler_revision;
+
+		CodeCache(std::string directory);
+
+		static u64 hash(ArrayView<u8> data, u64 seed = 0);
+		static u64 hash(std::string_view data, u64 seed = 0);
+
+		bool find(u64 key, std::vector<u8>& data) const;
+		void store(u64 key, ArrayView<u8> data) const;
+
+	private:
+		std::string entry_name(u64 key) const;
+
+		std::string _directory;
+};
+
+}
+
+#endif // JIT_CODECACHE_H
@@ -0,0 +1,2375 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "Compiler.h"
+#include "Lexer.h"
+#include "bytecode.h"
+#include "exceptions.h"
+#include "arithmetic.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Mostly follows the structure of lparser.c and lcode.c from the reference implementation:
+// expressions are described by an Expr and only discharged into registers when needed.
+
+namespace jit {
+
+static constexpr i32 no_jump = -1;
+static constexpr u32 no_reg = 0xFF;
+static constexpr u32 max_regs = 255;
+static constexpr i32 multret = -1;
+
+static constexpr i32 max_sbx = (1 << 17) - 1;
+static constexpr u32 max_bx = (1 << 18) - 1;
+static constexpr u32 max_c = (1 << 9) - 1;
+static constexpr u32 max_index_rk = Instruction::max_k - 1;
+
+static constexpr u32 fields_per_flush = 50;
+static constexpr u32 max_vars = 200;
+static constexpr u32 max_upvalues = 255;
+static constexpr u32 max_levels = 200;
+static constexpr usize max_short_string = 40;
+
+static constexpr u32 rk_constant(u32 k) {
+	return k | u32(Instruction::max_k);
+}
+
+static bool is_constant(u32 rk) {
+	return rk & u32(Instruction::max_k);
+}
+
+static Instruction make_abc(OpCode op, u32 a, u32 b, u32 c) {
+	Instruction i = {};
+	i.opcode = u32(op);
+	i.A = a;
+	i.B = b;
+	i.C = c;
+	return i;
+}
+
+static void set_bx(Instruction& i, u32 bx) {
+	i.B = bx >> 9;
+	i.C = bx & max_c;
+}
+
+// Instruction::sBx is offset by one compared to the actual jump distance
+static i32 get_sbx(Instruction i) {
+	return i32(i.Bx()) - max_sbx;
+}
+
+static void set_sbx(Instruction& i, i32 sbx) {
+	set_bx(i, u32(sbx + max_sbx));
+}
+
+static bool is_test_mode(Instruction i) {
+	switch(OpCode(i.opcode)) {
+		case OpCode::Eq:
+		case OpCode::Lt:
+		case OpCode::Le:
+		case OpCode::Test:
+		case OpCode::Testset:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// converts an integer into a "floating point byte", as used by Newtable
+static u32 int_to_fb(u32 x) {
+	u32 e = 0;
+	if(x < 8) {
+		return x;
+	}
+	while(x >= (8 << 4)) {
+		x = (x + 0xf) >> 4;
+		e += 4;
+	}
+	while(x >= (8 << 1)) {
+		x = (x + 1) >> 1;
+		++e;
+	}
+	return ((e + 1) << 3) | (x - 8);
+}
+
+
+enum class ExprKind {
+	Void,		// empty expression list
+	Nil,
+	True,
+	False,
+	Constant,	// info = constant index
+	Float,		// number
+	Int,		// integer
+	NonReloc,	// info = result register
+	Local,		// info = local register
+	Upvalue,	// info = upvalue index
+	Indexed,	// indexed.table = table register or upvalue, indexed.key = key RK
+	Jump,		// info = pc of the jump instruction
+	Relocable,	// info = pc of the instruction, its result register can be changed
+	Call,		// info = pc of the call
+	Vararg		// info = pc of the vararg
+};
+
+struct Expr {
+	ExprKind kind = ExprKind::Void;
+	i32 info = 0;
+
+	struct {
+		u32 table = 0;
+		u32 key = 0;
+		ExprKind table_kind = ExprKind::Local;
+	} indexed;
+
+	i64 integer = 0;
+	double number = 0.0;
+
+	i32 true_list = no_jump;
+	i32 false_list = no_jump;
+
+	Expr() = default;
+
+	Expr(ExprKind k, i32 i = 0) : kind(k), info(i) {
+	}
+
+	bool has_jumps() const {
+		return true_list != false_list;
+	}
+
+	bool has_multret() const {
+		return kind == ExprKind::Call || kind == ExprKind::Vararg;
+	}
+
+	bool is_var() const {
+		return kind == ExprKind::Local || kind == ExprKind::Upvalue || kind == ExprKind::Indexed;
+	}
+
+	bool is_numeral() const {
+		return !has_jumps() && (kind == ExprKind::Int || kind == ExprKind::Float);
+	}
+};
+
+
+enum class BinOp {
+	Add, Sub, Mul, Mod, Pow, Div, Idiv,
+	Band, Bor, Bxor, Shl, Shr,
+	Concat,
+	Eq, Lt, Le, Ne, Gt, Ge,
+	And, Or,
+	None
+};
+
+enum class UnOp {
+	Minus, Bnot, Not, Len,
+	None
+};
+
+static const struct {
+	u8 left;
+	u8 right;
+} priorities[] = {
+	{10, 10}, {10, 10},				// + -
+	{11, 11}, {11, 11},				// * %
+	{14, 13},						// ^ (right associative)
+	{11, 11}, {11, 11},				// / //
+	{6, 6}, {4, 4}, {5, 5},			// & | ~
+	{7, 7}, {7, 7},					// << >>
+	{9, 8},							// .. (right associative)
+	{3, 3}, {3, 3}, {3, 3},			// == < <=
+	{3, 3}, {3, 3}, {3, 3},			// ~= > >=
+	{2, 2}, {1, 1}					// and or
+};
+
+static constexpr u32 unary_priority = 12;
+
+static UnOp unary_op(Token token) {
+	switch(token) {
+		case Token::Not: return UnOp::Not;
+		case Token::Minus: return UnOp::Minus;
+		case Token::Tilde: return UnOp::Bnot;
+		case Token::Hash: return UnOp::Len;
+		default: return UnOp::None;
+	}
+}
+
+static BinOp binary_op(Token token) {
+	switch(token) {
+		case Token::Plus: return BinOp::Add;
+		case Token::Minus: return BinOp::Sub;
+		case Token::Star: return BinOp::Mul;
+		case Token::Percent: return BinOp::Mod;
+		case Token::Caret: return BinOp::Pow;
+		case Token::Slash: return BinOp::Div;
+		case Token::Idiv: return BinOp::Idiv;
+		case Token::Ampersand: return BinOp::Band;
+		case Token::Pipe: return BinOp::Bor;
+		case Token::Tilde: return BinOp::Bxor;
+		case Token::Shl: return BinOp::Shl;
+		case Token::Shr: return BinOp::Shr;
+		case Token::Concat: return BinOp::Concat;
+		case Token::Ne: return BinOp::Ne;
+		case Token::Eq: return BinOp::Eq;
+		case Token::Lt: return BinOp::Lt;
+		case Token::Le: return BinOp::Le;
+		case Token::Gt: return BinOp::Gt;
+		case Token::Ge: return BinOp::Ge;
+		case Token::And: return BinOp::And;
+		case Token::Or: return BinOp::Or;
+		default: return BinOp::None;
+	}
+}
+
+static const char* expected_message(Token token) {
+	switch(token) {
+		case Token::OpenParen: return "'(' expected.";
+		case Token::CloseParen: return "')' expected.";
+		case Token::CloseBracket: return "']' expected.";
+		case Token::CloseBrace: return "'}' expected.";
+		case Token::Assign: return "'=' expected.";
+		case Token::Do: return "'do' expected.";
+		case Token::End: return "'end' expected.";
+		case Token::In: return "'in' expected.";
+		case Token::Then: return "'then' expected.";
+		case Token::Until: return "'until' expected.";
+		case Token::Name: return "<name> expected.";
+		case Token::Eos: return "<eof> expected.";
+		default: return "Unexpected symbol.";
+	}
+}
+
+
+// constant folding, follows the integer/float rules of Lua 5.3
+static bool to_integer(const Expr& e, i64& i) {
+	if(e.kind == ExprKind::Int) {
+		i = e.integer;
+		return true;
+	}
+	return float_to_integer(e.number, i);
+}
+
+static double to_number(const Expr& e) {
+	return e.kind == ExprKind::Int ? double(e.integer) : e.number;
+}
+
+static bool fold(BinOp op, Expr& e1, const Expr& e2) {
+	if(!e1.is_numeral() || !e2.is_numeral()) {
+		return false;
+	}
+
+	// division by zero is left to the runtime
+	if((op == BinOp::Div || op == BinOp::Idiv || op == BinOp::Mod) && to_number(e2) == 0.0) {
+		return false;
+	}
+
+	bool ints = e1.kind == ExprKind::Int && e2.kind == ExprKind::Int;
+	switch(op) {
+		case BinOp::Band:
+		case BinOp::Bor:
+		case BinOp::Bxor:
+		case BinOp::Shl:
+		case BinOp::Shr: {
+			i64 a = 0;
+			i64 b = 0;
+			if(!to_integer(e1, a) || !to_integer(e2, b)) {
+				return false;
+			}
+			i64 r = op == BinOp::Band ? a & b
+				  : op == BinOp::Bor ? a | b
+				  : op == BinOp::Bxor ? a ^ b
+				  : op == BinOp::Shl ? shift_left(a, b)
+				  : shift_right(a, b);
+			e1 = Expr(ExprKind::Int);
+			e1.integer = r;
+			return true;
+		}
+
+		case BinOp::Add:
+		case BinOp::Sub:
+		case BinOp::Mul:
+		case BinOp::Mod:
+		case BinOp::Idiv:
+			if(ints) {
+				i64 a = e1.integer;
+				i64 b = e2.integer;
+				switch(op) {
+					case BinOp::Add: e1.integer = int_add(a, b); break;
+					case BinOp::Sub: e1.integer = int_sub(a, b); break;
+					case BinOp::Mul: e1.integer = int_mul(a, b); break;
+					case BinOp::Mod: e1.integer = int_mod(a, b); break;
+					default: e1.integer = int_idiv(a, b); break;
+				}
+				return true;
+			}
+		break;
+
+		default:
+		break;
+	}
+
+	double a = to_number(e1);
+	double b = to_number(e2);
+	double r = 0.0;
+	switch(op) {
+		case BinOp::Add: r = a + b; break;
+		case BinOp::Sub: r = a - b; break;
+		case BinOp::Mul: r = a * b; break;
+		case BinOp::Div: r = a / b; break;
+		case BinOp::Pow: r = std::pow(a, b); break;
+		case BinOp::Idiv: r = float_idiv(a, b); break;
+		case BinOp::Mod: r = float_mod(a, b); break;
+		default:
+			return false;
+	}
+	// don't fold NaNs and zeros (-0.0 and 0.0 are different constants)
+	if(std::isnan(r) || r == 0.0) {
+		return false;
+	}
+	e1 = Expr(ExprKind::Float);
+	e1.number = r;
+	return true;
+}
+
+
+struct CompiledConstant {
+	ConstantType type = ConstantType::None;
+	std::string string;
+	i64 integer = 0;
+	double number = 0.0;
+};
+
+struct LocalVar {
+	std::string name;
+	i32 start_pc = 0;
+	i32 end_pc = 0;
+};
+
+struct UpValueDesc {
+	std::string name;
+	bool in_stack = false;
+	u8 index = 0;
+};
+
+struct Proto {
+	std::vector<Instruction> code;
+	std::vector<u32> lines;
+	std::vector<CompiledConstant> constants;
+	std::vector<UpValueDesc> upvalues;
+	std::vector<std::unique_ptr<Proto>> protos;
+	std::vector<LocalVar> locals;
+
+	u32 line_defined = 0;
+	u32 last_line_defined = 0;
+	u8 params = 0;
+	bool varargs = false;
+	u8 max_stack = 2;
+};
+
+struct PendingBreak {
+	i32 jumps = no_jump;
+	u32 active_vars = 0;
+};
+
+struct Block {
+	Block* previous = nullptr;
+	u32 active_vars = 0;
+	bool upvalue = false;
+	bool is_loop = false;
+	std::vector<PendingBreak> breaks;
+};
+
+struct FuncState {
+	Proto* proto = nullptr;
+	FuncState* prev = nullptr;
+	Block* block = nullptr;
+
+	i32 last_target = 0;
+	i32 pending_jumps = no_jump;
+
+	u32 first_local = 0;
+	u32 active_vars = 0;
+	u32 free_reg = 0;
+
+	std::unordered_map<std::string, u32> constant_indexes;
+
+	i32 pc() const {
+		return i32(proto->code.size());
+	}
+};
+
+
+class Compiler {
+	public:
+		Compiler(std::string_view source) : _lex(source) {
+		}
+
+		std::unique_ptr<Proto> main_function();
+
+	private:
+		[[noreturn]] void error(const char* msg) const {
+			throw SyntaxErrorException(msg, _lex.line());
+		}
+
+		// ------------------------------ code generation ------------------------------
+
+		Instruction& instruction(const Expr& e) {
+			return _fs->proto->code[usize(e.info)];
+		}
+
+		i32 code(Instruction i) {
+			discharge_pending_jumps();
+			_fs->proto->code.push_back(i);
+			_fs->proto->lines.push_back(_lex.last_line());
+			return _fs->pc() - 1;
+		}
+
+		i32 code_abc(OpCode op, u32 a, u32 b, u32 c) {
+			return code(make_abc(op, a, b, c));
+		}
+
+		i32 code_abx(OpCode op, u32 a, u32 bx) {
+			Instruction i = make_abc(op, a, 0, 0);
+			set_bx(i, bx);
+			return code(i);
+		}
+
+		i32 code_asbx(OpCode op, u32 a, i32 sbx) {
+			return code_abx(op, a, u32(sbx + max_sbx));
+		}
+
+		void fix_line(u32 line) {
+			_fs->proto->lines.back() = line;
+		}
+
+		void load_nil(u32 from, u32 n) {
+			u32 last = from + n - 1;
+			if(_fs->pc() > _fs->last_target) {
+				Instruction& previous = _fs->proto->code.back();
+				if(OpCode(previous.opcode) == OpCode::Loadnil) {
+					u32 prev_from = previous.A;
+					u32 prev_last = prev_from + previous.B;
+					if((prev_from <= from && from <= prev_last + 1) || (from <= prev_from && prev_from <= last + 1)) {
+						previous.A = std::min(from, prev_from);
+						previous.B = std::max(last, prev_last) - previous.A;
+						return;
+					}
+				}
+			}
+			code_abc(OpCode::Loadnil, from, n - 1, 0);
+		}
+
+		i32 get_jump(i32 pc) {
+			i32 offset = get_sbx(_fs->proto->code[usize(pc)]);
+			return offset == no_jump ? no_jump : pc + 1 + offset;
+		}
+
+		void fix_jump(i32 pc, i32 dest) {
+			i32 offset = dest - (pc + 1);
+			if(std::abs(offset) > max_sbx) {
+				error("Control structure too long.");
+			}
+			set_sbx(_fs->proto->code[usize(pc)], offset);
+		}
+
+		void concat(i32& list, i32 other) {
+			if(other == no_jump) {
+				return;
+			}
+			if(list == no_jump) {
+				list = other;
+				return;
+			}
+			i32 last = list;
+			for(i32 next = get_jump(last); next != no_jump; next = get_jump(last)) {
+				last = next;
+			}
+			fix_jump(last, other);
+		}
+
+		i32 jump() {
+			i32 pending = _fs->pending_jumps;
+			_fs->pending_jumps = no_jump;
+			i32 j = code_asbx(OpCode::Jmp, 0, no_jump);
+			concat(j, pending);
+			return j;
+		}
+
+		void jump_to(i32 target) {
+			patch_list(jump(), target);
+		}
+
+		void ret(u32 first, i32 count) {
+			code_abc(OpCode::Return, first, u32(count + 1), 0);
+		}
+
+		i32 cond_jump(OpCode op, u32 a, u32 b, u32 c) {
+			code_abc(op, a, b, c);
+			return jump();
+		}
+
+		i32 get_label() {
+			_fs->last_target = _fs->pc();
+			return _fs->pc();
+		}
+
+		Instruction& jump_control(i32 pc) {
+			auto& code = _fs->proto->code;
+			if(pc >= 1 && is_test_mode(code[usize(pc - 1)])) {
+				return code[usize(pc - 1)];
+			}
+			return code[usize(pc)];
+		}
+
+		bool patch_test_reg(i32 node, u32 reg) {
+			Instruction& i = jump_control(node);
+			if(OpCode(i.opcode) != OpCode::Testset) {
+				return false;
+			}
+			if(reg != no_reg && reg != i.B) {
+				i.A = reg;
+			} else {
+				i = make_abc(OpCode::Test, i.B, 0, i.C);
+			}
+			return true;
+		}
+
+		void remove_values(i32 list) {
+			for(; list != no_jump; list = get_jump(list)) {
+				patch_test_reg(list, no_reg);
+			}
+		}
+
+		void patch_list_aux(i32 list, i32 value_target, u32 reg, i32 default_target) {
+			while(list != no_jump) {
+				i32 next = get_jump(list);
+				fix_jump(list, patch_test_reg(list, reg) ? value_target : default_target);
+				list = next;
+			}
+		}
+
+		void discharge_pending_jumps() {
+			patch_list_aux(_fs->pending_jumps, _fs->pc(), no_reg, _fs->pc());
+			_fs->pending_jumps = no_jump;
+		}
+
+		void patch_to_here(i32 list) {
+			get_label();
+			concat(_fs->pending_jumps, list);
+		}
+
+		void patch_list(i32 list, i32 target) {
+			if(target == _fs->pc()) {
+				patch_to_here(list);
+			} else {
+				patch_list_aux(list, target, no_reg, target);
+			}
+		}
+
+		// jumps will close upvalues >= level
+		void patch_close(i32 list, u32 level) {
+			for(; list != no_jump; list = get_jump(list)) {
+				_fs->proto->code[usize(list)].A = level + 1;
+			}
+		}
+
+		void check_stack(u32 n) {
+			u32 new_stack = _fs->free_reg + n;
+			if(new_stack > _fs->proto->max_stack) {
+				if(new_stack >= max_regs) {
+					error("Function or expression needs too many registers.");
+				}
+				_fs->proto->max_stack = u8(new_stack);
+			}
+		}
+
+		void reserve_regs(u32 n) {
+			check_stack(n);
+			_fs->free_reg += n;
+		}
+
+		void free_reg(u32 reg) {
+			if(!is_constant(reg) && reg >= _fs->active_vars) {
+				--_fs->free_reg;
+				assert(reg == _fs->free_reg);
+			}
+		}
+
+		void free_expr(const Expr& e) {
+			if(e.kind == ExprKind::NonReloc) {
+				free_reg(u32(e.info));
+			}
+		}
+
+		void free_exprs(const Expr& e1, const Expr& e2) {
+			i32 r1 = e1.kind == ExprKind::NonReloc ? e1.info : -1;
+			i32 r2 = e2.kind == ExprKind::NonReloc ? e2.info : -1;
+			if(r1 > r2) {
+				free_reg(u32(r1));
+				if(r2 >= 0) {
+					free_reg(u32(r2));
+				}
+			} else {
+				if(r2 >= 0) {
+					free_reg(u32(r2));
+				}
+				if(r1 >= 0) {
+					free_reg(u32(r1));
+				}
+			}
+		}
+
+		u32 add_constant(const std::string& key, CompiledConstant cst) {
+			auto& indexes = _fs->constant_indexes;
+			if(auto it = indexes.find(key); it != indexes.end()) {
+				return it->second;
+			}
+			auto& constants = _fs->proto->constants;
+			u32 index = u32(constants.size());
+			if(index > max_bx) {
+				error("Too many constants.");
+			}
+			constants.emplace_back(std::move(cst));
+			indexes[key] = index;
+			return index;
+		}
+
+		template<typename T>
+		static std::string constant_key(char type, T value) {
+			std::string key(1 + sizeof(T), type);
+			std::memcpy(&key[1], &value, sizeof(T));
+			return key;
+		}
+
+		u32 string_constant(const std::string& str) {
+			CompiledConstant cst;
+			cst.type = str.size() <= max_short_string ? ConstantType::String : ConstantType::LongString;
+			cst.string = str;
+			return add_constant("s" + str, std::move(cst));
+		}
+
+		u32 int_constant(i64 i) {
+			CompiledConstant cst;
+			cst.type = ConstantType::Integer;
+			cst.integer = i;
+			return add_constant(constant_key('i', i), std::move(cst));
+		}
+
+		u32 number_constant(double n) {
+			CompiledConstant cst;
+			cst.type = ConstantType::Number;
+			cst.number = n;
+			return add_constant(constant_key('f', n), std::move(cst));
+		}
+
+		u32 nil_constant() {
+			return add_constant("n", CompiledConstant());
+		}
+
+		void code_k(u32 reg, u32 k) {
+			if(k > max_bx) {
+				error("Too many constants.");
+			}
+			code_abx(OpCode::Loadk, reg, k);
+		}
+
+		void set_returns(Expr& e, i32 results) {
+			if(e.kind == ExprKind::Call) {
+				instruction(e).C = u32(results + 1);
+			} else if(e.kind == ExprKind::Vararg) {
+				Instruction& i = instruction(e);
+				i.B = u32(results + 1);
+				i.A = _fs->free_reg;
+				reserve_regs(1);
+			}
+		}
+
+		void set_multret(Expr& e) {
+			set_returns(e, multret);
+		}
+
+		void set_one_ret(Expr& e) {
+			if(e.kind == ExprKind::Call) {
+				e.kind = ExprKind::NonReloc;
+				e.info = i32(instruction(e).A);
+			} else if(e.kind == ExprKind::Vararg) {
+				instruction(e).B = 2;
+				e.kind = ExprKind::Relocable;
+			}
+		}
+
+		void discharge_vars(Expr& e) {
+			switch(e.kind) {
+				case ExprKind::Local:
+					e.kind = ExprKind::NonReloc;
+				break;
+
+				case ExprKind::Upvalue:
+					e.info = code_abc(OpCode::Getupval, 0, u32(e.info), 0);
+					e.kind = ExprKind::Relocable;
+				break;
+
+				case ExprKind::Indexed: {
+					OpCode op = OpCode::Gettabup;
+					free_reg(e.indexed.key);
+					if(e.indexed.table_kind == ExprKind::Local) {
+						free_reg(e.indexed.table);
+						op = OpCode::Gettable;
+					}
+					e.info = code_abc(op, 0, e.indexed.table, e.indexed.key);
+					e.kind = ExprKind::Relocable;
+				} break;
+
+				case ExprKind::Vararg:
+				case ExprKind::Call:
+					set_one_ret(e);
+				break;
+
+				default:
+				break;
+			}
+		}
+
+		void discharge_to_reg(Expr& e, u32 reg) {
+			discharge_vars(e);
+			switch(e.kind) {
+				case ExprKind::Nil:
+					load_nil(reg, 1);
+				break;
+
+				case ExprKind::False:
+				case ExprKind::True:
+					code_abc(OpCode::Loadbool, reg, e.kind == ExprKind::True, 0);
+				break;
+
+				case ExprKind::Constant:
+					code_k(reg, u32(e.info));
+				break;
+
+				case ExprKind::Float:
+					code_k(reg, number_constant(e.number));
+				break;
+
+				case ExprKind::Int:
+					code_k(reg, int_constant(e.integer));
+				break;
+
+				case ExprKind::Relocable:
+					instruction(e).A = reg;
+				break;
+
+				case ExprKind::NonReloc:
+					if(reg != u32(e.info)) {
+						code_abc(OpCode::Move, reg, u32(e.info), 0);
+					}
+				break;
+
+				default:
+					assert(e.kind == ExprKind::Jump || e.kind == ExprKind::Void);
+					return;
+			}
+			e.info = i32(reg);
+			e.kind = ExprKind::NonReloc;
+		}
+
+		void discharge_to_any_reg(Expr& e) {
+			if(e.kind != ExprKind::NonReloc) {
+				reserve_regs(1);
+				discharge_to_reg(e, _fs->free_reg - 1);
+			}
+		}
+
+		i32 code_loadbool(u32 a, u32 b, u32 jump) {
+			get_label();
+			return code_abc(OpCode::Loadbool, a, b, jump);
+		}
+
+		bool need_value(i32 list) {
+			for(; list != no_jump; list = get_jump(list)) {
+				if(OpCode(jump_control(list).opcode) != OpCode::Testset) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void expr_to_reg(Expr& e, u32 reg) {
+			discharge_to_reg(e, reg);
+			if(e.kind == ExprKind::Jump) {
+				concat(e.true_list, e.info);
+			}
+			if(e.has_jumps()) {
+				i32 load_false = no_jump;
+				i32 load_true = no_jump;
+				if(need_value(e.true_list) || need_value(e.false_list)) {
+					i32 skip = e.kind == ExprKind::Jump ? no_jump : jump();
+					load_false = code_loadbool(reg, 0, 1);
+					load_true = code_loadbool(reg, 1, 0);
+					patch_to_here(skip);
+				}
+				i32 final = get_label();
+				patch_list_aux(e.false_list, final, reg, load_false);
+				patch_list_aux(e.true_list, final, reg, load_true);
+			}
+			e.false_list = e.true_list = no_jump;
+			e.info = i32(reg);
+			e.kind = ExprKind::NonReloc;
+		}
+
+		void expr_to_next_reg(Expr& e) {
+			discharge_vars(e);
+			free_expr(e);
+			reserve_regs(1);
+			expr_to_reg(e, _fs->free_reg - 1);
+		}
+
+		u32 expr_to_any_reg(Expr& e) {
+			discharge_vars(e);
+			if(e.kind == ExprKind::NonReloc) {
+				if(!e.has_jumps()) {
+					return u32(e.info);
+				}
+				if(u32(e.info) >= _fs->active_vars) {
+					expr_to_reg(e, u32(e.info));
+					return u32(e.info);
+				}
+			}
+			expr_to_next_reg(e);
+			return u32(e.info);
+		}
+
+		void expr_to_any_reg_up(Expr& e) {
+			if(e.kind != ExprKind::Upvalue || e.has_jumps()) {
+				expr_to_any_reg(e);
+			}
+		}
+
+		void expr_to_value(Expr& e) {
+			if(e.has_jumps()) {
+				expr_to_any_reg(e);
+			} else {
+				discharge_vars(e);
+			}
+		}
+
+		// booleans are never stored as constants: the loader doesn't support them
+		u32 expr_to_rk(Expr& e) {
+			expr_to_value(e);
+			switch(e.kind) {
+				case ExprKind::Nil:
+					e.info = i32(nil_constant());
+				break;
+
+				case ExprKind::Int:
+					e.info = i32(int_constant(e.integer));
+				break;
+
+				case ExprKind::Float:
+					e.info = i32(number_constant(e.number));
+				break;
+
+				case ExprKind::Constant:
+				break;
+
+				default:
+					return expr_to_any_reg(e);
+			}
+			e.kind = ExprKind::Constant;
+			if(u32(e.info) <= max_index_rk) {
+				return rk_constant(u32(e.info));
+			}
+			return expr_to_any_reg(e);
+		}
+
+		void store_var(const Expr& var, Expr& e) {
+			switch(var.kind) {
+				case ExprKind::Local:
+					free_expr(e);
+					expr_to_reg(e, u32(var.info));
+				return;
+
+				case ExprKind::Upvalue: {
+					u32 reg = expr_to_any_reg(e);
+					code_abc(OpCode::Setupval, reg, u32(var.info), 0);
+				} break;
+
+				case ExprKind::Indexed: {
+					OpCode op = var.indexed.table_kind == ExprKind::Local ? OpCode::Settable : OpCode::Settabup;
+					u32 rk = expr_to_rk(e);
+					code_abc(op, var.indexed.table, var.indexed.key, rk);
+				} break;
+
+				default:
+					assert(false);
+			}
+			free_expr(e);
+		}
+
+		void self(Expr& e, Expr& key) {
+			expr_to_any_reg(e);
+			u32 reg = u32(e.info);
+			free_expr(e);
+			e.info = i32(_fs->free_reg);
+			e.kind = ExprKind::NonReloc;
+			reserve_regs(2);
+			code_abc(OpCode::Self, u32(e.info), reg, expr_to_rk(key));
+			free_expr(key);
+		}
+
+		void negate_condition(Expr& e) {
+			Instruction& i = jump_control(e.info);
+			i.A = !i.A;
+		}
+
+		i32 jump_on_cond(Expr& e, bool cond) {
+			if(e.kind == ExprKind::Relocable) {
+				Instruction i = instruction(e);
+				if(OpCode(i.opcode) == OpCode::Not) {
+					// remove previous Not
+					_fs->proto->code.pop_back();
+					_fs->proto->lines.pop_back();
+					return cond_jump(OpCode::Test, i.B, 0, !cond);
+				}
+			}
+			discharge_to_any_reg(e);
+			free_expr(e);
+			return cond_jump(OpCode::Testset, no_reg, u32(e.info), cond);
+		}
+
+		void go_if_true(Expr& e) {
+			i32 pc = no_jump;
+			discharge_vars(e);
+			switch(e.kind) {
+				case ExprKind::Jump:
+					negate_condition(e);
+					pc = e.info;
+				break;
+
+				case ExprKind::Constant:
+				case ExprKind::Float:
+				case ExprKind::Int:
+				case ExprKind::True:
+				break;
+
+				default:
+					pc = jump_on_cond(e, false);
+			}
+			concat(e.false_list, pc);
+			patch_to_here(e.true_list);
+			e.true_list = no_jump;
+		}
+
+		void go_if_false(Expr& e) {
+			i32 pc = no_jump;
+			discharge_vars(e);
+			switch(e.kind) {
+				case ExprKind::Jump:
+					pc = e.info;
+				break;
+
+				case ExprKind::Nil:
+				case ExprKind::False:
+				break;
+
+				default:
+					pc = jump_on_cond(e, true);
+			}
+			concat(e.true_list, pc);
+			patch_to_here(e.false_list);
+			e.false_list = no_jump;
+		}
+
+		void code_not(Expr& e) {
+			discharge_vars(e);
+			switch(e.kind) {
+				case ExprKind::Nil:
+				case ExprKind::False:
+					e.kind = ExprKind::True;
+				break;
+
+				case ExprKind::Constant:
+				case ExprKind::Float:
+				case ExprKind::Int:
+				case ExprKind::True:
+					e.kind = ExprKind::False;
+				break;
+
+				case ExprKind::Jump:
+					negate_condition(e);
+				break;
+
+				case ExprKind::Relocable:
+				case ExprKind::NonReloc:
+					discharge_to_any_reg(e);
+					free_expr(e);
+					e.info = code_abc(OpCode::Not, 0, u32(e.info), 0);
+					e.kind = ExprKind::Relocable;
+				break;
+
+				default:
+					assert(false);
+			}
+			std::swap(e.false_list, e.true_list);
+			remove_values(e.false_list);
+			remove_values(e.true_list);
+		}
+
+		void indexed(Expr& t, Expr& key) {
+			assert(!t.has_jumps() && (t.kind == ExprKind::Local || t.kind == ExprKind::NonReloc || t.kind == ExprKind::Upvalue));
+			t.indexed.table = u32(t.info);
+			t.indexed.key = expr_to_rk(key);
+			t.indexed.table_kind = t.kind == ExprKind::Upvalue ? ExprKind::Upvalue : ExprKind::Local;
+			t.kind = ExprKind::Indexed;
+		}
+
+		void code_unary(OpCode op, Expr& e, u32 line) {
+			u32 reg = expr_to_any_reg(e);
+			free_expr(e);
+			e.info = code_abc(op, 0, reg, 0);
+			e.kind = ExprKind::Relocable;
+			fix_line(line);
+		}
+
+		void code_binary(OpCode op, Expr& e1, Expr& e2, u32 line) {
+			u32 rk2 = expr_to_rk(e2);
+			u32 rk1 = expr_to_rk(e1);
+			free_exprs(e1, e2);
+			e1.info = code_abc(op, 0, rk1, rk2);
+			e1.kind = ExprKind::Relocable;
+			fix_line(line);
+		}
+
+		void code_comparison(BinOp op, Expr& e1, Expr& e2) {
+			assert(e1.kind == ExprKind::Constant || e1.kind == ExprKind::NonReloc);
+			u32 rk1 = e1.kind == ExprKind::Constant ? rk_constant(u32(e1.info)) : u32(e1.info);
+			u32 rk2 = expr_to_rk(e2);
+			free_exprs(e1, e2);
+			switch(op) {
+				case BinOp::Ne:
+					e1.info = cond_jump(OpCode::Eq, 0, rk1, rk2);
+				break;
+
+				case BinOp::Gt:
+					e1.info = cond_jump(OpCode::Lt, 1, rk2, rk1);
+				break;
+
+				case BinOp::Ge:
+					e1.info = cond_jump(OpCode::Le, 1, rk2, rk1);
+				break;
+
+				default:
+					e1.info = cond_jump(OpCode(i32(OpCode::Eq) + i32(op) - i32(BinOp::Eq)), 1, rk1, rk2);
+			}
+			e1.kind = ExprKind::Jump;
+		}
+
+		void prefix(UnOp op, Expr& e, u32 line) {
+			switch(op) {
+				case UnOp::Minus:
+					if(e.is_numeral()) {
+						if(e.kind == ExprKind::Int) {
+							e.integer = i64(0 - u64(e.integer));
+							return;
+						}
+						if(e.number != 0.0) {
+							e.number = -e.number;
+							return;
+						}
+					}
+					code_unary(OpCode::Unm, e, line);
+				break;
+
+				case UnOp::Bnot: {
+					i64 i = 0;
+					if(e.is_numeral() && to_integer(e, i)) {
+						e = Expr(ExprKind::Int);
+						e.integer = ~i;
+						return;
+					}
+					code_unary(OpCode::Bnot, e, line);
+				} break;
+
+				case UnOp::Len:
+					code_unary(OpCode::Len, e, line);
+				break;
+
+				case UnOp::Not:
+					code_not(e);
+				break;
+
+				default:
+					assert(false);
+			}
+		}
+
+		void infix(BinOp op, Expr& e) {
+			switch(op) {
+				case BinOp::And:
+					go_if_true(e);
+				break;
+
+				case BinOp::Or:
+					go_if_false(e);
+				break;
+
+				case BinOp::Concat:
+					expr_to_next_reg(e);
+				break;
+
+				case BinOp::Add: case BinOp::Sub: case BinOp::Mul: case BinOp::Div:
+				case BinOp::Idiv: case BinOp::Mod: case BinOp::Pow:
+				case BinOp::Band: case BinOp::Bor: case BinOp::Bxor:
+				case BinOp::Shl: case BinOp::Shr:
+					// keep numerals, they might be folded
+					if(!e.is_numeral()) {
+						expr_to_rk(e);
+					}
+				break;
+
+				default:
+					expr_to_rk(e);
+			}
+		}
+
+		void postfix(BinOp op, Expr& e1, Expr& e2, u32 line) {
+			switch(op) {
+				case BinOp::And:
+					assert(e1.true_list == no_jump);
+					discharge_vars(e2);
+					concat(e2.false_list, e1.false_list);
+					e1 = e2;
+				break;
+
+				case BinOp::Or:
+					assert(e1.false_list == no_jump);
+					discharge_vars(e2);
+					concat(e2.true_list, e1.true_list);
+					e1 = e2;
+				break;
+
+				case BinOp::Concat:
+					expr_to_value(e2);
+					if(e2.kind == ExprKind::Relocable && OpCode(instruction(e2).opcode) == OpCode::Concat) {
+						assert(u32(e1.info) + 1 == u32(instruction(e2).B));
+						free_expr(e1);
+						instruction(e2).B = u32(e1.info);
+						e1.kind = ExprKind::Relocable;
+						e1.info = e2.info;
+					} else {
+						expr_to_next_reg(e2);
+						code_binary(OpCode::Concat, e1, e2, line);
+					}
+				break;
+
+				case BinOp::Eq: case BinOp::Lt: case BinOp::Le:
+				case BinOp::Ne: case BinOp::Gt: case BinOp::Ge:
+					code_comparison(op, e1, e2);
+				break;
+
+				default:
+					if(!fold(op, e1, e2)) {
+						code_binary(OpCode(i32(OpCode::Add) + i32(op)), e1, e2, line);
+					}
+			}
+		}
+
+		void set_list(u32 base, u32 count, i32 to_store) {
+			u32 c = (count - 1) / fields_per_flush + 1;
+			u32 b = to_store == multret ? 0 : u32(to_store);
+			if(c <= max_c) {
+				code_abc(OpCode::Setlist, base, b, c);
+			} else {
+				code_abc(OpCode::Setlist, base, b, 0);
+				Instruction extra = {};
+				extra.opcode = u32(OpCode::Extraarg);
+				set_bx(extra, c);
+				code(extra);
+			}
+			_fs->free_reg = base + 1;
+		}
+
+
+		// ------------------------------ parsing ------------------------------
+
+		void check(Token token) {
+			if(_lex.token() != token) {
+				error(expected_message(token));
+			}
+		}
+
+		void check_next(Token token) {
+			check(token);
+			_lex.next();
+		}
+
+		bool test_next(Token token) {
+			if(_lex.token() == token) {
+				_lex.next();
+				return true;
+			}
+			return false;
+		}
+
+		void check_match(Token what, u32 line) {
+			if(!test_next(what)) {
+				if(line == _lex.line()) {
+					error(expected_message(what));
+				}
+				throw SyntaxErrorException(expected_message(what), line);
+			}
+		}
+
+		std::string check_name() {
+			check(Token::Name);
+			std::string name = _lex.current().string;
+			_lex.next();
+			return name;
+		}
+
+		Expr string_expr(const std::string& str) {
+			return Expr(ExprKind::Constant, i32(string_constant(str)));
+		}
+
+		bool block_follow(bool with_until) const {
+			switch(_lex.token()) {
+				case Token::Else:
+				case Token::Elseif:
+				case Token::End:
+				case Token::Eos:
+					return true;
+				case Token::Until:
+					return with_until;
+				default:
+					return false;
+			}
+		}
+
+		void enter_level() {
+			if(++_levels > max_levels) {
+				error("Chunk has too many syntax levels.");
+			}
+		}
+
+		void leave_level() {
+			--_levels;
+		}
+
+		LocalVar& local_var(u32 i) {
+			return _fs->proto->locals[_active_vars[_fs->first_local + i]];
+		}
+
+		void new_local(std::string name) {
+			if(_active_vars.size() + 1 - _fs->first_local > max_vars) {
+				error("Too many local variables.");
+			}
+			_active_vars.push_back(u32(_fs->proto->locals.size()));
+			_fs->proto->locals.push_back(LocalVar{std::move(name), 0, 0});
+		}
+
+		void adjust_locals(u32 count) {
+			_fs->active_vars += count;
+			for(u32 i = count; i; --i) {
+				local_var(_fs->active_vars - i).start_pc = _fs->pc();
+			}
+		}
+
+		void remove_locals(u32 level) {
+			while(_fs->active_vars > level) {
+				local_var(--_fs->active_vars).end_pc = _fs->pc();
+			}
+			_active_vars.resize(_fs->first_local + level);
+		}
+
+		void enter_block(Block& block, bool is_loop) {
+			block.is_loop = is_loop;
+			block.active_vars = _fs->active_vars;
+			block.upvalue = false;
+			block.previous = _fs->block;
+			_fs->block = &block;
+			assert(_fs->free_reg == _fs->active_vars);
+		}
+
+		void leave_block() {
+			Block* block = _fs->block;
+			if(block->previous && block->upvalue) {
+				// jump to here to close upvalues
+				i32 j = jump();
+				patch_close(j, block->active_vars);
+				patch_to_here(j);
+			}
+			if(block->is_loop) {
+				for(const PendingBreak& b : block->breaks) {
+					patch_to_here(b.jumps);
+				}
+				block->breaks.clear();
+			}
+			_fs->block = block->previous;
+			remove_locals(block->active_vars);
+			_fs->free_reg = _fs->active_vars;
+
+			if(!block->breaks.empty()) {
+				if(!block->previous) {
+					error("Break outside a loop.");
+				}
+				for(PendingBreak& b : block->breaks) {
+					if(b.active_vars > block->active_vars) {
+						if(block->upvalue) {
+							patch_close(b.jumps, block->active_vars);
+						}
+						b.active_vars = block->active_vars;
+					}
+					block->previous->breaks.push_back(b);
+				}
+			}
+		}
+
+		void break_stat(i32 jumps) {
+			Block* block = _fs->block;
+			while(block && !block->is_loop) {
+				block = block->previous;
+			}
+			if(!block) {
+				error("Break outside a loop.");
+			}
+			_fs->block->breaks.push_back(PendingBreak{jumps, _fs->active_vars});
+		}
+
+		void mark_upvalue(u32 level) {
+			Block* block = _fs->block;
+			while(block->active_vars > level) {
+				block = block->previous;
+			}
+			block->upvalue = true;
+		}
+
+		i32 search_local(FuncState* fs, const std::string& name) {
+			for(i32 i = i32(fs->active_vars) - 1; i >= 0; --i) {
+				if(fs->proto->locals[_active_vars[fs->first_local + u32(i)]].name == name) {
+					return i;
+				}
+			}
+			return -1;
+		}
+
+		i32 search_upvalue(FuncState* fs, const std::string& name) {
+			const auto& upvalues = fs->proto->upvalues;
+			for(usize i = 0; i != upvalues.size(); ++i) {
+				if(upvalues[i].name == name) {
+					return i32(i);
+				}
+			}
+			return -1;
+		}
+
+		i32 new_upvalue(FuncState* fs, const std::string& name, const Expr& e) {
+			auto& upvalues = fs->proto->upvalues;
+			if(upvalues.size() >= max_upvalues) {
+				error("Too many upvalues.");
+			}
+			upvalues.push_back(UpValueDesc{name, e.kind == ExprKind::Local, u8(e.info)});
+			return i32(upvalues.size() - 1);
+		}
+
+		void single_var_aux(FuncState* fs, const std::string& name, Expr& var, bool base) {
+			if(!fs) {
+				var = Expr(ExprKind::Void);
+				return;
+			}
+			if(i32 v = search_local(fs, name); v >= 0) {
+				var = Expr(ExprKind::Local, v);
+				if(!base) {
+					FuncState* current = _fs;
+					_fs = fs;
+					mark_upvalue(u32(v));
+					_fs = current;
+				}
+				return;
+			}
+			i32 index = search_upvalue(fs, name);
+			if(index < 0) {
+				single_var_aux(fs->prev, name, var, false);
+				if(var.kind == ExprKind::Void) {
+					return;
+				}
+				index = new_upvalue(fs, name, var);
+			}
+			var = Expr(ExprKind::Upvalue, index);
+		}
+
+		void single_var(Expr& var) {
+			std::string name = check_name();
+			single_var_aux(_fs, name, var, true);
+			if(var.kind == ExprKind::Void) {
+				// global: _ENV[name]
+				single_var_aux(_fs, "_ENV", var, true);
+				assert(var.kind != ExprKind::Void);
+				Expr key = string_expr(name);
+				indexed(var, key);
+			}
+		}
+
+		void adjust_assign(u32 vars, u32 exprs, Expr& e) {
+			i32 extra = i32(vars) - i32(exprs);
+			if(e.has_multret()) {
+				extra = std::max(extra + 1, 0);
+				set_returns(e, extra);
+				if(extra > 1) {
+					reserve_regs(u32(extra - 1));
+				}
+			} else {
+				if(e.kind != ExprKind::Void) {
+					expr_to_next_reg(e);
+				}
+				if(extra > 0) {
+					u32 reg = _fs->free_reg;
+					reserve_regs(u32(extra));
+					load_nil(reg, u32(extra));
+				}
+			}
+			if(exprs > vars) {
+				_fs->free_reg -= exprs - vars;
+			}
+		}
+
+		void open_function(FuncState& fs, Proto* proto) {
+			fs.proto = proto;
+			fs.prev = _fs;
+			fs.first_local = u32(_active_vars.size());
+			_fs = &fs;
+		}
+
+		void close_function() {
+			ret(0, 0);
+			leave_block();
+			assert(!_fs->block);
+			_fs = _fs->prev;
+		}
+
+		// ------------------------------ expressions ------------------------------
+
+		void field_sel(Expr& v) {
+			expr_to_any_reg_up(v);
+			_lex.next(); // skip . or :
+			Expr key = string_expr(check_name());
+			indexed(v, key);
+		}
+
+		void index(Expr& v) {
+			_lex.next(); // skip [
+			expr(v);
+			expr_to_value(v);
+			check_next(Token::CloseBracket);
+		}
+
+		struct ConstructorState {
+			Expr* table = nullptr;
+			Expr value;
+			u32 hash_count = 0;
+			u32 array_count = 0;
+			u32 to_store = 0;
+		};
+
+		void rec_field(ConstructorState& cc) {
+			u32 reg = _fs->free_reg;
+			Expr key;
+			if(_lex.token() == Token::Name) {
+				key = string_expr(check_name());
+			} else {
+				index(key);
+			}
+			++cc.hash_count;
+			check_next(Token::Assign);
+			u32 rk_key = expr_to_rk(key);
+			Expr value;
+			expr(value);
+			code_abc(OpCode::Settable, u32(cc.table->info), rk_key, expr_to_rk(value));
+			_fs->free_reg = reg;
+		}
+
+		void close_list_field(ConstructorState& cc) {
+			if(cc.value.kind == ExprKind::Void) {
+				return;
+			}
+			expr_to_next_reg(cc.value);
+			cc.value = Expr(ExprKind::Void);
+			if(cc.to_store == fields_per_flush) {
+				set_list(u32(cc.table->info), cc.array_count, i32(cc.to_store));
+				cc.to_store = 0;
+			}
+		}
+
+		void last_list_field(ConstructorState& cc) {
+			if(!cc.to_store) {
+				return;
+			}
+			if(cc.value.has_multret()) {
+				set_multret(cc.value);
+				set_list(u32(cc.table->info), cc.array_count, multret);
+				--cc.array_count;
+			} else {
+				if(cc.value.kind != ExprKind::Void) {
+					expr_to_next_reg(cc.value);
+				}
+				set_list(u32(cc.table->info), cc.array_count, i32(cc.to_store));
+			}
+		}
+
+		void list_field(ConstructorState& cc) {
+			expr(cc.value);
+			++cc.array_count;
+			++cc.to_store;
+		}
+
+		void constructor(Expr& t) {
+			u32 line = _lex.line();
+			i32 pc = code_abc(OpCode::Newtable, 0, 0, 0);
+			ConstructorState cc;
+			cc.table = &t;
+			t = Expr(ExprKind::Relocable, pc);
+			expr_to_next_reg(t);
+			check_next(Token::OpenBrace);
+			do {
+				if(_lex.token() == Token::CloseBrace) {
+					break;
+				}
+				close_list_field(cc);
+				switch(_lex.token()) {
+					case Token::Name:
+						if(_lex.look_ahead() != Token::Assign) {
+							list_field(cc);
+						} else {
+							rec_field(cc);
+						}
+					break;
+
+					case Token::OpenBracket:
+						rec_field(cc);
+					break;
+
+					default:
+						list_field(cc);
+				}
+			} while(test_next(Token::Comma) || test_next(Token::Semicolon));
+			check_match(Token::CloseBrace, line);
+			last_list_field(cc);
+
+			Instruction& i = _fs->proto->code[usize(pc)];
+			i.B = int_to_fb(cc.array_count);
+			i.C = int_to_fb(cc.hash_count);
+		}
+
+		void param_list() {
+			Proto* proto = _fs->proto;
+			u32 params = 0;
+			if(_lex.token() != Token::CloseParen) {
+				do {
+					if(_lex.token() == Token::Name) {
+						new_local(check_name());
+						++params;
+					} else if(_lex.token() == Token::Dots) {
+						_lex.next();
+						proto->varargs = true;
+					} else {
+						error("<name> expected.");
+					}
+				} while(!proto->varargs && test_next(Token::Comma));
+			}
+			adjust_locals(params);
+			proto->params = u8(_fs->active_vars);
+			reserve_regs(_fs->active_vars);
+		}
+
+		void body(Expr& e, bool is_method, u32 line) {
+			Proto* proto = _fs->proto->protos.emplace_back(std::make_unique<Proto>()).get();
+			proto->line_defined = line;
+
+			FuncState fs;
+			open_function(fs, proto);
+			Block block;
+			enter_block(block, false);
+
+			check_next(Token::OpenParen);
+			if(is_method) {
+				new_local("self");
+				adjust_locals(1);
+			}
+			param_list();
+			check_next(Token::CloseParen);
+			statement_list();
+			proto->last_line_defined = _lex.line();
+			check_match(Token::End, line);
+			close_function();
+
+			// closure goes in the parent function
+			e = Expr(ExprKind::Relocable, code_abx(OpCode::Closure, 0, u32(_fs->proto->protos.size() - 1)));
+			expr_to_next_reg(e);
+		}
+
+		u32 expr_list(Expr& e) {
+			u32 count = 1;
+			expr(e);
+			while(test_next(Token::Comma)) {
+				expr_to_next_reg(e);
+				expr(e);
+				++count;
+			}
+			return count;
+		}
+
+		void func_args(Expr& f, u32 line) {
+			Expr args;
+			switch(_lex.token()) {
+				case Token::OpenParen:
+					_lex.next();
+					if(_lex.token() == Token::CloseParen) {
+						args = Expr(ExprKind::Void);
+					} else {
+						expr_list(args);
+						set_multret(args);
+					}
+					check_match(Token::CloseParen, line);
+				break;
+
+				case Token::OpenBrace:
+					constructor(args);
+				break;
+
+				case Token::String:
+					args = string_expr(_lex.current().string);
+					_lex.next();
+				break;
+
+				default:
+					error("Function arguments expected.");
+			}
+
+			assert(f.kind == ExprKind::NonReloc);
+			u32 base = u32(f.info);
+			i32 params = multret;
+			if(!args.has_multret()) {
+				if(args.kind != ExprKind::Void) {
+					expr_to_next_reg(args);
+				}
+				params = i32(_fs->free_reg - (base + 1));
+			}
+			f = Expr(ExprKind::Call, code_abc(OpCode::Call, base, u32(params + 1), 2));
+			fix_line(line);
+			_fs->free_reg = base + 1;
+		}
+
+		void primary_expr(Expr& v) {
+			switch(_lex.token()) {
+				case Token::OpenParen: {
+					u32 line = _lex.line();
+					_lex.next();
+					expr(v);
+					check_match(Token::CloseParen, line);
+					discharge_vars(v);
+				} break;
+
+				case Token::Name:
+					single_var(v);
+				break;
+
+				default:
+					error("Unexpected symbol.");
+			}
+		}
+
+		void suffixed_expr(Expr& v) {
+			u32 line = _lex.line();
+			primary_expr(v);
+			for(;;) {
+				switch(_lex.token()) {
+					case Token::Dot:
+						field_sel(v);
+					break;
+
+					case Token::OpenBracket: {
+						expr_to_any_reg_up(v);
+						Expr key;
+						index(key);
+						indexed(v, key);
+					} break;
+
+					case Token::Colon: {
+						_lex.next();
+						Expr key = string_expr(check_name());
+						self(v, key);
+						func_args(v, line);
+					} break;
+
+					case Token::OpenParen:
+					case Token::String:
+					case Token::OpenBrace:
+						expr_to_next_reg(v);
+						func_args(v, line);
+					break;
+
+					default:
+						return;
+				}
+			}
+		}
+
+		void simple_expr(Expr& v) {
+			switch(_lex.token()) {
+				case Token::Number:
+					v = Expr(ExprKind::Float);
+					v.number = _lex.current().number;
+				break;
+
+				case Token::Integer:
+					v = Expr(ExprKind::Int);
+					v.integer = _lex.current().integer;
+				break;
+
+				case Token::String:
+					v = string_expr(_lex.current().string);
+				break;
+
+				case Token::Nil:
+					v = Expr(ExprKind::Nil);
+				break;
+
+				case Token::True:
+					v = Expr(ExprKind::True);
+				break;
+
+				case Token::False:
+					v = Expr(ExprKind::False);
+				break;
+
+				case Token::Dots:
+					if(!_fs->proto->varargs) {
+						error("Cannot use '...' outside a vararg function.");
+					}
+					v = Expr(ExprKind::Vararg, code_abc(OpCode::Vararg, 0, 1, 0));
+				break;
+
+				case Token::OpenBrace:
+					constructor(v);
+				return;
+
+				case Token::Function: {
+					u32 line = _lex.line();
+					_lex.next();
+					body(v, false, line);
+				} return;
+
+				default:
+					suffixed_expr(v);
+				return;
+			}
+			_lex.next();
+		}
+
+		BinOp sub_expr(Expr& v, u32 limit) {
+			enter_level();
+			UnOp uop = unary_op(_lex.token());
+			if(uop != UnOp::None) {
+				u32 line = _lex.line();
+				_lex.next();
+				sub_expr(v, unary_priority);
+				prefix(uop, v, line);
+			} else {
+				simple_expr(v);
+			}
+
+			BinOp op = binary_op(_lex.token());
+			while(op != BinOp::None && priorities[usize(op)].left > limit) {
+				u32 line = _lex.line();
+				_lex.next();
+				infix(op, v);
+				Expr v2;
+				BinOp next_op = sub_expr(v2, priorities[usize(op)].right);
+				postfix(op, v, v2, line);
+				op = next_op;
+			}
+			leave_level();
+			return op;
+		}
+
+		void expr(Expr& v) {
+			sub_expr(v, 0);
+		}
+
+		// ------------------------------ statements ------------------------------
+
+		void block() {
+			Block bl;
+			enter_block(bl, false);
+			statement_list();
+			leave_block();
+		}
+
+		struct AssignTarget {
+			AssignTarget* prev = nullptr;
+			Expr var;
+		};
+
+		// if a local used as table or key is assigned before the indexed var, copy it first
+		void check_conflict(AssignTarget* lhs, const Expr& v) {
+			u32 extra = _fs->free_reg;
+			bool conflict = false;
+			for(; lhs; lhs = lhs->prev) {
+				Expr& var = lhs->var;
+				if(var.kind != ExprKind::Indexed) {
+					continue;
+				}
+				if(var.indexed.table_kind == v.kind && var.indexed.table == u32(v.info)) {
+					conflict = true;
+					var.indexed.table_kind = ExprKind::Local;
+					var.indexed.table = extra;
+				}
+				if(v.kind == ExprKind::Local && var.indexed.key == u32(v.info)) {
+					conflict = true;
+					var.indexed.key = extra;
+				}
+			}
+			if(conflict) {
+				code_abc(v.kind == ExprKind::Local ? OpCode::Move : OpCode::Getupval, extra, u32(v.info), 0);
+				reserve_regs(1);
+			}
+		}
+
+		void assignment(AssignTarget& lhs, u32 vars) {
+			if(!lhs.var.is_var()) {
+				error("Syntax error.");
+			}
+			Expr e;
+			if(test_next(Token::Comma)) {
+				AssignTarget next;
+				next.prev = &lhs;
+				suffixed_expr(next.var);
+				if(next.var.kind != ExprKind::Indexed) {
+					check_conflict(&lhs, next.var);
+				}
+				enter_level();
+				assignment(next, vars + 1);
+				leave_level();
+			} else {
+				check_next(Token::Assign);
+				u32 exprs = expr_list(e);
+				if(exprs == vars) {
+					set_one_ret(e);
+					store_var(lhs.var, e);
+					return;
+				}
+				adjust_assign(vars, exprs, e);
+			}
+			e = Expr(ExprKind::NonReloc, i32(_fs->free_reg - 1));
+			store_var(lhs.var, e);
+		}
+
+		i32 cond() {
+			Expr v;
+			expr(v);
+			if(v.kind == ExprKind::Nil) {
+				v.kind = ExprKind::False;
+			}
+			go_if_true(v);
+			return v.false_list;
+		}
+
+		void while_stat(u32 line) {
+			_lex.next();
+			i32 while_init = get_label();
+			i32 cond_exit = cond();
+			Block bl;
+			enter_block(bl, true);
+			check_next(Token::Do);
+			block();
+			jump_to(while_init);
+			check_match(Token::End, line);
+			leave_block();
+			patch_to_here(cond_exit);
+		}
+
+		void repeat_stat(u32 line) {
+			i32 repeat_init = get_label();
+			Block loop;
+			Block scope;
+			enter_block(loop, true);
+			enter_block(scope, false);
+			_lex.next();
+			statement_list();
+			check_match(Token::Until, line);
+			i32 cond_exit = cond();
+			if(scope.upvalue) {
+				patch_close(cond_exit, scope.active_vars);
+			}
+			leave_block();
+			patch_list(cond_exit, repeat_init);
+			leave_block();
+		}
+
+		void expr_to_next(Expr& e) {
+			expr(e);
+			expr_to_next_reg(e);
+		}
+
+		void for_body(u32 base, u32 line, u32 vars, bool is_num) {
+			adjust_locals(3);
+			check_next(Token::Do);
+			i32 prep = is_num ? code_asbx(OpCode::Forprep, base, no_jump) : jump();
+			Block bl;
+			enter_block(bl, false);
+			adjust_locals(vars);
+			reserve_regs(vars);
+			block();
+			leave_block();
+			patch_to_here(prep);
+			i32 end = 0;
+			if(is_num) {
+				end = code_asbx(OpCode::Forloop, base, no_jump);
+			} else {
+				code_abc(OpCode::Tforcall, base, 0, vars);
+				fix_line(line);
+				end = code_asbx(OpCode::Tforloop, base + 2, no_jump);
+			}
+			patch_list(end, prep + 1);
+			fix_line(line);
+		}
+
+		void for_num(std::string name, u32 line) {
+			u32 base = _fs->free_reg;
+			new_local("(for index)");
+			new_local("(for limit)");
+			new_local("(for step)");
+			new_local(std::move(name));
+			check_next(Token::Assign);
+			Expr e;
+			expr_to_next(e);
+			check_next(Token::Comma);
+			expr_to_next(e);
+			if(test_next(Token::Comma)) {
+				expr_to_next(e);
+			} else {
+				code_k(_fs->free_reg, int_constant(1));
+				reserve_regs(1);
+			}
+			for_body(base, line, 1, true);
+		}
+
+		void for_list(std::string name) {
+			u32 base = _fs->free_reg;
+			u32 vars = 4;
+			new_local("(for generator)");
+			new_local("(for state)");
+			new_local("(for control)");
+			new_local(std::move(name));
+			while(test_next(Token::Comma)) {
+				new_local(check_name());
+				++vars;
+			}
+			check_next(Token::In);
+			u32 line = _lex.line();
+			Expr e;
+			adjust_assign(3, expr_list(e), e);
+			check_stack(3);
+			for_body(base, line, vars - 3, false);
+		}
+
+		void for_stat(u32 line) {
+			Block bl;
+			enter_block(bl, true);
+			_lex.next();
+			std::string name = check_name();
+			switch(_lex.token()) {
+				case Token::Assign:
+					for_num(std::move(name), line);
+				break;
+
+				case Token::Comma:
+				case Token::In:
+					for_list(std::move(name));
+				break;
+
+				default:
+					error("'=' or 'in' expected.");
+			}
+			check_match(Token::End, line);
+			leave_block();
+		}
+
+		void test_then_block(i32& escape_list) {
+			Block bl;
+			i32 jump_false = no_jump;
+
+			_lex.next(); // if or elseif
+			Expr v;
+			expr(v);
+			check_next(Token::Then);
+			if(_lex.token() == Token::Break) {
+				// jump directly to the loop exit if the condition is true
+				go_if_false(v);
+				enter_block(bl, false);
+				_lex.next();
+				break_stat(v.true_list);
+				while(test_next(Token::Semicolon)) {
+				}
+				if(block_follow(false)) {
+					leave_block();
+					return;
+				}
+				jump_false = jump();
+			} else {
+				go_if_true(v);
+				enter_block(bl, false);
+				jump_false = v.false_list;
+			}
+			statement_list();
+			leave_block();
+			if(_lex.token() == Token::Else || _lex.token() == Token::Elseif) {
+				concat(escape_list, jump());
+			}
+			patch_to_here(jump_false);
+		}
+
+		void if_stat(u32 line) {
+			i32 escape_list = no_jump;
+			test_then_block(escape_list);
+			while(_lex.token() == Token::Elseif) {
+				test_then_block(escape_list);
+			}
+			if(test_next(Token::Else)) {
+				block();
+			}
+			check_match(Token::End, line);
+			patch_to_here(escape_list);
+		}
+
+		void local_func() {
+			new_local(check_name());
+			adjust_locals(1);
+			Expr b;
+			body(b, false, _lex.line());
+			// debug information will only see the variable after this point
+			local_var(u32(b.info)).start_pc = _fs->pc();
+		}
+
+		void local_stat() {
+			u32 vars = 0;
+			do {
+				new_local(check_name());
+				++vars;
+			} while(test_next(Token::Comma));
+			Expr e;
+			u32 exprs = 0;
+			if(test_next(Token::Assign)) {
+				exprs = expr_list(e);
+			}
+			adjust_assign(vars, exprs, e);
+			adjust_locals(vars);
+		}
+
+		bool func_name(Expr& v) {
+			single_var(v);
+			while(_lex.token() == Token::Dot) {
+				field_sel(v);
+			}
+			if(_lex.token() == Token::Colon) {
+				field_sel(v);
+				return true;
+			}
+			return false;
+		}
+
+		void func_stat(u32 line) {
+			_lex.next();
+			Expr v;
+			bool is_method = func_name(v);
+			Expr b;
+			body(b, is_method, line);
+			store_var(v, b);
+			fix_line(line);
+		}
+
+		void expr_stat() {
+			AssignTarget v;
+			suffixed_expr(v.var);
+			if(_lex.token() == Token::Assign || _lex.token() == Token::Comma) {
+				assignment(v, 1);
+			} else {
+				if(v.var.kind != ExprKind::Call) {
+					error("Syntax error.");
+				}
+				instruction(v.var).C = 1;
+			}
+		}
+
+		void return_stat() {
+			u32 first = 0;
+			i32 count = 0;
+			Expr e;
+			if(!block_follow(true) && _lex.token() != Token::Semicolon) {
+				count = i32(expr_list(e));
+				if(e.has_multret()) {
+					set_multret(e);
+					if(e.kind == ExprKind::Call && count == 1) {
+						instruction(e).opcode = u32(OpCode::Tailcall);
+					}
+					first = _fs->active_vars;
+					count = multret;
+				} else if(count == 1) {
+					first = expr_to_any_reg(e);
+				} else {
+					expr_to_next_reg(e);
+					first = _fs->active_vars;
+					assert(u32(count) == _fs->free_reg - first);
+				}
+			}
+			ret(first, count);
+			test_next(Token::Semicolon);
+		}
+
+		void statement() {
+			u32 line = _lex.line();
+			enter_level();
+			switch(_lex.token()) {
+				case Token::Semicolon:
+					_lex.next();
+				break;
+
+				case Token::If:
+					if_stat(line);
+				break;
+
+				case Token::While:
+					while_stat(line);
+				break;
+
+				case Token::Do:
+					_lex.next();
+					block();
+					check_match(Token::End, line);
+				break;
+
+				case Token::For:
+					for_stat(line);
+				break;
+
+				case Token::Repeat:
+					repeat_stat(line);
+				break;
+
+				case Token::Function:
+					func_stat(line);
+				break;
+
+				case Token::Local:
+					_lex.next();
+					if(test_next(Token::Function)) {
+						local_func();
+					} else {
+						local_stat();
+					}
+				break;
+
+				case Token::Return:
+					_lex.next();
+					return_stat();
+				break;
+
+				case Token::Break:
+					_lex.next();
+					break_stat(jump());
+				break;
+
+				case Token::DoubleColon:
+				case Token::Goto:
+					error("Goto and labels are not supported.");
+
+				default:
+					expr_stat();
+			}
+			assert(_fs->proto->max_stack >= _fs->free_reg && _fs->free_reg >= _fs->active_vars);
+			_fs->free_reg = _fs->active_vars;
+			leave_level();
+		}
+
+		void statement_list() {
+			while(!block_follow(true)) {
+				if(_lex.token() == Token::Return) {
+					statement();
+					return;
+				}
+				statement();
+			}
+		}
+
+		Lexer _lex;
+		FuncState* _fs = nullptr;
+		std::vector<u32> _active_vars;
+		u32 _levels = 0;
+};
+
+std::unique_ptr<Proto> Compiler::main_function() {
+	auto main = std::make_unique<Proto>();
+	main->varargs = true;
+
+	FuncState fs;
+	open_function(fs, main.get());
+	Block block;
+	enter_block(block, false);
+
+	// main function always has _ENV as its only upvalue
+	new_upvalue(_fs, "_ENV", Expr(ExprKind::Local, 0));
+
+	statement_list();
+	check(Token::Eos);
+	close_function();
+
+	return main;
+}
+
+
+class ChunkWriter {
+	public:
+		ChunkWriter(std::vector<u8>& out) : _out(out) {
+		}
+
+		template<typename T>
+		void write(T t) {
+			const u8* bytes = reinterpret_cast<const u8*>(&t);
+			_out.insert(_out.end(), bytes, bytes + sizeof(T));
+		}
+
+		void write_string(std::string_view str) {
+			usize size = str.size() + 1;
+			if(size < 0xFF) {
+				write(u8(size));
+			} else {
+				write(u8(0xFF));
+				write(size);
+			}
+			_out.insert(_out.end(), str.begin(), str.end());
+		}
+
+		void write_null_string() {
+			write(u8(0));
+		}
+
+		void write_header(u8 upvalues) {
+			write(u32(0x61754c1b));
+			write(u8(0x53));
+			write(u8(0)); // format
+			const u8 check[] = {0x19, 0x93, 0x0d, 0x0a, 0x1a, 0x0a};
+			_out.insert(_out.end(), std::begin(check), std::end(check));
+			write(u8(sizeof(i32)));
+			write(u8(sizeof(usize)));
+			write(u8(sizeof(Instruction)));
+			write(u8(sizeof(i64)));
+			write(u8(sizeof(double)));
+			write(i64(0x5678));
+			write(double(370.5));
+			write(upvalues);
+		}
+
+		void write_function(const Proto& proto, std::string_view source) {
+			if(source.empty()) {
+				write_null_string();
+			} else {
+				write_string(source);
+			}
+			write(u32(proto.line_defined));
+			write(u32(proto.last_line_defined));
+			write(proto.params);
+			write(u8(proto.varargs));
+			write(proto.max_stack);
+
+			write(u32(proto.code.size()));
+			for(Instruction i : proto.code) {
+				write(i);
+			}
+
+			write(u32(proto.constants.size()));
+			for(const CompiledConstant& cst : proto.constants) {
+				write(u8(cst.type));
+				switch(cst.type) {
+					case ConstantType::String:
+					case ConstantType::LongString:
+						write_string(cst.string);
+					break;
+
+					case ConstantType::Integer:
+						write(cst.integer);
+					break;
+
+					case ConstantType::Number:
+						write(cst.number);
+					break;
+
+					default:
+					break;
+				}
+			}
+
+			write(u32(proto.upvalues.size()));
+			for(const UpValueDesc& up : proto.upvalues) {
+				write(u8(up.in_stack));
+				write(up.index);
+			}
+
+			write(u32(proto.protos.size()));
+			for(const auto& p : proto.protos) {
+				write_function(*p, std::string_view());
+			}
+
+			// debug
+			write(u32(proto.lines.size()));
+			for(u32 line : proto.lines) {
+				write(line);
+			}
+
+			write(u32(proto.locals.size()));
+			for(const LocalVar& local : proto.locals) {
+				write_string(local.name);
+				write(u32(local.start_pc));
+				write(u32(local.end_pc));
+			}
+
+			write(u32(proto.upvalues.size()));
+			for(const UpValueDesc& up : proto.upvalues) {
+				write_string(up.name);
+			}
+		}
+
+	private:
+		std::vector<u8>& _out;
+};
+
+std::vector<u8> compile_lua(std::string_view source, std::string_view chunk_name) {
+	Compiler compiler(source);
+	std::unique_ptr<Proto> main = compiler.main_function();
+
+	std::vector<u8> chunk;
+	ChunkWriter writer(chunk);
+	writer.write_header(u8(main->upvalues.size()));
+	writer.write_function(*main, chunk_name);
+	return chunk;
+}
+
+}
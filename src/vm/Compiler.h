@@ -0,0 +1,41 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_COMPILER_H
+#define JIT_COMPILER_H
+
+#include <utils.h>
+
+#include <vector>
+#include <string_view>
+
+namespace jit {
+
+// Bump whenever compile_lua emits different code for the same source, cached chunks of older revisions are then discarded
+constexpr u32 compiler_revision = 3;
+
+// Compiles Lua 5.3 source into a luac chunk, in a single pass and without building an AST.
+// Throws SyntaxErrorException on invalid code.
+std::vector<u8> compile_lua(std::string_view source, std::string_view chunk_name = "=?");
+
+}
+
+#endif // JIT_COMPILER_H
@@ -0,0 +1,64 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "EventLoop.h"
+
+namespace jit {
+
+void EventLoop::spawn(VM& vm, const Program& program) {
+	if(!vm.start(program, nullptr)) {
+		++_suspended;
+	}
+}
+
+void EventLoop::complete(Continuation cont, std::vector<Value> results) {
+	{
+		std::unique_lock lock(_lock);
+		_completed.emplace_back(cont.vm, std::move(results));
+	}
+	_condition.notify_one();
+}
+
+void EventLoop::run() {
+	std::vector<std::pair<VM*, std::vector<Value>>> completed;
+	while(_suspended) {
+		{
+			std::unique_lock lock(_lock);
+			_condition.wait(lock, [this] { return !_completed.empty(); });
+			std::swap(completed, _completed);
+		}
+
+		for(auto& [vm, results] : completed) {
+			assert(vm->is_suspended());
+			if(vm->resume(Span<Value>(results.data(), results.size()))) {
+				--_suspended;
+			}
+		}
+		completed.clear();
+	}
+}
+
+usize EventLoop::pending() const {
+	return _suspended;
+}
+
+}
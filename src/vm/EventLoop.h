@@ -0,0 +1,56 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_EVENTLOOP_H
+#define JIT_EVENTLOOP_H
+
+#include "VM.h"
+
+#include <mutex>
+#include <condition_variable>
+
+namespace jit {
+
+// Runs many VMs on a single thread, resuming them as their async calls complete.
+class EventLoop {
+
+	public:
+		void spawn(VM& vm, const Program& program);
+
+		// Can be called from any thread
+		void complete(Continuation cont, std::vector<Value> results);
+
+		// Returns once every spawned VM has finished
+		void run();
+
+		usize pending() const;
+
+	private:
+		std::mutex _lock;
+		std::condition_variable _condition;
+		std::vector<std::pair<VM*, std::vector<Value>>> _completed;
+
+		usize _suspended = 0;
+};
+
+}
+
+#endif // JIT_EVENTLOOP_H
@@ -0,0 +1,336 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "File.h"
+#include "pattern.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <string>
+
+#include <sys/stat.h>
+
+#ifdef __WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace jit {
+
+// Lua reads at most this many characters for a number
+static constexpr usize max_numeral_size = 200;
+
+// intrusive list, so it doesn't depend on the destruction order of statics at exit
+static File* open_files = nullptr;
+
+// a block read on a terminal would wait for the whole block to be typed
+static bool is_terminal(std::FILE* file) {
+#ifdef __WIN32
+	return _isatty(_fileno(file));
+#else
+	return isatty(fileno(file));
+#endif
+}
+
+// bytes left in regular files, -1 for anything else
+static i64 remaining_size(std::FILE* file) {
+#ifdef __WIN32
+	struct _stati64 st = {};
+	if(_fstati64(_fileno(file), &st) || !(st.st_mode & _S_IFREG)) {
+		return -1;
+	}
+	i64 position = _ftelli64(file);
+#else
+	struct stat st = {};
+	if(fstat(fileno(file), &st) || !S_ISREG(st.st_mode)) {
+		return -1;
+	}
+	i64 position = ftello(file);
+#endif
+	return position < 0 ? -1 : std::max(i64(st.st_size) - position, i64(0));
+}
+
+File::File(std::FILE* file, bool owned, OutputBuffer* output) :
+		_file(file),
+		_owned(owned),
+		_interactive(is_terminal(file)),
+		_output(output) {
+
+	if(_owned) {
+		static bool registered = (std::atexit(&File::flush_all), true);
+		unused(registered);
+
+		_next = open_files;
+		if(_next) {
+			_next->_prev = this;
+		}
+		open_files = this;
+	}
+}
+
+File::~File() {
+	close();
+}
+
+void File::tie(OutputBuffer* output) {
+	_tied = output;
+}
+
+bool File::is_closed() const {
+	return !_file;
+}
+
+bool File::is_owned() const {
+	return _owned;
+}
+
+bool File::close() {
+	if(!_file) {
+		return false;
+	}
+	flush();
+	if(!_owned) {
+		return false;
+	}
+
+	_own_output = nullptr;
+	_output = nullptr;
+	bool ok = !std::fclose(_file);
+	_file = nullptr;
+
+	(_prev ? _prev->_next : open_files) = _next;
+	if(_next) {
+		_next->_prev = _prev;
+	}
+	_prev = _next = nullptr;
+
+	return ok;
+}
+
+void File::flush() {
+	if(_output) {
+		_output->flush();
+	}
+}
+
+void File::flush_all() {
+	for(File* file = open_files; file; file = file->_next) {
+		file->flush();
+	}
+}
+
+usize File::buffered() const {
+	return _end - _begin;
+}
+
+const char* File::buffer_begin() const {
+	return _buffer.get() + _begin;
+}
+
+const char* File::buffer_end() const {
+	return _buffer.get() + _end;
+}
+
+bool File::fill() {
+	assert(!buffered());
+
+	if(_tied) {
+		_tied->flush();
+	}
+	if(_own_output) {
+		_own_output->flush();
+	}
+	if(!_buffer) {
+		_buffer = std::make_unique<char[]>(read_buffer_size);
+	}
+
+	usize size = 0;
+	if(_interactive) {
+		for(int c = 0; size != read_buffer_size && (c = std::getc(_file)) != EOF;) {
+			_buffer[size++] = char(c);
+			if(c == '\n') {
+				break;
+			}
+		}
+	} else {
+		size = std::fread(_buffer.get(), 1, read_buffer_size, _file);
+	}
+
+	_begin = 0;
+	_end = size;
+	return size;
+}
+
+Value File::read_line(bool keep_newline) {
+	if(!buffered() && !fill()) {
+		return Value();
+	}
+
+	// most lines are entirely in the buffer and don't need to be copied twice
+	const char* newline = find_byte(buffer_begin(), buffer_end(), '\n');
+	if(newline != buffer_end()) {
+		std::string_view line(buffer_begin(), usize(newline - buffer_begin()) + keep_newline);
+		_begin += usize(newline - buffer_begin()) + 1;
+		return Value(line);
+	}
+
+	std::string line(buffer_begin(), buffered());
+	_begin = _end;
+	while(fill()) {
+		newline = find_byte(buffer_begin(), buffer_end(), '\n');
+		if(newline != buffer_end()) {
+			line.append(buffer_begin(), newline + keep_newline);
+			_begin += usize(newline - buffer_begin()) + 1;
+			break;
+		}
+		line.append(buffer_begin(), buffer_end());
+		_begin = _end;
+	}
+	return Value(std::string_view(line));
+}
+
+Value File::read_number() {
+	auto peek = [this]() -> int {
+		return buffered() || fill() ? u8(_buffer[_begin]) : EOF;
+	};
+
+	while(std::isspace(peek())) {
+		++_begin;
+	}
+
+	// same grammar as Lua's l_getn, the numeral is then converted like any string
+	std::string numeral;
+	auto accept = [&](const char* set) {
+		int c = peek();
+		if(c == EOF || !c || numeral.size() >= max_numeral_size || !std::strchr(set, c)) {
+			return false;
+		}
+		numeral.push_back(char(c));
+		++_begin;
+		return true;
+	};
+	auto accept_digits = [&](bool hex) {
+		usize count = 0;
+		for(int c = peek(); c != EOF && (hex ? std::isxdigit(c) : std::isdigit(c)) && numeral.size() < max_numeral_size; c = peek()) {
+			numeral.push_back(char(c));
+			++_begin;
+			++count;
+		}
+		return count;
+	};
+
+	accept("+-");
+	bool hex = false;
+	usize digits = 0;
+	if(accept("0")) {
+		hex = accept("xX");
+		digits = hex ? 0 : 1;
+	}
+	digits += accept_digits(hex);
+	if(accept(".")) {
+		digits += accept_digits(hex);
+	}
+	if(digits && accept(hex ? "pP" : "eE")) {
+		accept("+-");
+		accept_digits(false);
+	}
+
+	Value number;
+	if(string_to_number(numeral, number)) {
+		return number;
+	}
+	return Value();
+}
+
+Value File::read_bytes(usize count) {
+	if(!buffered() && !fill()) {
+		return Value();
+	}
+	if(buffered() >= count) {
+		std::string_view bytes(buffer_begin(), count);
+		_begin += count;
+		return Value(bytes);
+	}
+
+	std::string bytes(buffer_begin(), buffered());
+	_begin = _end;
+	while(bytes.size() < count && fill()) {
+		usize size = std::min(count - bytes.size(), buffered());
+		bytes.append(buffer_begin(), size);
+		_begin += size;
+	}
+	return Value(std::string_view(bytes));
+}
+
+Value File::read_all() {
+	if(_tied) {
+		_tied->flush();
+	}
+	if(_own_output) {
+		_own_output->flush();
+	}
+
+	// regular files are read straight into the string, in one allocation
+	const usize prefix = buffered();
+	if(i64 remaining = remaining_size(_file); remaining >= 0) {
+		usize read = 0;
+		String* str = String::build(prefix + usize(remaining), [&](char* data) {
+			std::copy_n(buffer_begin(), prefix, data);
+			read = std::fread(data + prefix, 1, usize(remaining), _file);
+		});
+		_begin = _end;
+		if(read == usize(remaining)) {
+			return Value(str);
+		}
+		return Value(std::string_view(str->data(), prefix + read));
+	}
+
+	std::string data(buffer_begin(), prefix);
+	_begin = _end;
+	for(usize block = read_buffer_size;; block = std::min(block * 2, usize(64) << 20)) {
+		usize size = data.size();
+		data.resize(size + block);
+		usize read = std::fread(data.data() + size, 1, block, _file);
+		data.resize(size + read);
+		if(read != block) {
+			break;
+		}
+	}
+	return Value(std::string_view(data));
+}
+
+OutputBuffer& File::output() {
+	// read ahead data is given back to the file, so writes land where reads stopped.
+	// Pipes and terminals can't seek and have no position to write at, the data stays buffered for the next read.
+	if(buffered() && !std::fseek(_file, -long(buffered()), SEEK_CUR)) {
+		_begin = _end = 0;
+	}
+	if(!_output) {
+		_own_output = std::make_unique<OutputBuffer>(_file);
+		_output = _own_output.get();
+	}
+	return *_output;
+}
+
+}
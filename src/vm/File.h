@@ -0,0 +1,93 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_FILE_H
+#define JIT_FILE_H
+
+#include "OutputBuffer.h"
+
+#include <cstdio>
+#include <memory>
+
+namespace jit {
+
+// File handle of the io library.
+// Reads go through a large buffer that lines are cut out of with SIMD newline searches,
+// writes go through an OutputBuffer. Switching between the two keeps the file position right.
+class File : public Userdata {
+	public:
+		static constexpr usize read_buffer_size = 256 * 1024;
+
+		File(const File&) = delete;
+		File& operator=(const File&) = delete;
+
+		// owned files are closed by close() and on destruction, the others are only flushed.
+		// output replaces the buffer the file would use for writes.
+		File(std::FILE* file, bool owned, OutputBuffer* output = nullptr);
+		~File() override;
+
+		// output is flushed before reads have to wait for the file, for prompts on stdin
+		void tie(OutputBuffer* output);
+
+		bool is_closed() const;
+		bool is_owned() const;
+
+		bool close();
+		void flush();
+
+		// all return nil at the end of the file, read_all returns an empty string instead
+		Value read_line(bool keep_newline);
+		Value read_number();
+		Value read_bytes(usize count);
+		Value read_all();
+
+		OutputBuffer& output();
+
+		// flushes every owned file that is still open, at exit
+		static void flush_all();
+
+	private:
+		// only called once everything buffered has been consumed, false at the end of the file
+		bool fill();
+
+		usize buffered() const;
+		const char* buffer_begin() const;
+		const char* buffer_end() const;
+
+		std::FILE* _file = nullptr;
+		bool _owned = false;
+		bool _interactive = false;
+
+		std::unique_ptr<char[]> _buffer;
+		usize _begin = 0;
+		usize _end = 0;
+
+		std::unique_ptr<OutputBuffer> _own_output;
+		OutputBuffer* _output = nullptr;
+		OutputBuffer* _tied = nullptr;
+
+		File* _prev = nullptr;
+		File* _next = nullptr;
+};
+
+}
+
+#endif // JIT_FILE_H
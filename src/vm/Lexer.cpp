@@ -0,0 +1,485 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "Lexer.h"
+#include "exceptions.h"
+#include "number.h"
+
+#include <cctype>
+
+namespace jit {
+
+static const char* reserved_words[] = {
+	"and", "break", "do", "else", "elseif", "end", "false", "for", "function", "goto", "if", "in",
+	"local", "nil", "not", "or", "repeat", "return", "then", "true", "until", "while"
+};
+
+static bool is_digit(char c) {
+	return std::isdigit(u8(c));
+}
+
+static bool is_hex_digit(char c) {
+	return std::isxdigit(u8(c));
+}
+
+static bool is_alpha(char c) {
+	return std::isalpha(u8(c)) || c == '_';
+}
+
+static bool is_alnum(char c) {
+	return std::isalnum(u8(c)) || c == '_';
+}
+
+static u32 hex_value(char c) {
+	return is_digit(c) ? u32(c - '0') : u32(std::tolower(u8(c)) - 'a' + 10);
+}
+
+
+Lexer::Lexer(std::string_view source) : _source(source) {
+	// skip first line if it's a comment (for #!)
+	if(peek() == '#') {
+		while(!is_at_end() && peek() != '\n' && peek() != '\r') {
+			advance();
+		}
+	}
+	next();
+}
+
+void Lexer::next() {
+	_last_line = _line;
+	if(_has_ahead) {
+		_current = std::move(_ahead);
+		_has_ahead = false;
+	} else {
+		_current = read();
+	}
+}
+
+Token Lexer::look_ahead() {
+	if(!_has_ahead) {
+		_ahead = read();
+		_has_ahead = true;
+	}
+	return _ahead.token;
+}
+
+const Lexer::Lexeme& Lexer::current() const {
+	return _current;
+}
+
+Token Lexer::token() const {
+	return _current.token;
+}
+
+u32 Lexer::line() const {
+	return _line;
+}
+
+u32 Lexer::last_line() const {
+	return _last_line;
+}
+
+void Lexer::error(const char* msg) const {
+	throw SyntaxErrorException(msg, _line);
+}
+
+char Lexer::peek(usize offset) const {
+	return _pos + offset < _source.size() ? _source[_pos + offset] : '\0';
+}
+
+bool Lexer::is_at_end() const {
+	return _pos >= _source.size();
+}
+
+void Lexer::advance() {
+	++_pos;
+}
+
+void Lexer::newline() {
+	char old = peek();
+	advance();
+	if((peek() == '\n' || peek() == '\r') && peek() != old) {
+		advance();
+	}
+	++_line;
+}
+
+bool Lexer::check_next(char c) {
+	if(peek() == c) {
+		advance();
+		return true;
+	}
+	return false;
+}
+
+// reads [=*[ or ]=*], returns the number of '=' if well formed, -count - 1 otherwise
+i32 Lexer::long_string_level() {
+	char s = peek();
+	i32 count = 0;
+	advance();
+	while(peek() == '=') {
+		advance();
+		++count;
+	}
+	return peek() == s ? count : -count - 1;
+}
+
+void Lexer::read_long_string(usize level, Lexeme* lex) {
+	advance(); // second [
+	if(peek() == '\n' || peek() == '\r') {
+		newline();
+	}
+	for(;;) {
+		if(is_at_end()) {
+			error(lex ? "Unfinished long string." : "Unfinished long comment.");
+		}
+		switch(peek()) {
+			case ']': {
+				usize start = _pos;
+				if(long_string_level() == i32(level)) {
+					advance(); // second ]
+					return;
+				}
+				if(lex) {
+					lex->string.append(_source.substr(start, _pos - start));
+				}
+			} break;
+
+			case '\n':
+			case '\r':
+				newline();
+				if(lex) {
+					lex->string.push_back('\n');
+				}
+			break;
+
+			default:
+				if(lex) {
+					lex->string.push_back(peek());
+				}
+				advance();
+		}
+	}
+}
+
+void Lexer::utf8_escape(std::string& str) {
+	advance(); // u
+	if(!check_next('{')) {
+		error("Missing '{' in \\u{xxxx}.");
+	}
+	u64 code = 0;
+	bool empty = true;
+	while(is_hex_digit(peek())) {
+		code = code * 16 + hex_value(peek());
+		if(code > 0x7FFFFFFF) {
+			error("UTF-8 value too large.");
+		}
+		advance();
+		empty = false;
+	}
+	if(empty || !check_next('}')) {
+		error("Invalid \\u{xxxx} escape sequence.");
+	}
+
+	if(code < 0x80) {
+		str.push_back(char(code));
+		return;
+	}
+	char buffer[8] = {};
+	usize n = 0;
+	u64 max_first = 0x3f;
+	do {
+		buffer[7 - n++] = char(0x80 | (code & 0x3f));
+		code >>= 6;
+		max_first >>= 1;
+	} while(code > max_first);
+	buffer[7 - n] = char((~max_first << 1) | code);
+	++n;
+	str.append(buffer + 8 - n, n);
+}
+
+void Lexer::read_escape(std::string& str) {
+	advance(); // backslash
+	char c = peek();
+	switch(c) {
+		case 'a': str.push_back('\a'); advance(); break;
+		case 'b': str.push_back('\b'); advance(); break;
+		case 'f': str.push_back('\f'); advance(); break;
+		case 'n': str.push_back('\n'); advance(); break;
+		case 'r': str.push_back('\r'); advance(); break;
+		case 't': str.push_back('\t'); advance(); break;
+		case 'v': str.push_back('\v'); advance(); break;
+
+		case '\\':
+		case '"':
+		case '\'':
+			str.push_back(c);
+			advance();
+		break;
+
+		case '\n':
+		case '\r':
+			newline();
+			str.push_back('\n');
+		break;
+
+		case 'x': {
+			advance();
+			if(!is_hex_digit(peek()) || !is_hex_digit(peek(1))) {
+				error("Hexadecimal digit expected.");
+			}
+			str.push_back(char(hex_value(peek()) * 16 + hex_value(peek(1))));
+			advance();
+			advance();
+		} break;
+
+		case 'z':
+			advance();
+			while(std::isspace(u8(peek()))) {
+				if(peek() == '\n' || peek() == '\r') {
+					newline();
+				} else {
+					advance();
+				}
+			}
+		break;
+
+		case 'u':
+			utf8_escape(str);
+		break;
+
+		default: {
+			if(!is_digit(c)) {
+				error("Invalid escape sequence.");
+			}
+			u32 value = 0;
+			for(usize i = 0; i != 3 && is_digit(peek()); ++i) {
+				value = value * 10 + u32(peek() - '0');
+				advance();
+			}
+			if(value > 0xFF) {
+				error("Decimal escape too large.");
+			}
+			str.push_back(char(value));
+		}
+	}
+}
+
+void Lexer::read_string(char delimiter, Lexeme& lex) {
+	advance(); // delimiter
+	while(peek() != delimiter) {
+		switch(peek()) {
+			case '\0':
+				if(is_at_end()) {
+					error("Unfinished string.");
+				}
+				lex.string.push_back(peek());
+				advance();
+			break;
+
+			case '\n':
+			case '\r':
+				error("Unfinished string.");
+
+			case '\\':
+				read_escape(lex.string);
+			break;
+
+			default:
+				lex.string.push_back(peek());
+				advance();
+		}
+	}
+	advance(); // delimiter
+	lex.token = Token::String;
+}
+
+void Lexer::read_numeral(Lexeme& lex) {
+	const char* exponent = "Ee";
+	if(peek() == '0' && (peek(1) == 'x' || peek(1) == 'X')) {
+		exponent = "Pp";
+		lex.string.push_back(peek());
+		lex.string.push_back(peek(1));
+		advance();
+		advance();
+	}
+	for(;;) {
+		char c = peek();
+		if(c && (c == exponent[0] || c == exponent[1])) {
+			lex.string.push_back(c);
+			advance();
+			if(peek() == '+' || peek() == '-') {
+				lex.string.push_back(peek());
+				advance();
+			}
+		} else if(is_hex_digit(c) || c == '.') {
+			lex.string.push_back(c);
+			advance();
+		} else {
+			break;
+		}
+	}
+
+	// integers that overflow are read as floats, except for hexadecimal ones which wrap around
+	if(parse_integer(lex.string, lex.integer)) {
+		lex.token = Token::Integer;
+	} else if(parse_float(lex.string, lex.number)) {
+		lex.token = Token::Number;
+	} else {
+		error("Malformed number.");
+	}
+	lex.string.clear();
+}
+
+Lexer::Lexeme Lexer::read() {
+	Lexeme lex;
+	for(;;) {
+		if(is_at_end()) {
+			lex.token = Token::Eos;
+			return lex;
+		}
+
+		char c = peek();
+		switch(c) {
+			case '\n':
+			case '\r':
+				newline();
+			break;
+
+			case ' ':
+			case '\f':
+			case '\t':
+			case '\v':
+				advance();
+			break;
+
+			case '-': {
+				advance();
+				if(peek() != '-') {
+					lex.token = Token::Minus;
+					return lex;
+				}
+				advance();
+				if(peek() == '[') {
+					i32 level = long_string_level();
+					if(level >= 0) {
+						read_long_string(usize(level), nullptr);
+						break;
+					}
+				}
+				while(!is_at_end() && peek() != '\n' && peek() != '\r') {
+					advance();
+				}
+			} break;
+
+			case '[': {
+				i32 level = long_string_level();
+				if(level >= 0) {
+					read_long_string(usize(level), &lex);
+					lex.token = Token::String;
+				} else if(level != -1) {
+					error("Invalid long string delimiter.");
+				} else {
+					lex.token = Token::OpenBracket;
+				}
+				return lex;
+			}
+
+			case '=':
+				advance();
+				lex.token = check_next('=') ? Token::Eq : Token::Assign;
+				return lex;
+
+			case '<':
+				advance();
+				lex.token = check_next('=') ? Token::Le : check_next('<') ? Token::Shl : Token::Lt;
+				return lex;
+
+			case '>':
+				advance();
+				lex.token = check_next('=') ? Token::Ge : check_next('>') ? Token::Shr : Token::Gt;
+				return lex;
+
+			case '/':
+				advance();
+				lex.token = check_next('/') ? Token::Idiv : Token::Slash;
+				return lex;
+
+			case '~':
+				advance();
+				lex.token = check_next('=') ? Token::Ne : Token::Tilde;
+				return lex;
+
+			case ':':
+				advance();
+				lex.token = check_next(':') ? Token::DoubleColon : Token::Colon;
+				return lex;
+
+			case '"':
+			case '\'':
+				read_string(c, lex);
+				return lex;
+
+			case '.':
+				if(peek(1) == '.') {
+					advance();
+					advance();
+					lex.token = check_next('.') ? Token::Dots : Token::Concat;
+					return lex;
+				}
+				if(!is_digit(peek(1))) {
+					advance();
+					lex.token = Token::Dot;
+					return lex;
+				}
+				read_numeral(lex);
+				return lex;
+
+			default:
+				if(is_digit(c)) {
+					read_numeral(lex);
+					return lex;
+				}
+				if(is_alpha(c)) {
+					usize start = _pos;
+					while(is_alnum(peek())) {
+						advance();
+					}
+					std::string_view name = _source.substr(start, _pos - start);
+					for(usize i = 0; i != sizeof(reserved_words) / sizeof(reserved_words[0]); ++i) {
+						if(name == reserved_words[i]) {
+							lex.token = Token(usize(Token::And) + i);
+							return lex;
+						}
+					}
+					lex.token = Token::Name;
+					lex.string = name;
+					return lex;
+				}
+				advance();
+				lex.token = Token(u8(c));
+				return lex;
+		}
+	}
+}
+
+}
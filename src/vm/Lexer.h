@@ -0,0 +1,159 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_LEXER_H
+#define JIT_LEXER_H
+
+#include <utils.h>
+
+#include <string>
+#include <string_view>
+
+namespace jit {
+
+// single char tokens use their character value
+enum class Token : u16 {
+	Hash = '#',
+	Percent = '%',
+	Ampersand = '&',
+	OpenParen = '(',
+	CloseParen = ')',
+	Star = '*',
+	Plus = '+',
+	Comma = ',',
+	Minus = '-',
+	Dot = '.',
+	Slash = '/',
+	Colon = ':',
+	Semicolon = ';',
+	Lt = '<',
+	Assign = '=',
+	Gt = '>',
+	OpenBracket = '[',
+	CloseBracket = ']',
+	Caret = '^',
+	OpenBrace = '{',
+	Pipe = '|',
+	CloseBrace = '}',
+	Tilde = '~',
+
+	And = 257,
+	Break,
+	Do,
+	Else,
+	Elseif,
+	End,
+	False,
+	For,
+	Function,
+	Goto,
+	If,
+	In,
+	Local,
+	Nil,
+	Not,
+	Or,
+	Repeat,
+	Return,
+	Then,
+	True,
+	Until,
+	While,
+
+	Idiv,			// //
+	Concat,			// ..
+	Dots,			// ...
+	Eq,				// ==
+	Ge,				// >=
+	Le,				// <=
+	Ne,				// ~=
+	Shl,			// <<
+	Shr,			// >>
+	DoubleColon,	// ::
+
+	Eos,
+
+	Number,
+	Integer,
+	Name,
+	String
+};
+
+class Lexer {
+	public:
+		struct Lexeme {
+			Token token = Token::Eos;
+			std::string string;
+			union {
+				i64 integer;
+				double number;
+			};
+
+			Lexeme() : integer(0) {
+			}
+		};
+
+		Lexer(std::string_view source);
+
+		void next();
+		Token look_ahead();
+
+		const Lexeme& current() const;
+		Token token() const;
+
+		u32 line() const;
+		// line of the last consumed token
+		u32 last_line() const;
+
+	private:
+		Lexeme read();
+
+		char peek(usize offset = 0) const;
+		bool is_at_end() const;
+		void advance();
+		void newline();
+
+		bool check_next(char c);
+
+		void read_numeral(Lexeme& lex);
+		void read_string(char delimiter, Lexeme& lex);
+		void read_long_string(usize level, Lexeme* lex);
+		i32 long_string_level();
+
+		void read_escape(std::string& str);
+		void utf8_escape(std::string& str);
+
+		[[noreturn]] void error(const char* msg) const;
+
+		std::string_view _source;
+		usize _pos = 0;
+
+		u32 _line = 1;
+		u32 _last_line = 1;
+
+		Lexeme _current;
+		Lexeme _ahead;
+		bool _has_ahead = false;
+};
+
+}
+
+#endif // JIT_LEXER_H
@@ -0,0 +1,91 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "MappedFile.h"
+
+#ifdef __WIN32
+#define WIN32_MAPPED_FILE
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace jit {
+
+MappedFile::MappedFile(const char* filename) {
+#ifdef WIN32_MAPPED_FILE
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE) {
+		fatal("Bytecode file not found.");
+	}
+	SCOPE_EXIT(CloseHandle(file))
+
+	LARGE_INTEGER size = {};
+	if(!GetFileSizeEx(file, &size) || !size.QuadPart) {
+		fatal("Unable to read bytecode file.");
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(!mapping) {
+		fatal("Unable to map bytecode file.");
+	}
+	SCOPE_EXIT(CloseHandle(mapping))
+
+	_data = static_cast<const u8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	_size = usize(size.QuadPart);
+#else
+	int file = open(filename, O_RDONLY);
+	if(file < 0) {
+		fatal("Bytecode file not found.");
+	}
+	SCOPE_EXIT(close(file))
+
+	struct stat st = {};
+	if(fstat(file, &st) || !st.st_size) {
+		fatal("Unable to read bytecode file.");
+	}
+
+	void* data = mmap(nullptr, usize(st.st_size), PROT_READ, MAP_SHARED, file, 0);
+	_data = data == MAP_FAILED ? nullptr : static_cast<const u8*>(data);
+	_size = usize(st.st_size);
+#endif
+	if(!_data) {
+		fatal("Unable to map bytecode file.");
+	}
+}
+
+MappedFile::~MappedFile() {
+#ifdef WIN32_MAPPED_FILE
+	UnmapViewOfFile(_data);
+#else
+	munmap(const_cast<u8*>(_data), _size);
+#endif
+}
+
+ArrayView<u8> MappedFile::data() const {
+	return ArrayView<u8>(_data, _size);
+}
+
+}
@@ -0,0 +1,391 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "Optimizer.h"
+#include "arithmetic.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace jit {
+
+static constexpr u32 max_bx = (1 << 18) - 1;
+
+static OpCode op(Instruction i) {
+	return OpCode(i.opcode);
+}
+
+static bool is_constant(u32 rk) {
+	return rk & Instruction::max_k;
+}
+
+static void set_bx(Instruction& i, u32 bx) {
+	i.B = bx >> 9;
+	i.C = bx & 0x1FF;
+}
+
+// Instruction::sBx is offset by one, this is the actual distance from the next instruction
+static i32 jump_offset(Instruction i) {
+	return i.sBx() + 1;
+}
+
+static void set_jump_offset(Instruction& i, i32 offset) {
+	set_bx(i, u32(offset - 1 + Instruction::max_bx));
+}
+
+static bool is_jump(Instruction i) {
+	switch(op(i)) {
+		case OpCode::Jmp:
+		case OpCode::Forloop:
+		case OpCode::Forloopup:
+		case OpCode::Forloopdown:
+		case OpCode::Forprep:
+		case OpCode::Tforloop:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// instructions that can skip the next one, which must then stay in place
+static bool can_skip_next(Instruction i) {
+	switch(op(i)) {
+		case OpCode::Eq:
+		case OpCode::Lt:
+		case OpCode::Le:
+		case OpCode::Test:
+		case OpCode::Testset:
+			return true;
+		case OpCode::Loadbool:
+			return i.C;
+		default:
+			return false;
+	}
+}
+
+static bool reads_rk(u32 rk, u32 reg) {
+	return !is_constant(rk) && rk == reg;
+}
+
+// returns true if the instruction always writes R(A) and nothing else, without reading reg first
+static bool overwrites(Instruction i, u32 reg) {
+	if(i.A != reg) {
+		return false;
+	}
+	switch(op(i)) {
+		case OpCode::Loadk:
+		case OpCode::Getupval:
+		case OpCode::Newtable:
+		case OpCode::Closure:
+			return true;
+
+		case OpCode::Loadbool:
+			return !i.C;
+
+		case OpCode::Move:
+		case OpCode::Unm:
+		case OpCode::Not:
+		case OpCode::Len:
+			return i.B != reg;
+
+		case OpCode::Gettabup:
+			return !reads_rk(i.C, reg);
+
+		case OpCode::Gettable:
+			return i.B != reg && !reads_rk(i.C, reg);
+
+		case OpCode::Add:
+		case OpCode::Sub:
+		case OpCode::Mul:
+		case OpCode::Mod:
+		case OpCode::Pow:
+		case OpCode::Div:
+			return !reads_rk(i.B, reg) && !reads_rk(i.C, reg);
+
+		default:
+			return false;
+	}
+}
+
+static bool is_number(const Constant& cst) {
+	return cst.type == ConstantType::Number || cst.type == ConstantType::Integer;
+}
+
+static double to_number(const Constant& cst) {
+	return cst.type == ConstantType::Integer ? double(cst.integer) : cst.number;
+}
+
+// Same arithmetic as the VM
+static bool fold(Instruction& i, std::vector<Constant>& constants) {
+	if(!is_constant(i.B) || !is_constant(i.C)) {
+		return false;
+	}
+	const Constant& b = constants[i.B & Instruction::r_mask];
+	const Constant& c = constants[i.C & Instruction::r_mask];
+	if(!is_number(b) || !is_number(c)) {
+		return false;
+	}
+
+	Constant result;
+	if(b.type == ConstantType::Integer && c.type == ConstantType::Integer && op(i) != OpCode::Pow && op(i) != OpCode::Div) {
+		i64 x = b.integer;
+		i64 y = c.integer;
+		result.type = ConstantType::Integer;
+		switch(op(i)) {
+			case OpCode::Add: result.integer = int_add(x, y); break;
+			case OpCode::Sub: result.integer = int_sub(x, y); break;
+			case OpCode::Mul: result.integer = int_mul(x, y); break;
+			case OpCode::Mod:
+				// the error is raised at runtime
+				if(!y) {
+					return false;
+				}
+				result.integer = int_mod(x, y);
+			break;
+			default:
+				return false;
+		}
+	} else {
+		double x = to_number(b);
+		double y = to_number(c);
+		result.type = ConstantType::Number;
+		switch(op(i)) {
+			case OpCode::Add: result.number = x + y; break;
+			case OpCode::Sub: result.number = x - y; break;
+			case OpCode::Mul: result.number = x * y; break;
+			case OpCode::Mod: result.number = float_mod(x, y); break;
+			case OpCode::Pow: result.number = std::pow(x, y); break;
+			case OpCode::Div: result.number = x / y; break;
+			default:
+				return false;
+		}
+	}
+
+	u32 index = u32(constants.size());
+	if(index > max_bx) {
+		return false;
+	}
+	constants.push_back(result);
+
+	i.opcode = u32(OpCode::Loadk);
+	set_bx(i, index);
+	return true;
+}
+
+static usize jump_target(const std::vector<Instruction>& code, usize pc) {
+	return usize(i32(pc) + 1 + jump_offset(code[pc]));
+}
+
+// Forprep is always right after the step is loaded, a constant step lets the loop skip the direction test
+static void specialize_loop(std::vector<Instruction>& code, const std::vector<Constant>& constants, usize pc) {
+	const Instruction& prep = code[pc];
+	if(!pc || op(code[pc - 1]) != OpCode::Loadk || code[pc - 1].A != prep.A + 2u) {
+		return;
+	}
+	const Constant& step = constants[code[pc - 1].Bx()];
+	if(!is_number(step)) {
+		return;
+	}
+	usize loop = jump_target(code, pc);
+	if(loop >= code.size() || op(code[loop]) != OpCode::Forloop || code[loop].A != prep.A) {
+		return;
+	}
+	double value = to_number(step);
+	if(value > 0.0) {
+		code[loop].opcode = u32(OpCode::Forloopup);
+	} else if(value < 0.0) {
+		code[loop].opcode = u32(OpCode::Forloopdown);
+	}
+}
+
+// follows chains of unconditional jumps, Jmp with A != 0 also close upvalues and are left alone
+static usize final_target(const std::vector<Instruction>& code, usize target) {
+	for(usize hops = 0; hops != code.size(); ++hops) {
+		if(target >= code.size() || op(code[target]) != OpCode::Jmp || code[target].A) {
+			break;
+		}
+		usize next = jump_target(code, target);
+		if(next == target) {
+			break;
+		}
+		target = next;
+	}
+	return target;
+}
+
+// pairs that show up the most in hot loops, Jmp that close upvalues are not supported by the VM
+static OpCode superinstruction(Instruction i, Instruction next) {
+	switch(op(i)) {
+		case OpCode::Eq:
+			return op(next) == OpCode::Jmp && !next.A ? OpCode::Eqjmp : op(i);
+		case OpCode::Lt:
+			return op(next) == OpCode::Jmp && !next.A ? OpCode::Ltjmp : op(i);
+		case OpCode::Le:
+			return op(next) == OpCode::Jmp && !next.A ? OpCode::Lejmp : op(i);
+		case OpCode::Test:
+			return op(next) == OpCode::Jmp && !next.A ? OpCode::Testjmp : op(i);
+		case OpCode::Gettable:
+			return op(next) == OpCode::Gettable ? OpCode::Gettablegettable : op(i);
+		case OpCode::Mul:
+			return op(next) == OpCode::Add ? OpCode::Muladd : op(i);
+		case OpCode::Sub:
+			return op(next) == OpCode::Mul ? OpCode::Submul : op(i);
+		case OpCode::Add:
+			return op(next) == OpCode::Settable ? OpCode::Addsettable : op(i);
+		default:
+			return op(i);
+	}
+}
+
+// The second instruction of a pair stays in place, so jumps to it are still valid
+static void fuse(std::vector<Instruction>& code) {
+	for(usize pc = 0; pc + 1 < code.size(); ++pc) {
+		OpCode fused = superinstruction(code[pc], code[pc + 1]);
+		if(fused != op(code[pc])) {
+			code[pc].opcode = u32(fused);
+			++pc;
+		}
+	}
+}
+
+void optimize_bytecode(Function& func) {
+	std::vector<Instruction> code(func.instructions.begin(), func.instructions.end());
+	std::vector<u32> lines(func.lines.begin(), func.lines.end());
+	lines.resize(code.size());
+
+	const usize size = code.size();
+	std::vector<bool> is_target(size + 1, false);
+	std::vector<bool> removed(size, false);
+
+	for(usize pc = 0; pc != size; ++pc) {
+		if(is_jump(code[pc])) {
+			usize target = jump_target(code, pc);
+			if(target <= size) {
+				is_target[target] = true;
+			}
+		}
+		if(can_skip_next(code[pc]) && pc + 2 <= size) {
+			is_target[pc + 2] = true;
+		}
+	}
+
+	for(usize pc = 0; pc != size; ++pc) {
+		Instruction& i = code[pc];
+		bool removable = !pc || !can_skip_next(code[pc - 1]);
+
+		switch(op(i)) {
+			case OpCode::Add:
+			case OpCode::Sub:
+			case OpCode::Mul:
+			case OpCode::Mod:
+			case OpCode::Pow:
+			case OpCode::Div:
+				fold(i, func.constants);
+			break;
+
+			case OpCode::Forprep:
+				if(!is_target[pc]) {
+					specialize_loop(code, func.constants, pc);
+				}
+			break;
+
+			case OpCode::Move:
+				if(removable && (i.A == i.B || (pc + 1 < size && overwrites(code[pc + 1], i.A)))) {
+					removed[pc] = true;
+				}
+			break;
+
+			case OpCode::Loadnil: {
+				// merge with the next Loadnil if the ranges touch and nothing jumps in between
+				usize next = pc + 1;
+				while(next < size && op(code[next]) == OpCode::Loadnil && !is_target[next]) {
+					u32 first = i.A;
+					u32 last = i.A + i.B;
+					u32 next_first = code[next].A;
+					u32 next_last = next_first + code[next].B;
+					if(next_first > last + 1 || first > next_last + 1) {
+						break;
+					}
+					i.A = std::min(first, next_first);
+					i.B = std::max(last, next_last) - i.A;
+					removed[next++] = true;
+				}
+				pc = next - 1;
+			} break;
+
+			default:
+			break;
+		}
+	}
+
+	// thread jumps, this needs to see the final opcodes
+	for(usize pc = 0; pc != size; ++pc) {
+		if(!removed[pc] && is_jump(code[pc])) {
+			usize target = final_target(code, jump_target(code, pc));
+			set_jump_offset(code[pc], i32(target) - i32(pc) - 1);
+		}
+	}
+
+	// jumps over removed instructions only do nothing, going backward catches chains of them
+	for(usize pc = size; pc--;) {
+		const Instruction& i = code[pc];
+		if(op(i) != OpCode::Jmp || i.A || jump_offset(i) < 0 || (pc && can_skip_next(code[pc - 1]))) {
+			continue;
+		}
+		usize target = jump_target(code, pc);
+		if(std::all_of(removed.begin() + i32(pc) + 1, removed.begin() + i32(target), [](bool r) { return r; })) {
+			removed[pc] = true;
+		}
+	}
+
+	// compact, removed instructions are replaced by whatever follows them
+	std::vector<u32> new_pc(size + 1, 0);
+	u32 count = 0;
+	for(usize pc = 0; pc != size; ++pc) {
+		new_pc[pc] = count;
+		count += !removed[pc];
+	}
+	new_pc[size] = count;
+
+	func.instruction_buffer.clear();
+	func.line_buffer.clear();
+	for(usize pc = 0; pc != size; ++pc) {
+		if(removed[pc]) {
+			continue;
+		}
+		Instruction i = code[pc];
+		if(is_jump(i)) {
+			usize target = jump_target(code, pc);
+			set_jump_offset(i, i32(new_pc[std::min(target, size)]) - i32(new_pc[pc]) - 1);
+		}
+		func.instruction_buffer.push_back(i);
+		func.line_buffer.push_back(lines[pc]);
+	}
+	fuse(func.instruction_buffer);
+
+	func.instructions = ArrayView<Instruction>(func.instruction_buffer.data(), func.instruction_buffer.size());
+	if(!func.lines.is_empty()) {
+		func.lines = ArrayView<u32>(func.line_buffer.data(), func.line_buffer.size());
+	}
+}
+
+}
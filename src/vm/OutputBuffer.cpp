@@ -0,0 +1,110 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "OutputBuffer.h"
+#include "number.h"
+
+#include <algorithm>
+
+namespace jit {
+
+// enough for any number or pointer
+static constexpr usize min_capacity = 64;
+
+OutputBuffer::OutputBuffer(std::FILE* file, usize capacity) : _file(file) {
+	set_capacity(capacity);
+}
+
+OutputBuffer::~OutputBuffer() {
+	flush();
+}
+
+void OutputBuffer::set_capacity(usize capacity) {
+	flush();
+	_capacity = std::max(capacity, min_capacity);
+	_buffer = std::make_unique<char[]>(_capacity);
+}
+
+char* OutputBuffer::reserve(usize size) {
+	if(_capacity - _size < size) {
+		flush();
+	}
+	return _buffer.get() + _size;
+}
+
+void OutputBuffer::write(std::string_view str) {
+	if(_capacity - _size < str.size()) {
+		flush();
+		// too big to be worth copying
+		if(str.size() >= _capacity) {
+			std::fwrite(str.data(), 1, str.size(), _file);
+			return;
+		}
+	}
+	std::copy_n(str.data(), str.size(), _buffer.get() + _size);
+	_size += str.size();
+}
+
+void OutputBuffer::write(char c) {
+	if(_size == _capacity) {
+		flush();
+	}
+	_buffer[_size++] = c;
+}
+
+void OutputBuffer::write(const Value& value) {
+	switch(value.type) {
+		case ValueType::None:
+			write(std::string_view("nil"));
+		break;
+
+		case ValueType::Bool:
+			write(std::string_view(value.integer ? "true" : "false"));
+		break;
+
+		case ValueType::Number:
+			_size += number_to_string(value, reserve(max_number_size));
+		break;
+
+		case ValueType::String:
+			write(value.string().view());
+		break;
+
+		default:
+			_size += usize(std::snprintf(reserve(min_capacity), min_capacity, "%s: %p", value.type_str(), value.ptr));
+	}
+}
+
+void OutputBuffer::write_number(const Value& number) {
+	char* out = reserve(max_number_size);
+	_size += number.subtype == NumberType::Integer ? format_integer(number.integer, out) : format_float(number.number, out);
+}
+
+void OutputBuffer::flush() {
+	if(_size) {
+		std::fwrite(_buffer.get(), 1, _size, _file);
+		_size = 0;
+	}
+	std::fflush(_file);
+}
+
+}
@@ -0,0 +1,70 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_OUTPUTBUFFER_H
+#define JIT_OUTPUTBUFFER_H
+
+#include "Value.h"
+
+#include <cstdio>
+#include <memory>
+
+namespace jit {
+
+// Buffered writes to a FILE, flushed when full, by flush() and on destruction.
+// Numbers are formatted in place, so most writes never call into the C library.
+class OutputBuffer {
+	public:
+		static constexpr usize default_capacity = 64 * 1024;
+
+		OutputBuffer(const OutputBuffer&) = delete;
+		OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+		OutputBuffer(std::FILE* file, usize capacity = default_capacity);
+		~OutputBuffer();
+
+		// flushes what has been written so far
+		void set_capacity(usize capacity);
+
+		void write(std::string_view str);
+		void write(char c);
+
+		// same text as tostring
+		void write(const Value& value);
+
+		// same text as io.write, floats don't get a ".0"
+		void write_number(const Value& number);
+
+		void flush();
+
+	private:
+		// returns space for at least size chars, the caller then adds what it used to _size
+		char* reserve(usize size);
+
+		std::FILE* _file = nullptr;
+		std::unique_ptr<char[]> _buffer;
+		usize _size = 0;
+		usize _capacity = 0;
+};
+
+}
+
+#endif // JIT_OUTPUTBUFFER_H
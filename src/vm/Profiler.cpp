@@ -0,0 +1,181 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#include "Profiler.h"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+namespace jit {
+
+// sorts by decreasing count, then by name so that reports are stable
+template<typename T>
+static std::vector<std::pair<T, u64>> sorted_counts(const std::map<T, u64>& counts) {
+	std::vector<std::pair<T, u64>> sorted(counts.begin(), counts.end());
+	std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+	return sorted;
+}
+
+template<typename T>
+static void add_once(std::vector<T>& seen, const T& t, std::map<T, u64>& counts, u64 count) {
+	if(std::find(seen.begin(), seen.end(), t) == seen.end()) {
+		seen.push_back(t);
+		counts[t] += count;
+	}
+}
+
+static double percent(u64 count, u64 total) {
+	return total ? 100.0 * double(count) / double(total) : 0.0;
+}
+
+
+u32 Profiler::Location::line() const {
+	return pc < function->lines.size() ? function->lines[pc] : 0;
+}
+
+bool Profiler::Location::operator<(const Location& other) const {
+	return function != other.function ? function < other.function : pc < other.pc;
+}
+
+Profiler::Profiler(u32 interval) : _interval(std::max(interval, 2u)), _rng(0x9e3779b97f4a7c15) {
+}
+
+// xorshift64*
+u32 Profiler::next_interval() {
+	_rng ^= _rng >> 12;
+	_rng ^= _rng << 25;
+	_rng ^= _rng >> 27;
+	u64 r = (_rng * 0x2545f4914f6cdd1d) >> 32;
+	return _interval / 2 + u32(r % _interval) + 1;
+}
+
+void Profiler::add_sample(Span<Location> stack) {
+	if(stack.is_empty()) {
+		return;
+	}
+	++_samples;
+	++_stacks[std::vector<Location>(stack.begin(), stack.end())];
+}
+
+u64 Profiler::sample_count() const {
+	return _samples;
+}
+
+void Profiler::write_flat(std::FILE* file) const {
+	using Line = std::pair<std::string, u32>;
+	std::map<Line, u64> line_self;
+	std::map<Line, u64> line_total;
+	std::map<std::string, u64> func_self;
+	std::map<std::string, u64> func_total;
+
+	for(const auto& [stack, count] : _stacks) {
+		const Location& leaf = stack.back();
+		line_self[Line(source_name(*leaf.function), leaf.line())] += count;
+		func_self[function_name(*leaf.function)] += count;
+
+		// recursive frames are only counted once per sample
+		std::vector<Line> lines;
+		std::vector<std::string> funcs;
+		for(const Location& loc : stack) {
+			add_once(lines, Line(source_name(*loc.function), loc.line()), line_total, count);
+			add_once(funcs, function_name(*loc.function), func_total, count);
+		}
+	}
+
+	std::fprintf(file, "Flat profile: %llu samples\n\n", static_cast<unsigned long long>(_samples));
+	std::fprintf(file, "  self%%      self     total  line\n");
+	for(const auto& [line, total] : sorted_counts(line_total)) {
+		u64 self = line_self[line];
+		std::fprintf(file, "%6.2f%% %9llu %9llu  %s:%u\n", percent(self, _samples), static_cast<unsigned long long>(self),
+			static_cast<unsigned long long>(total), line.first.c_str(), line.second);
+	}
+
+	std::fprintf(file, "\n  self%%      self     total  function\n");
+	for(const auto& [func, total] : sorted_counts(func_total)) {
+		u64 self = func_self[func];
+		std::fprintf(file, "%6.2f%% %9llu %9llu  %s\n", percent(self, _samples), static_cast<unsigned long long>(self),
+			static_cast<unsigned long long>(total), func.c_str());
+	}
+}
+
+void Profiler::write_call_graph(std::FILE* file) const {
+	// caller, call site and callee
+	using Edge = std::tuple<std::string, u32, std::string>;
+	std::map<std::string, u64> func_self;
+	std::map<std::string, u64> func_total;
+	std::map<Edge, u64> edges;
+
+	for(const auto& [stack, count] : _stacks) {
+		func_self[function_name(*stack.back().function)] += count;
+
+		std::vector<std::string> funcs;
+		std::vector<Edge> calls;
+		for(usize i = 0; i != stack.size(); ++i) {
+			add_once(funcs, function_name(*stack[i].function), func_total, count);
+			if(i + 1 != stack.size()) {
+				add_once(calls, Edge(function_name(*stack[i].function), stack[i].line(), function_name(*stack[i + 1].function)), edges, count);
+			}
+		}
+	}
+
+	const auto sorted_edges = sorted_counts(edges);
+	std::fprintf(file, "Call graph: %llu samples\n", static_cast<unsigned long long>(_samples));
+	for(const auto& [func, total] : sorted_counts(func_total)) {
+		std::fprintf(file, "\n%s\n", func.c_str());
+		std::fprintf(file, "    total %llu (%.2f%%), self %llu (%.2f%%)\n",
+			static_cast<unsigned long long>(total), percent(total, _samples),
+			static_cast<unsigned long long>(func_self[func]), percent(func_self[func], _samples));
+
+		for(const auto& [edge, count] : sorted_edges) {
+			if(std::get<2>(edge) == func) {
+				std::fprintf(file, "    %9llu  called from %s line %u\n", static_cast<unsigned long long>(count), std::get<0>(edge).c_str(), std::get<1>(edge));
+			}
+		}
+		for(const auto& [edge, count] : sorted_edges) {
+			if(std::get<0>(edge) == func) {
+				std::fprintf(file, "    %9llu  calls %s at line %u\n", static_cast<unsigned long long>(count), std::get<2>(edge).c_str(), std::get<1>(edge));
+			}
+		}
+	}
+}
+
+void Profiler::write_collapsed(std::FILE* file) const {
+	std::map<std::string, u64> stacks;
+	for(const auto& [stack, count] : _stacks) {
+		std::string name;
+		for(const Location& loc : stack) {
+			if(!name.empty()) {
+				name += ';';
+			}
+			name += function_name(*loc.function);
+		}
+		stacks[name] += count;
+	}
+
+	for(const auto& [name, count] : stacks) {
+		std::fprintf(file, "%s %llu\n", name.c_str(), static_cast<unsigned long long>(count));
+	}
+}
+
+}
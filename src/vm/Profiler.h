@@ -0,0 +1,76 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_PROFILER_H
+#define JIT_PROFILER_H
+
+#include "bytecode.h"
+
+#include <cstdio>
+#include <map>
+#include <vector>
+
+namespace jit {
+
+// Sampling profiler for Lua code.
+// The VM records its call stack once every few thousand instructions, so time spent in native functions isn't sampled.
+class Profiler {
+	public:
+		struct Location {
+			const Function* function = nullptr;
+			u32 pc = 0;
+
+			u32 line() const;
+
+			bool operator<(const Location& other) const;
+		};
+
+		// interval is the average number of instructions between two samples
+		Profiler(u32 interval = 9973);
+
+		// The interval is randomized so that samples don't alias with loops
+		u32 next_interval();
+
+		// stack goes from the outermost frame to the running one, the pc of a caller is the one of its call instruction
+		void add_sample(Span<Location> stack);
+
+		u64 sample_count() const;
+
+		// Samples per source line and per function
+		void write_flat(std::FILE* file) const;
+
+		// Callers and callees of every function
+		void write_call_graph(std::FILE* file) const;
+
+		// One line per distinct stack, as read by flamegraph.pl
+		void write_collapsed(std::FILE* file) const;
+
+	private:
+		std::map<std::vector<Location>, u64> _stacks;
+		u64 _samples = 0;
+
+		u32 _interval = 0;
+		u64 _rng = 0;
+};
+
+}
+
+#endif // JIT_PROFILER_H
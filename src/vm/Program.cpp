@@ -23,6 +23,8 @@ SOFTWARE.
 #include "Program.h"
 
 #include "Value.h"
+#include "Compiler.h"
+#include "Optimizer.h"
 
 namespace jit {
 
@@ -47,13 +49,70 @@ static std::string_view parse_string(const u8* data, usize& len) {
 	return str;
 }
 
-static Function parse_func(const u8* data, usize& len) {
+// Walks over a function without decoding anything
+static void skip_func(const u8* data, usize& len) {
+	parse_string(data, len);
+	len += 2 * sizeof(u32) + 3 * sizeof(u8); // lines, params, varargs and regs
+
+	u32 code_size = READ(u32);
+	len += code_size * sizeof(Instruction);
+
+	u32 constants = READ(u32);
+	for(u32 i = 0; i != constants; ++i) {
+		switch(ConstantType(READ(u8))) {
+			case ConstantType::None:
+			break;
+
+			case ConstantType::String:
+			case ConstantType::LongString:
+				parse_string(data, len);
+			break;
+
+			case ConstantType::Integer:
+				len += sizeof(Integer);
+			break;
+
+			case ConstantType::Number:
+				len += sizeof(Number);
+			break;
+
+			default:
+				fatal("Unsupported constant type.");
+		}
+	}
+
+	u32 upvalues = READ(u32);
+	len += upvalues * sizeof(UpValue);
+
+	u32 prototypes = READ(u32);
+	for(u32 i = 0; i != prototypes; ++i) {
+		skip_func(data, len);
+	}
+
+	u32 line_nums = READ(u32);
+	len += line_nums * sizeof(u32);
+
+	u32 local_names = READ(u32);
+	for(u32 i = 0; i != local_names; ++i) {
+		parse_string(data, len);
+		len += 2 * sizeof(u32);
+	}
+
+	u32 upvalue_names = READ(u32);
+	for(u32 i = 0; i != upvalue_names; ++i) {
+		parse_string(data, len);
+	}
+}
+
+// only the main function stores its source name, prototypes inherit it
+static Function parse_func(const u8* data, usize& len, bool optimize, std::string_view parent_src) {
 	Function func;
 	func.info = parse_string(data, len);
+	func.src = func.info.empty() ? parent_src : func.info;
 
-	u32 start_line = READ(u32);
+	func.line = READ(u32);
 	u32 end_line = READ(u32);
-	unused(start_line, end_line);
+	unused(end_line);
 
 	func.params = READ(u8);
 	func.varargs = READ(u8);
@@ -93,10 +152,14 @@ static Function parse_func(const u8* data, usize& len) {
 	func.upvalues = ArrayView<UpValue>(reinterpret_cast<const UpValue*>(data + len), upvalues);
 	len += upvalues * sizeof(UpValue);
 
+	// prototypes are only parsed once a closure is created
 	u32 prototypes = READ(u32);
-	func.functions.reserve(prototypes);
-	for(u32 i = 0; i != prototypes; ++i) {
-		func.functions.emplace_back(parse_func(data, len));
+	func.functions.resize(prototypes);
+	for(Function& proto : func.functions) {
+		proto.lazy_data = data + len;
+		proto.optimize = optimize;
+		proto.src = func.src;
+		skip_func(data, len);
 	}
 
 	// debug
@@ -119,6 +182,10 @@ static Function parse_func(const u8* data, usize& len) {
 		}
 	}
 
+	if(optimize) {
+		optimize_bytecode(func);
+	}
+
 	return func;
 }
 
@@ -157,11 +224,11 @@ static void print_function(const Function& func) {
 	printf("\n");
 
 	for(const auto& f : func.functions) {
-		print_function(f);
+		print_function(Program::load(f));
 	}
 }
 
-Program Program::from_luac(ArrayView<u8> luac_data) {
+Program Program::from_luac(ArrayView<u8> luac_data, bool optimize) {
 	usize len = 0;
 	const u8* data = luac_data.data();
 
@@ -199,7 +266,7 @@ Program Program::from_luac(ArrayView<u8> luac_data) {
 
 	Program program;
 	while(len < luac_data.size()) {
-		program.functions.emplace_back(parse_func(data, len));
+		program.functions.emplace_back(parse_func(data, len, optimize, std::string_view()));
 	}
 
 	/*for(const auto& f : program.functions) {
@@ -209,4 +276,44 @@ Program Program::from_luac(ArrayView<u8> luac_data) {
 	return program;
 }
 
+const Function& Program::load(const Function& func) {
+	if(func.lazy_data) {
+		usize len = 0;
+		// prototypes are always stored in their parent's non const function vector
+		const_cast<Function&>(func) = parse_func(func.lazy_data, len, func.optimize, func.src);
+	}
+	return func;
+}
+
+Program Program::from_luac_file(const char* filename, bool optimize) {
+	auto mapping = std::make_unique<MappedFile>(filename);
+	Program program = from_luac(mapping->data(), optimize);
+	program.mapping = std::move(mapping);
+	return program;
+}
+
+Program Program::from_source(std::string_view source, std::string_view chunk_name, const CodeCache* cache, bool optimize) {
+	std::vector<u8> bytecode;
+	if(cache) {
+		u64 key = CodeCache::hash(source, CodeCache::hash(chunk_name, CodeCache::format_version));
+		if(!cache->find(key, bytecode)) {
+			bytecode = compile_lua(source, chunk_name);
+			cache->store(key, ArrayView<u8>(bytecode.data(), bytecode.size()));
+		}
+	} else {
+		bytecode = compile_lua(source, chunk_name);
+	}
+	// moving the vector keeps its buffer, so the lazily parsed functions stay valid
+	Program program = from_luac(ArrayView<u8>(bytecode.data(), bytecode.size()), optimize);
+	program.bytecode = std::move(bytecode);
+	return program;
+}
+
+Program Program::from_source_file(const char* filename, const CodeCache* cache, bool optimize) {
+	MappedFile file(filename);
+	ArrayView<u8> data = file.data();
+	std::string name = std::string("@") + filename;
+	return from_source(std::string_view(reinterpret_cast<const char*>(data.data()), data.size()), name, cache, optimize);
+}
+
 }
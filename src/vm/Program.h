@@ -23,16 +23,33 @@ SOFTWARE.
 #define JIT_PROGRAM_H
 
 #include "bytecode.h"
+#include "MappedFile.h"
+#include "CodeCache.h"
 
 #include <vector>
+#include <memory>
 
 namespace jit {
 
 
 struct Program {
-	static Program from_luac(ArrayView<u8> luac_data);
+	// If optimize is set, every function goes through optimize_bytecode when it is parsed
+	static Program from_luac(ArrayView<u8> luac_data, bool optimize = false);
+
+	// Functions are parsed in place, the mapping is kept alive by the program
+	static Program from_luac_file(const char* filename, bool optimize = false);
+
+	// Compiles Lua source, the resulting bytecode is owned by the program
+	// If a cache is given, bytecode is reused across runs for identical sources
+	static Program from_source(std::string_view source, std::string_view chunk_name = "=?", const CodeCache* cache = nullptr, bool optimize = false);
+	static Program from_source_file(const char* filename, const CodeCache* cache = nullptr, bool optimize = false);
+
+	// Parses the function if needed
+	static const Function& load(const Function& func);
 
 	std::vector<Function> functions;
+	std::unique_ptr<MappedFile> mapping;
+	std::vector<u8> bytecode;
 };
 
 }
@@ -0,0 +1,51 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "String.h"
+
+#include <algorithm>
+#include <functional>
+#include <new>
+
+namespace jit {
+
+String* String::allocate(usize size) {
+	// _data already holds the NUL
+	void* memory = ::operator new(sizeof(String) + size);
+	String* str = new(memory) String(size);
+	str->_data[size] = 0;
+	return str;
+}
+
+String* String::create(std::string_view str) {
+	return build(str.size(), [&](char* data) { std::copy_n(str.data(), str.size(), data); });
+}
+
+u64 String::hash() const {
+	if(!_hashed) {
+		_hash = std::hash<std::string_view>()(view());
+		_hashed = true;
+	}
+	return _hash;
+}
+
+}
@@ -0,0 +1,74 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_STRING_H
+#define JIT_STRING_H
+
+#include <utils.h>
+
+#include <string_view>
+
+namespace jit {
+
+// Immutable string, the size, the hash and the characters share a single allocation.
+// Characters are followed by a NUL for C APIs but may contain NULs themselves.
+class String {
+	public:
+		static String* create(std::string_view str);
+
+		// fill gets the size characters to write, the string can't be changed after that
+		template<typename F>
+		static String* build(usize size, F&& fill) {
+			String* str = allocate(size);
+			fill(str->_data);
+			return str;
+		}
+
+		usize size() const {
+			return _size;
+		}
+
+		const char* data() const {
+			return _data;
+		}
+
+		std::string_view view() const {
+			return std::string_view(_data, _size);
+		}
+
+		// computed on first use, most strings are never hashed
+		u64 hash() const;
+
+	private:
+		String(usize size) : _size(size) {
+		}
+
+		static String* allocate(usize size);
+
+		const usize _size;
+		mutable u64 _hash = 0;
+		mutable bool _hashed = false;
+		char _data[1];
+};
+
+}
+
+#endif // JIT_STRING_H
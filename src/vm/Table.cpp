@@ -22,6 +22,7 @@ SOFTWARE.
 
 #include "Table.h"
 #include "library.h"
+#include "exceptions.h"
 
 #include <algorithm>
 
@@ -30,14 +31,64 @@ namespace jit {
 
 Table::value_hash::result_type Table::value_hash::operator()(const argument_type& v) const noexcept {
 	if(v.type == ValueType::String) {
-		std::string_view str = v.string();
-		return std::hash<std::string_view>()(str);
+		return v.string().hash();
 	}
 	return v.integer;
 }
 
+Value Table::normalize_key(const Value& key) {
+	if(key.type == ValueType::Number && key.subtype == NumberType::Float) {
+		i64 i = 0;
+		if(key.to_integer(i)) {
+			return Value::from_integer(i);
+		}
+	}
+	return key;
+}
+
+// index in the array part for keys from 1 to size + 1, 0 for anything else
+static usize array_index(const Value& key, usize size) {
+	if(key.type != ValueType::Number) {
+		return 0;
+	}
+	i64 i = key.integer;
+	if(key.subtype == NumberType::Float && !key.to_integer(i)) {
+		return 0;
+	}
+	return i > 0 && u64(i) <= size + 1 ? usize(i) : 0;
+}
+
 usize Table::size() const {
-	return _storage.size();
+	return _array.size();
+}
+
+void Table::grow_array() {
+	while(!_storage.empty()) {
+		auto it = _storage.find(Value::from_integer(i64(_array.size()) + 1));
+		if(it == _storage.end()) {
+			break;
+		}
+		if(it->second.type == ValueType::None) {
+			_storage.erase(it);
+			--_cleared;
+			break;
+		}
+		_array.push_back(it->second);
+		_storage.erase(it);
+	}
+}
+
+void Table::trim_array() {
+	while(!_array.empty() && _array.back().type == ValueType::None) {
+		_array.pop_back();
+	}
+}
+
+void Table::purge_cleared() {
+	for(auto it = _storage.begin(); it != _storage.end();) {
+		it = it->second.type == ValueType::None ? _storage.erase(it) : std::next(it);
+	}
+	_cleared = 0;
 }
 
 void Table::set(const Constant& cst, const Value& value) {
@@ -45,19 +96,39 @@ void Table::set(const Constant& cst, const Value& value) {
 }
 
 void Table::set(const Value& key, const Value& value) {
-	auto it = find(key);
-	if(value.type == ValueType::None) {
-		if(it != end()) {
-			_storage.erase(it);
+	if(usize index = array_index(key, _array.size())) {
+		if(index <= _array.size()) {
+			_array[index - 1] = value;
+			if(index == _array.size()) {
+				trim_array();
+			}
+		} else if(value.type != ValueType::None) {
+			_array.push_back(value);
+			grow_array();
 		}
 		return;
 	}
 
-	if(it == end()) {
-		_storage[key] = value;
-	} else {
+	auto it = _storage.find(normalize_key(key));
+	if(it != _storage.end()) {
+		if(it->second.type == ValueType::None) {
+			--_cleared;
+		}
+		if(value.type == ValueType::None) {
+			++_cleared;
+		}
 		it->second = value;
+		return;
 	}
+	if(value.type == ValueType::None) {
+		return;
+	}
+
+	// new keys end any traversal, so cleared keys can go once they make up half of the hash part
+	if(_cleared && _cleared >= _storage.size() / 2) {
+		purge_cleared();
+	}
+	_storage[normalize_key(key)] = value;
 }
 
 Value Table::get(const Constant& cst) {
@@ -65,11 +136,76 @@ Value Table::get(const Constant& cst) {
 }
 
 Value Table::get(const Value& key) {
-	if(auto it = find(key); it != end()) {
+	if(usize index = array_index(key, _array.size())) {
+		return index <= _array.size() ? _array[index - 1] : Value();
+	}
+	if(_storage.empty()) {
+		return Value();
+	}
+	if(auto it = _storage.find(normalize_key(key)); it != _storage.end()) {
 		return it->second;
 	}
 
 	return Value();
 }
 
+std::pair<Value, Value> Table::next(const Value& key) {
+	usize index = 0;
+	auto it = _storage.begin();
+	if(key.type != ValueType::None) {
+		index = array_index(key, _array.size());
+		if(!index || index > _array.size()) {
+			it = _storage.find(normalize_key(key));
+			if(it != _storage.end()) {
+				index = _array.size();
+				++it;
+			} else {
+				// the array part keeps its capacity when trimmed, so keys cleared from its end still continue into the hash part
+				index = array_index(key, _array.capacity());
+				if(!index || index > _array.capacity()) {
+					throw ExecutionException("Invalid key to next");
+				}
+				it = _storage.begin();
+			}
+		}
+	}
+
+	for(; index < _array.size(); ++index) {
+		if(_array[index].type != ValueType::None) {
+			return {Value::from_integer(i64(index) + 1), _array[index]};
+		}
+	}
+	while(it != _storage.end() && it->second.type == ValueType::None) {
+		++it;
+	}
+	if(it == _storage.end()) {
+		return {};
+	}
+	return *it;
+}
+
+MutableSpan<Value> Table::array() {
+	return MutableSpan<Value>(_array.data(), _array.size());
+}
+
+void Table::insert(usize index, const Value& value) {
+	assert(index && index <= _array.size() + 1);
+	if(index == _array.size() + 1 && value.type == ValueType::None) {
+		return;
+	}
+	_array.insert(_array.begin() + (index - 1), value);
+	grow_array();
+}
+
+Value Table::remove(usize index) {
+	assert(index && index <= _array.size() + 1);
+	if(index > _array.size()) {
+		return Value();
+	}
+	Value value = _array[index - 1];
+	_array.erase(_array.begin() + (index - 1));
+	trim_array();
+	return value;
+}
+
 }
@@ -37,6 +37,7 @@ class Table {
 	};
 
 	public:
+		// a border of the table: t[size()] is not nil and t[size() + 1] is, 0 if t[1] is nil
 		usize size() const;
 
 		void set(const Constant& cst, const Value& value);
@@ -46,20 +47,34 @@ class Table {
 		Value get(const Constant& cst);
 		Value get(const Value& key);
 
-		auto begin() {
-			return _storage.begin();
-		}
+		// Lua's next: the entry after key, or a nil key once every entry has been visited
+		std::pair<Value, Value> next(const Value& key);
 
-		auto end() {
-			return _storage.end();
-		}
+		// values of the keys 1 to size(), nil for holes
+		MutableSpan<Value> array();
 
-		auto find(const Value& key) {
-			return _storage.find(key);
-		}
+		// table.insert and table.remove, index goes from 1 to size() + 1
+		void insert(usize index, const Value& value);
+		Value remove(usize index);
 
 	private:
+		// floats with an integer value are stored as integers, so that t[1] and t[1.0] are the same
+		static Value normalize_key(const Value& key);
+
+		// moves the keys that now follow the array part out of the hash part
+		void grow_array();
+		void trim_array();
+
+		// erases the cleared keys of the hash part
+		void purge_cleared();
+
+		// keys 1 to _array.size(), the last value is never nil.
+		// The hash part never holds the key _array.size() + 1, so _array.size() is a border.
+		std::vector<Value> _array;
 		std::unordered_map<Value, Value, value_hash> _storage;
+
+		// keys set to nil stay in the hash part, so that next() can still find them during a traversal
+		usize _cleared = 0;
 };
 
 
@@ -24,6 +24,8 @@ SOFTWARE.
 #include "Table.h"
 #include "library.h"
 #include "exceptions.h"
+#include "arithmetic.h"
+#include "operators.h"
 
 #include <algorithm>
 
@@ -35,12 +37,17 @@ SOFTWARE.
 #define CHECK_TABLE(value) CHECK_TYPE(value, ValueType::Table)
 #define CHECK_CLOSURE(value) CHECK_TYPE(value, ValueType::Closure)
 #define R(id) _func_stack[current.id]
-#define K(id) function.constants[current.id & Instruction::r_mask]
+#define K(id) function->constants[current.id & Instruction::r_mask]
 #define RK(id) (current.id & Instruction::max_k ? K(id) : R(id))
-#define UP(id) (function.upvalues[current.id])
+#define UP(id) (function->upvalues[current.id])
+#define PROFILE(operand, value) if(feedback) { feedback[pc - function->instructions.begin()].observe(operand, u32((value).type)); }
+#define PROFILE_RK(operand, id) if(!(current.id & Instruction::max_k)) { PROFILE(operand, R(id)) }
+#define PROFILE_TARGET(value) if(feedback) { feedback[pc - function->instructions.begin()].observe_target((value).c_ptr); }
 
 namespace jit {
 
+static thread_local VM* current_vm = nullptr;
+
 VM::VM(Table* env) : _stack(std::make_unique<Value[]>(1 << 16)) {
 	_stack[0] = env;
 	_upvalues.push_back(env);
@@ -82,6 +89,13 @@ Value& VM::upvalue(UpValue up) {
 	return _upvalues[up.reg];
 }
 
+// the callee frame isn't pushed yet, so the running frame is the first one up
+Value& VM::callee_upvalue(UpValue up) {
+	if(up.stack == 1) {
+		return _func_stack[up.reg];
+	}
+	return upvalue(up.stack ? UpValue{u8(up.stack - 1), up.reg} : up);
+}
 
 Table& VM::tab_upvalue(UpValue up) {
 	Value& val = upvalue(up);
@@ -95,40 +109,187 @@ Table& VM::tab_upvalue(UpValue up) {
 }
 
 void VM::eval(const Program& program, Value* ret) {
-	u32 rets = 1;
-	return eval(program.functions.front(), ret, rets);
+	if(!start(program, ret)) {
+		throw ExecutionException("Async call outside of an event loop", _frame.pc);
+	}
+}
+
+bool VM::start(const Program& program, Value* ret) {
+	assert(!_suspended && _call_frames.empty());
+	const Function& main = program.functions.front();
+	_frame = Frame{&main, main.instructions.begin(), ret, 1};
+	return run();
+}
+
+bool VM::resume(Span<Value> results) {
+	if(!_suspended) {
+		fatal("VM is not suspended.");
+	}
+	_suspended = false;
+	_last_ret_count = u32(std::min(results.size(), _pending_out.size()));
+	std::copy_n(results.begin(), _last_ret_count, _pending_out.begin());
+	// the frame still points to the suspended call, which nil fills its missing results like any other call
+	if(OpCode(_frame.pc->opcode) == OpCode::Call && _frame.pc->C) {
+		std::fill(_pending_out.begin() + _last_ret_count, _pending_out.end(), Value());
+	}
+	++_frame.pc;
+	return run();
+}
+
+u32 VM::deoptimize(const Function& function, u32 pc, Span<Value> registers, MutableSpan<Value> results) {
+	if(pc >= function.instructions.size() || registers.size() != function.regs) {
+		fatal("Invalid deoptimization state.");
+	}
+	return run_frame(function, function.instructions.begin() + pc, registers, results);
+}
+
+VM* VM::current() {
+	return current_vm;
+}
+
+u32 VM::call(const Value& function, Span<Value> args, MutableSpan<Value> results) {
+	if(function.type == ValueType::ExternalFunction) {
+		return function.func()(results, args);
+	}
+	if(function.type == ValueType::FastFunction) {
+		return function.fast_func().function(results, args);
+	}
+	check_type(function, ValueType::Closure);
+	const Function& func = function.closure();
+	check_params(func, u32(args.size()));
+
+	return run_frame(func, func.instructions.begin(), args, results);
+}
+
+// the new frame goes above the registers of the running one, which is the frame that called the native function if any
+u32 VM::run_frame(const Function& function, const Instruction* pc, Span<Value> registers, MutableSpan<Value> results) {
+	const Frame caller = _frame;
+	const usize base_frames = _base_frames;
+	const u32 last_ret_reg = _last_ret_reg;
+	push_stack(caller.function ? caller.function->regs : 0);
+	std::copy(registers.begin(), registers.end(), _func_stack);
+
+	// the caller stays on the frame stack so that the profiler sees it
+	if(caller.function) {
+		_call_frames.push_back(caller);
+	}
+	_base_frames = _call_frames.size();
+	_frame = Frame{&function, pc, results.begin(), u32(results.size())};
+	if(!run()) {
+		throw ExecutionException("Async call inside a native function");
+	}
+	const u32 count = _last_ret_count;
+
+	if(caller.function) {
+		_call_frames.pop_back();
+	}
+	pop_stack();
+	_frame = caller;
+	_base_frames = base_frames;
+	_last_ret_reg = last_ret_reg;
+	current_vm = this;
+	return count;
+}
+
+bool VM::is_suspended() const {
+	return _suspended;
 }
 
-void VM::eval(const Function& function, Value* ret, u32& ret_count) {
+void VM::set_profiling(bool enabled) {
+	_profiling = enabled;
+}
+
+void VM::set_profiler(Profiler* profiler) {
+	_profiler = profiler;
+	_sample_countdown = profiler ? profiler->next_interval() : 0;
+}
+
+void VM::set_call_handler(CallHandler* handler) {
+	_call_handler = handler;
+}
+
+// caller frames point to their call instruction
+void VM::sample(const Function* function, const Instruction* pc) {
+	_sample_stack.clear();
+	for(const Frame& frame : _call_frames) {
+		_sample_stack.push_back({frame.function, u32(frame.pc - frame.function->instructions.begin())});
+	}
+	_sample_stack.push_back({function, u32(pc - function->instructions.begin())});
+	_profiler->add_sample(Span<Profiler::Location>(_sample_stack.data(), _sample_stack.size()));
+	_sample_countdown = _profiler->next_interval();
+}
 
-	auto call = [this, &function](const Value& func_val, MutableSpan<Value> out, Span<Value> in) -> u32 {
+static TypeFeedback* feedback_slots(const Function* function, bool profiling) {
+	if(!profiling) {
+		return nullptr;
+	}
+	if(function->feedback.size() != function->instructions.size()) {
+		function->feedback.resize(function->instructions.size());
+	}
+	return function->feedback.data();
+}
+
+bool VM::run() {
+	const Function* function = _frame.function;
+	const Instruction* pc = _frame.pc;
+	TypeFeedback* feedback = feedback_slots(function, _profiling);
+	Profiler* const profiler = _profiler;
+	current_vm = this;
+
+	// returns false if execution left the current frame, either by entering the callee or by suspending
+	auto call = [&](const Value& func_val, MutableSpan<Value> out, Span<Value> in) -> bool {
+		// natives calling back into the VM are attributed to this call
+		_frame.pc = pc;
 		if(func_val.type == ValueType::ExternalFunction) {
-			return func_val.func()(out, in);
+			_last_ret_count = func_val.func()(out, in);
+			return true;
+		}
+		if(func_val.type == ValueType::FastFunction) {
+			_last_ret_count = func_val.fast_func().function(out, in);
+			return true;
+		}
+		if(func_val.type == ValueType::AsyncFunction) {
+			_last_ret_count = func_val.async_func()(Continuation{this}, out, in);
+			if(_last_ret_count != call_pending) {
+				return true;
+			}
+			_suspended = true;
+			_pending_out = out;
+			return false;
 		}
 		CHECK_CLOSURE(func_val);
 		const Function& func = func_val.closure();
 		CHECK_PARAMS(func, in.size());
-		push_stack(function.regs);
+		if(_call_handler && _call_handler->call(*this, func, in, out, _last_ret_count)) {
+			return true;
+		}
+		push_stack(function->regs);
 		std::copy(in.begin(), in.end(), _func_stack);
-		u32 returned = out.size();
-		eval(func, out.begin(), returned);
-		pop_stack();
-		return returned;
+
+		_call_frames.push_back(_frame);
+		_frame = Frame{&func, func.instructions.begin(), out.begin(), u32(out.size())};
+
+		function = _frame.function;
+		pc = _frame.pc;
+		feedback = feedback_slots(function, _profiling);
+		return false;
 	};
 
 
 	const u32 max_args = 254;
-	u32 last_ret_count = 0;
-	const Instruction* pc = nullptr;
 	try {
-		for(pc = function.instructions.begin();; ++pc) {
+		for(;;) {
 			Instruction current = *pc;
 
+			if(profiler && !--_sample_countdown) {
+				sample(function, pc);
+			}
+
 			//std::printf("%s %u %u %u\n", op_name(OpCode(current.opcode)), current.A, current.B, current.C);
 			//std::printf("%s\n", op_name(OpCode(current.opcode)));
 			/*
 
-			for(u32 i = 0; i != function.regs + 5; ++i) {
+			for(u32 i = 0; i != function->regs + 5; ++i) {
 				std::printf("[%d] ", i);
 				lib::print(_func_stack[i]);
 			}
@@ -142,7 +303,7 @@ void VM::eval(const Function& function, Value* ret, u32& ret_count) {
 				break;
 
 				case OpCode::Loadk:
-					R(A) = function.constants[current.Bx()];
+					R(A) = function->constants[current.Bx()];
 				break;
 
 				/* ... */
@@ -168,15 +329,41 @@ void VM::eval(const Function& function, Value* ret, u32& ret_count) {
 
 				case OpCode::Gettabup: {
 					Value& tab = upvalue(UP(B));
+					PROFILE(0, tab);
+					PROFILE_RK(1, C);
+					PROFILE_TARGET(tab);
 					CHECK_TABLE(tab);
 					R(A) = tab.table().get(RK(C));
 				} break;
 
 				case OpCode::Gettable:
+				gettable:
+					PROFILE(0, R(B));
+					PROFILE_RK(1, C);
+					PROFILE_TARGET(R(B));
 					CHECK_TABLE(R(B));
 					R(A) = R(B).table().get(RK(C));
 				break;
 
+				// strings find their methods in the string library
+				case OpCode::Self: {
+					Value object = R(B);
+					PROFILE(0, object);
+					PROFILE_RK(1, C);
+					PROFILE_TARGET(object);
+					R(A + 1) = object;
+					if(object.type == ValueType::String) {
+						R(A) = lib::string_library()->get(RK(C));
+						break;
+					}
+					if(object.type == ValueType::Userdata) {
+						R(A) = object.userdata().methods->get(RK(C));
+						break;
+					}
+					CHECK_TABLE(object);
+					R(A) = object.table().get(RK(C));
+				} break;
+
 				case OpCode::Settabup: {
 					Table& tab = tab_upvalue(UP(A));
 					tab.set(RK(B), RK(C));
@@ -187,6 +374,11 @@ void VM::eval(const Function& function, Value* ret, u32& ret_count) {
 				break;
 
 				case OpCode::Settable:
+				settable:
+					PROFILE(0, R(A));
+					PROFILE_RK(1, B);
+					PROFILE_RK(2, C);
+					PROFILE_TARGET(R(A));
 					CHECK_TABLE(R(A));
 					R(A).table().set(RK(B), RK(C));
 				break;
@@ -199,58 +391,100 @@ void VM::eval(const Function& function, Value* ret, u32& ret_count) {
 				/* ... */
 
 				case OpCode::Add:
-					CHECK_NUM(RK(B));
-					CHECK_NUM(RK(C));
-					R(A) = RK(B).number + RK(C).number;
+				add:
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					arithmetic(R(A), RK(B), RK(C), int_add, [](double x, double y) { return x + y; });
 				break;
 
 				case OpCode::Sub:
-					CHECK_NUM(RK(B));
-					CHECK_NUM(RK(C));
-					R(A) = RK(B).number - RK(C).number;
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					arithmetic(R(A), RK(B), RK(C), int_sub, [](double x, double y) { return x - y; });
 				break;
 
 				case OpCode::Mul:
-					CHECK_NUM(RK(B));
-					CHECK_NUM(RK(C));
-					R(A) = RK(B).number * RK(C).number;
+				mul:
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					arithmetic(R(A), RK(B), RK(C), int_mul, [](double x, double y) { return x * y; });
 				break;
 
 				case OpCode::Mod:
-					CHECK_NUM(RK(B));
-					CHECK_NUM(RK(C));
-					R(A) = std::fmod(RK(B).number, RK(C).number);
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					arithmetic(R(A), RK(B), RK(C), [](i64 x, i64 y) { return int_mod(x, nonzero(y)); }, float_mod);
 				break;
 
 				case OpCode::Pow:
-					CHECK_NUM(RK(B));
-					CHECK_NUM(RK(C));
-					R(A) = std::pow(RK(B).number, RK(C).number);
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					set_number(R(A), std::pow(float_value(RK(B)), float_value(RK(C))));
 				break;
 
 				case OpCode::Div:
-					CHECK_NUM(RK(B));
-					CHECK_NUM(RK(C));
-					R(A) = RK(B).number / RK(C).number;
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					set_number(R(A), float_value(RK(B)) / float_value(RK(C)));
 				break;
 
-				/* ... */
+				case OpCode::Idiv:
+					arithmetic(R(A), RK(B), RK(C), [](i64 x, i64 y) { return int_idiv(x, nonzero(y)); }, float_idiv);
+				break;
+
+				case OpCode::Band:
+					set_integer(R(A), integer_value(RK(B)) & integer_value(RK(C)));
+				break;
+
+				case OpCode::Bor:
+					set_integer(R(A), integer_value(RK(B)) | integer_value(RK(C)));
+				break;
+
+				case OpCode::Bxor:
+					set_integer(R(A), integer_value(RK(B)) ^ integer_value(RK(C)));
+				break;
+
+				case OpCode::Shl:
+					set_integer(R(A), shift_left(integer_value(RK(B)), integer_value(RK(C))));
+				break;
+
+				case OpCode::Shr:
+					set_integer(R(A), shift_right(integer_value(RK(B)), integer_value(RK(C))));
+				break;
 
 				case OpCode::Unm:
-					CHECK_NUM(R(B));
-					R(A) = -R(B).number;
+					PROFILE(0, R(B));
+					if(is_integer(R(B))) {
+						set_integer(R(A), int_sub(0, R(B).integer));
+					} else {
+						set_number(R(A), -float_value(R(B)));
+					}
+				break;
+
+				case OpCode::Bnot:
+					set_integer(R(A), ~integer_value(R(B)));
 				break;
 
 				/* ... */
 
 				case OpCode::Len:
+					PROFILE(0, R(B));
+					if(R(B).type == ValueType::String) {
+						set_integer(R(A), i64(R(B).string_size()));
+						break;
+					}
 					CHECK_TABLE(R(B));
-					R(A) = R(B).table().size();
+					set_integer(R(A), i64(R(B).table().size()));
+				break;
+
+				case OpCode::Concat:
+					R(A) = Value::concat(Span<Value>(&R(B), current.C - current.B + 1));
 				break;
 
 				/* ... */
 
 				case OpCode::Jmp:
+				jmp:
 					pc += current.sBx() + 1;
 					if(current.A) {
 						fatal("Unsupported.");
@@ -263,17 +497,21 @@ void VM::eval(const Function& function, Value* ret, u32& ret_count) {
 					}
 				break;
 
-				/*case OpCode::Lt:
-					if((RK(B) < RK(C)) != current.A) {
+				case OpCode::Lt:
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					if(less_than(RK(B), RK(C)) != current.A) {
 						++pc;
 					}
 				break;
 
 				case OpCode::Le:
-					if((RK(B) <= RK(C)) != current.A) {
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					if(less_equal(RK(B), RK(C)) != current.A) {
 						++pc;
 					}
-				break;*/
+				break;
 
 				/* ... */
 
@@ -292,44 +530,121 @@ void VM::eval(const Function& function, Value* ret, u32& ret_count) {
 				break;
 
 				case OpCode::Call: {
+					PROFILE(0, R(A));
+					PROFILE_TARGET(R(A));
+
+					// typed natives run straight on the registers when they take the arguments
+					if(R(A).type == ValueType::FastFunction) {
+						const FastFunction& native = R(A).fast_func();
+						Value discarded;
+						if(current.B == native.args + 1 && native.fast(current.C == 1 ? discarded : R(A), &R(A + 1))) {
+							_last_ret_reg = current.A;
+							_last_ret_count = 1;
+							for(u32 i = 2; i < current.C; ++i) {
+								R(A + i - 1) = Value();
+							}
+							break;
+						}
+					}
+
 					u32 returns = current.C ? current.C - 1 : max_args;
 					MutableSpan<Value> out(_func_stack + current.A, returns);
 
-					u32 args = current.B ? current.B - 1 : last_ret_count;
+					// with B == 0 the arguments end with the results of the previous call
+					u32 args = current.B ? current.B - 1 : _last_ret_reg + _last_ret_count - (current.A + 1);
 					Span<Value> in(_func_stack + current.A + 1, args);
+					_last_ret_reg = current.A;
 
-					last_ret_count = call(R(A), out, in);
+					if(!call(R(A), out, in)) {
+						if(_suspended) {
+							return false;
+						}
+						continue;
+					}
+					// native functions only write the results they have
+					if(current.C) {
+						std::fill(out.begin() + std::min(_last_ret_count, returns), out.end(), Value());
+					}
 				} break;
 
 
 				/* ... */
 
-				case OpCode::Return:
-					if(ret) {
-						ret_count = std::min(ret_count, current.B ? current.B - 1 : function.regs - current.A);
-						std::copy_n(_func_stack + current.A, ret_count, ret);
+				case OpCode::Return: {
+					u32 ret_count = std::min(_frame.ret_count, current.B ? current.B - 1 : function->regs - current.A);
+					if(_frame.ret) {
+						std::copy_n(_func_stack + current.A, ret_count, _frame.ret);
 						/*printf("ret = %d\n", ret_count);
-						lib::print(ret, ret_count);*/
+						lib::print(_frame.ret, ret_count);*/
 					}
-					return;
-				break;
+					_last_ret_count = ret_count;
+					if(_call_frames.size() == _base_frames) {
+						return true;
+					}
+					// like after a native call, the results that a call with a fixed count didn't get are nil
+					if(_call_frames.back().pc->C) {
+						std::fill(_frame.ret + ret_count, _frame.ret + _frame.ret_count, Value());
+					}
+
+					pop_stack();
+					_frame = _call_frames.back();
+					_call_frames.pop_back();
 
+					function = _frame.function;
+					pc = _frame.pc;
+					feedback = feedback_slots(function, _profiling);
+					_last_ret_reg = pc->A;
+				} break;
+
+				// the loop registers can't be reached from Lua code, Forprep checks and converts them once
 				case OpCode::Forloop:
-					CHECK_NUM(R(A));
-					CHECK_NUM(R(A + 1));
-					CHECK_NUM(R(A + 2));
-					R(A).number += R(A + 2).number;
-					if(R(A + 2).number > 0.0 ? R(A).number <= R(A + 1).number : R(A).number >= R(A + 1).number) {
+					if(R(A).subtype == NumberType::Integer) {
+						i64 index = int_add(R(A).integer, R(A + 2).integer);
+						if(R(A + 2).integer > 0 ? index <= R(A + 1).integer : index >= R(A + 1).integer) {
+							pc += current.sBx() + 1;
+							set_integer(R(A), index);
+							set_integer(R(A + 3), index);
+						}
+					} else {
+						R(A).number += R(A + 2).number;
+						if(R(A + 2).number > 0.0 ? R(A).number <= R(A + 1).number : R(A).number >= R(A + 1).number) {
+							pc += current.sBx() + 1;
+							set_number(R(A + 3), R(A).number);
+						}
+					}
+				break;
+
+				case OpCode::Forloopup:
+					if(R(A).subtype == NumberType::Integer) {
+						i64 index = int_add(R(A).integer, R(A + 2).integer);
+						if(index <= R(A + 1).integer) {
+							pc += current.sBx() + 1;
+							set_integer(R(A), index);
+							set_integer(R(A + 3), index);
+						}
+					} else if((R(A).number += R(A + 2).number) <= R(A + 1).number) {
+						pc += current.sBx() + 1;
+						set_number(R(A + 3), R(A).number);
+					}
+				break;
+
+				case OpCode::Forloopdown:
+					if(R(A).subtype == NumberType::Integer) {
+						i64 index = int_add(R(A).integer, R(A + 2).integer);
+						if(index >= R(A + 1).integer) {
+							pc += current.sBx() + 1;
+							set_integer(R(A), index);
+							set_integer(R(A + 3), index);
+						}
+					} else if((R(A).number += R(A + 2).number) >= R(A + 1).number) {
 						pc += current.sBx() + 1;
-						R(A + 3) = R(A);
+						set_number(R(A + 3), R(A).number);
 					}
 				break;
 
 				case OpCode::Forprep:
-					CHECK_NUM(R(A));
-					CHECK_NUM(R(A + 2));
-					R(A).number -= R(A + 2).number;
-					pc += current.sBx() + 1;
+					// jumps to the Forloop, or right after it if the loop can't run
+					pc += current.sBx() + (prepare_loop(R(A), R(A + 1), R(A + 2)) ? 1 : 2);
 				break;
 
 				case OpCode::Tforcall: {
@@ -339,7 +654,12 @@ void VM::eval(const Function& function, Value* ret, u32& ret_count) {
 					MutableSpan<Value> out(_func_stack + current.A + 3, current.C/* - 1*/);
 					Span<Value> in(_func_stack + current.A + 1, 2);
 
-					call(R(A), out, in);
+					if(!call(R(A), out, in)) {
+						if(_suspended) {
+							return false;
+						}
+						continue;
+					}
 				} break;
 
 				case OpCode::Tforloop:
@@ -355,19 +675,88 @@ void VM::eval(const Function& function, Value* ret, u32& ret_count) {
 				case OpCode::Setlist: {
 					CHECK_TABLE(R(A));
 					Table& list = R(A).table();
-					usize start = (current.C - 1) * 50;
-					for(usize i = 1; i <= current.B; ++i) {
-						list.set(start + i, R(A + i));
+					i64 start = (current.C - 1) * 50;
+					for(u32 i = 1; i <= current.B; ++i) {
+						list.set(Value::from_integer(start + i), R(A + i));
 					}
 				} break;
 
 				case OpCode::Closure:
-					R(A) = &function.functions[current.Bx()];
+					R(A) = &Program::load(function->functions[current.Bx()]);
 				break;
 
+				// superinstructions run the second instruction of the pair directly
+				case OpCode::Eqjmp:
+					if((RK(B) == RK(C)) != current.A) {
+						++pc;
+						break;
+					}
+					current = *++pc;
+				goto jmp;
+
+				case OpCode::Ltjmp:
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					if(less_than(RK(B), RK(C)) != current.A) {
+						++pc;
+						break;
+					}
+					current = *++pc;
+				goto jmp;
+
+				case OpCode::Lejmp:
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					if(less_equal(RK(B), RK(C)) != current.A) {
+						++pc;
+						break;
+					}
+					current = *++pc;
+				goto jmp;
+
+				case OpCode::Testjmp:
+					if(R(A).to_bool() != current.C) {
+						++pc;
+						break;
+					}
+					current = *++pc;
+				goto jmp;
+
+				case OpCode::Gettablegettable:
+					PROFILE(0, R(B));
+					PROFILE_RK(1, C);
+					PROFILE_TARGET(R(B));
+					CHECK_TABLE(R(B));
+					R(A) = R(B).table().get(RK(C));
+					current = *++pc;
+				goto gettable;
+
+				case OpCode::Muladd:
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					arithmetic(R(A), RK(B), RK(C), int_mul, [](double x, double y) { return x * y; });
+					current = *++pc;
+				goto add;
+
+				case OpCode::Submul:
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					arithmetic(R(A), RK(B), RK(C), int_sub, [](double x, double y) { return x - y; });
+					current = *++pc;
+				goto mul;
+
+				case OpCode::Addsettable:
+					PROFILE_RK(0, B);
+					PROFILE_RK(1, C);
+					arithmetic(R(A), RK(B), RK(C), int_add, [](double x, double y) { return x + y; });
+					current = *++pc;
+				goto settable;
+
 				default:
 					throw InvalidInstructionException(pc);
 			}
+
+			++pc;
 		}
 	} catch(ExecutionException& exception) {
 		if(!exception.instruction) {
@@ -25,11 +25,24 @@ SOFTWARE.
 #include "bytecode.h"
 #include "Value.h"
 #include "Program.h"
+#include "Profiler.h"
 
 #include <memory>
 
 namespace jit {
 
+class VM;
+
+// Runs closures called by the interpreter in its place, see VM::set_call_handler
+class CallHandler {
+	public:
+		virtual ~CallHandler() = default;
+
+		// Returns false to let the interpreter run the function, otherwise count is the number of results written.
+		// args and results can overlap.
+		virtual bool call(VM& vm, const Function& function, Span<Value> args, MutableSpan<Value> results, u32& count) = 0;
+};
+
 class VM {
 
 	public:
@@ -37,9 +50,46 @@ class VM {
 
 		void eval(const Program& program, Value* ret);
 
+		// Both return false if the program has been suspended by an async call
+		bool start(const Program& program, Value* ret);
+		bool resume(Span<Value> results);
+
+		bool is_suspended() const;
+
+		// Rebuilds the frame of a compiled function whose guard failed and interprets it from pc until it returns.
+		// registers holds a value for every register of the frame. Returns the number of results written, like call().
+		u32 deoptimize(const Function& function, u32 pc, Span<Value> registers, MutableSpan<Value> results);
+
+		// Records operand types and call targets in Function::feedback
+		void set_profiling(bool enabled);
+
+		// Records the call stack into profiler every few thousand instructions, nullptr stops sampling
+		void set_profiler(Profiler* profiler);
+
+		// Offers every call from Lua code to a Lua function to handler first, nullptr removes it
+		void set_call_handler(CallHandler* handler);
+
+		// The VM running the current native function, which can call back into it
+		static VM* current();
+
+		// Calls a function from a native function, returns the number of results written
+		u32 call(const Value& function, Span<Value> args, MutableSpan<Value> results);
+
+		// Upvalue of a closure that the running frame is calling, as the callee would see it once entered
+		Value& callee_upvalue(UpValue up);
+
 
 	private:
-		void eval(const Function& function, Value* ret, u32& ret_count);
+		struct Frame {
+			const Function* function = nullptr;
+			const Instruction* pc = nullptr;
+			Value* ret = nullptr;
+			u32 ret_count = 0;
+		};
+
+		bool run();
+		u32 run_frame(const Function& function, const Instruction* pc, Span<Value> registers, MutableSpan<Value> results);
+		void sample(const Function* function, const Instruction* pc);
 
 		Value& upvalue(UpValue up);
 		Table& tab_upvalue(UpValue up);
@@ -51,6 +101,21 @@ class VM {
 		std::unique_ptr<Value[]> _stack;
 		std::vector<Value*> _stack_frames;
 
+		Frame _frame;
+		std::vector<Frame> _call_frames;
+		// Return leaves run() at this depth, it is only above 0 during VM::call
+		usize _base_frames = 0;
+		u32 _last_ret_count = 0;
+		u32 _last_ret_reg = 0;
+
+		bool _profiling = false;
+		Profiler* _profiler = nullptr;
+		CallHandler* _call_handler = nullptr;
+		u32 _sample_countdown = 0;
+		std::vector<Profiler::Location> _sample_stack;
+		bool _suspended = false;
+		MutableSpan<Value> _pending_out;
+
 		std::vector<Value> _upvalues;
 
 		static void check_type(const Value& value, ValueType type);
@@ -21,9 +21,50 @@ SOFTWARE.
 **********************************/
 
 #include "Value.h"
+#include "arithmetic.h"
+#include "exceptions.h"
+#include "number.h"
+
+#include <algorithm>
+#include <vector>
 
 namespace jit {
 
+// Results of Concat that start with a string at least this long are ropes, so that s = s .. x doesn't copy s
+static constexpr usize min_rope_size = 64;
+
+struct Rope {
+	Value left;
+	Value right;
+	usize size = 0;
+	String* flat = nullptr;
+};
+
+static Rope& rope(const Value& value) {
+	return *reinterpret_cast<Rope*>(value.ptr);
+}
+
+// ropes are usually left deep, so this doesn't recurse
+static const String& flatten(Rope& r) {
+	if(!r.flat) {
+		r.flat = String::build(r.size, [&](char* data) {
+			std::vector<const Value*> stack = {&r.right, &r.left};
+			while(!stack.empty()) {
+				const Value* v = stack.back();
+				stack.pop_back();
+				if(v->string_type == StringType::Rope && !rope(*v).flat) {
+					stack.push_back(&rope(*v).right);
+					stack.push_back(&rope(*v).left);
+				} else {
+					const String& str = v->string();
+					data = std::copy_n(str.data(), str.size(), data);
+				}
+			}
+		});
+	}
+	return *r.flat;
+}
+
 Value::Value() : integer(0) {
 }
 
@@ -33,18 +74,27 @@ Value::Value(double n) : type(ValueType::Number), number(n) {
 Value::Value(Table* t) : type(ValueType::Table), ptr(t) {
 }
 
-Value::Value(std::string* s) : type(ValueType::String), ptr(s) {
+Value::Value(const String* s) : type(ValueType::String), c_ptr(s) {
 }
 
-Value::Value(std::string_view s) : Value(new std::string(s)) {
+Value::Value(std::string_view s) : Value(String::create(s)) {
 }
 
 Value::Value(FunctionPtr f) : type(ValueType::ExternalFunction), ptr(reinterpret_cast<void*>(f)) {
 }
 
+Value::Value(AsyncFunctionPtr f) : type(ValueType::AsyncFunction), ptr(reinterpret_cast<void*>(f)) {
+}
+
+Value::Value(const FastFunction* f) : type(ValueType::FastFunction), c_ptr(f) {
+}
+
 Value::Value(const Function* f) : type(ValueType::Closure), c_ptr(f) {
 }
 
+Value::Value(Userdata* u) : type(ValueType::Userdata), ptr(u) {
+}
+
 Value::Value(const Constant& cst) {
 	switch(cst.type) {
 		case ConstantType::None:
@@ -54,12 +104,13 @@ Value::Value(const Constant& cst) {
 		case ConstantType::String:
 		case ConstantType::LongString:
 			type = ValueType::String;
-			ptr = new std::string(cst.string);
+			ptr = String::create(cst.string);
 		break;
 
 		case ConstantType::Integer:
 			type = ValueType::Number;
-			number = cst.integer;
+			subtype = NumberType::Integer;
+			integer = cst.integer;
 		break;
 
 		case ConstantType::Number:
@@ -74,7 +125,7 @@ Value::Value(const Constant& cst) {
 }
 
 const char* Value::type_str(ValueType type) {
-	static const char* names[] = {"nil", "number", "bool", "table", "string", "function", "function"};
+	static const char* names[] = {"nil", "number", "bool", "table", "string", "function", "function", "function", "userdata", "function"};
 	return names[usize(type)];
 }
 
@@ -87,9 +138,96 @@ Table& Value::table() const {
 	return *reinterpret_cast<Table*>(ptr);
 }
 
-std::string& Value::string() const {
+const String& Value::string() const {
+	assert(type == ValueType::String);
+	if(string_type == StringType::Rope) {
+		return flatten(rope(*this));
+	}
+	return *reinterpret_cast<const String*>(ptr);
+}
+
+usize Value::string_size() const {
 	assert(type == ValueType::String);
-	return *reinterpret_cast<std::string*>(ptr);
+	return string_type == StringType::Rope ? rope(*this).size : string().size();
+}
+
+usize number_to_string(const Value& value, char* buffer) {
+	if(value.subtype == NumberType::Integer) {
+		return format_integer(value.integer, buffer);
+	}
+	usize len = format_float(value.number, buffer);
+	if(std::all_of(buffer, buffer + len, [](char c) { return c == '-' || (c >= '0' && c <= '9'); })) {
+		buffer[len++] = '.';
+		buffer[len++] = '0';
+		buffer[len] = 0;
+	}
+	return len;
+}
+
+bool string_to_number(std::string_view str, Value& number) {
+	auto is_space = [](char c) { return c == ' ' || (c >= '\t' && c <= '\r'); };
+	while(!str.empty() && is_space(str.front())) {
+		str.remove_prefix(1);
+	}
+	while(!str.empty() && is_space(str.back())) {
+		str.remove_suffix(1);
+	}
+
+	i64 i = 0;
+	if(parse_integer(str, i)) {
+		number = Value::from_integer(i);
+		return true;
+	}
+	double f = 0.0;
+	if(parse_float(str, f)) {
+		number = Value(f);
+		return true;
+	}
+	return false;
+}
+
+Value Value::concat(Span<Value> values) {
+	for(const Value& v : values) {
+		if(v.type != ValueType::String && v.type != ValueType::Number) {
+			throw TypeErrorException(ValueType::String, v.type);
+		}
+	}
+
+	// the long prefix is kept as is, everything after it is built in one allocation
+	const bool make_rope = values[0].type == ValueType::String && values[0].string_size() >= min_rope_size;
+	Span<Value> parts = make_rope ? Span<Value>(values.begin() + 1, values.size() - 1) : values;
+
+	usize size = 0;
+	char buffer[32];
+	for(const Value& v : parts) {
+		size += v.type == ValueType::String ? v.string_size() : number_to_string(v, buffer);
+	}
+
+	String* str = String::build(size, [&](char* data) {
+		for(const Value& v : parts) {
+			if(v.type == ValueType::String) {
+				const String& part = v.string();
+				data = std::copy_n(part.data(), part.size(), data);
+			} else {
+				data = std::copy_n(buffer, number_to_string(v, buffer), data);
+			}
+		}
+	});
+
+	if(!make_rope) {
+		return Value(str);
+	}
+
+	auto* r = new Rope();
+	r->left = values[0];
+	r->right = Value(str);
+	r->size = values[0].string_size() + str->size();
+
+	Value value;
+	value.type = ValueType::String;
+	value.string_type = StringType::Rope;
+	value.ptr = r;
+	return value;
 }
 
 FunctionPtr Value::func() const {
@@ -97,11 +235,26 @@ FunctionPtr Value::func() const {
 	return reinterpret_cast<FunctionPtr>(ptr);
 }
 
+AsyncFunctionPtr Value::async_func() const {
+	assert(type == ValueType::AsyncFunction);
+	return reinterpret_cast<AsyncFunctionPtr>(ptr);
+}
+
+const FastFunction& Value::fast_func() const {
+	assert(type == ValueType::FastFunction);
+	return *reinterpret_cast<const FastFunction*>(c_ptr);
+}
+
 const Function& Value::closure() const {
 	assert(type == ValueType::Closure);
 	return *reinterpret_cast<const Function*>(c_ptr);
 }
 
+Userdata& Value::userdata() const {
+	assert(type == ValueType::Userdata);
+	return *reinterpret_cast<Userdata*>(ptr);
+}
+
 Value Value::from_bool(bool b) {
 	Value v;
 	v.type = ValueType::Bool;
@@ -109,6 +262,37 @@ Value Value::from_bool(bool b) {
 	return v;
 }
 
+Value Value::from_integer(i64 i) {
+	Value v;
+	v.type = ValueType::Number;
+	v.subtype = NumberType::Integer;
+	v.integer = i;
+	return v;
+}
+
+bool Value::is_integer() const {
+	return type == ValueType::Number && subtype == NumberType::Integer;
+}
+
+bool Value::to_integer(i64& i) const {
+	if(type != ValueType::Number) {
+		return false;
+	}
+	if(subtype == NumberType::Integer) {
+		i = integer;
+		return true;
+	}
+	return float_to_integer(number, i);
+}
+
+bool Value::to_double(double& d) const {
+	if(type != ValueType::Number) {
+		return false;
+	}
+	d = subtype == NumberType::Integer ? double(integer) : number;
+	return true;
+}
+
 bool Value::to_bool() const {
 	if(type == ValueType::None) {
 		return false;
@@ -127,12 +311,19 @@ bool Value::operator==(const Value& value) const {
 	switch(type) {
 		case ValueType::None:
 			return true;
-		case ValueType::Number:
-			return number == value.number;
+		case ValueType::Number: {
+			if(subtype == value.subtype) {
+				return subtype == NumberType::Integer ? integer == value.integer : number == value.number;
+			}
+			// an integer and a float are equal if the float has the exact same integer value
+			i64 a = 0;
+			i64 b = 0;
+			return to_integer(a) && value.to_integer(b) && a == b;
+		}
 
 		case ValueType::String:
 #warning intern string
-			return string() == value.string();
+			return ptr == value.ptr || (string_size() == value.string_size() && string().view() == value.string().view());
 
 		default:
 			return integer == value.integer;
@@ -143,10 +334,43 @@ bool Value::operator!=(const Value& value) const {
 	return !operator==(value);
 }
 
+static void check_comparable(const Value& a, const Value& b) {
+	if(a.type != ValueType::Number && a.type != ValueType::String) {
+		throw TypeErrorException(ValueType::Number, a.type);
+	}
+	if(a.type != b.type) {
+		throw TypeErrorException(a.type, b.type);
+	}
+}
+
+bool Value::operator<(const Value& value) const {
+	check_comparable(*this, value);
+	if(type == ValueType::String) {
+		return string().view() < value.string().view();
+	}
+	if(subtype == value.subtype) {
+		return subtype == NumberType::Integer ? integer < value.integer : number < value.number;
+	}
+	return subtype == NumberType::Integer ? int_less_float(integer, value.number) : float_less_int(number, value.integer);
+}
+
+bool Value::operator<=(const Value& value) const {
+	check_comparable(*this, value);
+	if(type == ValueType::String) {
+		return string().view() <= value.string().view();
+	}
+	if(subtype == value.subtype) {
+		return subtype == NumberType::Integer ? integer <= value.integer : number <= value.number;
+	}
+	return subtype == NumberType::Integer ? int_less_equal_float(integer, value.number) : float_less_equal_int(number, value.integer);
+}
+
 Value& Value::operator=(const Value& v) {
 	type = v.type;
+	subtype = v.subtype;
+	string_type = v.string_type;
 	integer = v.integer;
-	assert(*this == v);
+	assert(*this == v || (type == ValueType::Number && std::isnan(number)));
 	return *this;
 }
 
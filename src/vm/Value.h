@@ -25,6 +25,7 @@ SOFTWARE.
 #include <utils.h>
 
 #include "bytecode.h"
+#include "String.h"
 
 namespace jit {
 
@@ -38,14 +39,58 @@ enum class ValueType {
 	String,
 
 	Closure,
-	ExternalFunction
+	ExternalFunction,
+	AsyncFunction,
+
+	Userdata,
+	FastFunction
+};
+
+// Numbers are either integers or floats, like in Lua 5.3 both are of type Number
+enum class NumberType : u8 {
+	Float,
+	Integer
+};
+
+// Strings built by concatenation can be ropes, their content is only built when first needed
+enum class StringType : u8 {
+	Flat,
+	Rope
 };
 
+class VM;
 struct Value;
+
+// Native objects, scripts can only call the functions of their methods table
+struct Userdata {
+	virtual ~Userdata() = default;
+
+	Table* methods = nullptr;
+};
+
+// Handle given to async functions, used to resume the suspended VM once the call completes.
+struct Continuation {
+	VM* vm = nullptr;
+};
+
+// Returned by async functions that did not complete immediately
+static constexpr u32 call_pending = u32(-1);
+
 using FunctionPtr = u32(*)(MutableSpan<Value>, Span<Value>);
+using AsyncFunctionPtr = u32(*)(Continuation, MutableSpan<Value>, Span<Value>);
+
+// Natives with a typed version that the interpreter calls straight on its registers, see native.h.
+// fast only takes exactly args arguments and returns false if it can't handle them, function is used for anything else.
+struct FastFunction {
+	FunctionPtr function = nullptr;
+	bool (*fast)(Value& ret, const Value* args) = nullptr;
+	u32 args = 0;
+};
 
 struct Value {
 	ValueType type = ValueType::None;
+	NumberType subtype = NumberType::Float;
+	StringType string_type = StringType::Flat;
 
 	union {
 		i64 integer;
@@ -58,11 +103,13 @@ struct Value {
 
 	Value(double n);
 	Value(Table* t);
-#warning string should be able to contain nulls
-	Value(std::string* s);
+	Value(const String* s);
 	Value(std::string_view s);
 	Value(FunctionPtr f);
+	Value(AsyncFunctionPtr f);
+	Value(const FastFunction* f);
 	Value(const Function* f);
+	Value(Userdata* u);
 
 	Value(const Constant& cst);
 
@@ -70,24 +117,46 @@ struct Value {
 	const char* type_str() const;
 
 	Table& table() const;
-	std::string& string() const;
+	const String& string() const;
+	usize string_size() const;
+
+	// numbers are converted, anything else than strings and numbers throws
+	static Value concat(Span<Value> values);
 
 	FunctionPtr func() const;
+	AsyncFunctionPtr async_func() const;
+	const FastFunction& fast_func() const;
 	const Function& closure() const;
+	Userdata& userdata() const;
 
 	static Value from_bool(bool b);
 	bool to_bool() const;
 
+	static Value from_integer(i64 i);
+	bool is_integer() const;
+
+	// both fail for non numbers, to_integer also fails for floats with a fractional part
+	bool to_integer(i64& i) const;
+	bool to_double(double& d) const;
+
 	explicit operator bool() const;
 
 	bool operator==(const Value& value) const;
 	bool operator!=(const Value& value) const;
 
+	// only numbers and strings can be ordered, anything else throws
+	bool operator<(const Value& value) const;
+	bool operator<=(const Value& value) const;
+
 	Value& operator=(const Value& v);
 
 };
 
+// Formats numbers like Lua 5.3 and returns the length, buffer needs to hold at least 32 chars
+usize number_to_string(const Value& number, char* buffer);
 
+// Lua 5.3 string coercion: surrounding spaces are allowed, integers are tried first
+bool string_to_number(std::string_view str, Value& number);
 
 }
 
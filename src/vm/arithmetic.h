@@ -0,0 +1,124 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_ARITHMETIC_H
+#define JIT_ARITHMETIC_H
+
+#include <utils.h>
+
+#include <cmath>
+#include <limits>
+
+namespace jit {
+
+// Number rules of Lua 5.3, shared by the VM and the compile time folding.
+// Integer arithmetic wraps around, division by zero has to be checked by the caller.
+
+inline bool float_to_integer(double f, i64& i) {
+	if(std::floor(f) != f || f < -9223372036854775808.0 || f >= 9223372036854775808.0) {
+		return false;
+	}
+	i = i64(f);
+	return true;
+}
+
+// Exact comparisons between integers and floats, converting either side could round
+inline bool int_less_float(i64 i, double f) {
+	i64 c = 0;
+	return float_to_integer(std::ceil(f), c) ? i < c : f > 0.0;
+}
+
+inline bool int_less_equal_float(i64 i, double f) {
+	i64 c = 0;
+	return float_to_integer(std::floor(f), c) ? i <= c : f > 0.0;
+}
+
+inline bool float_less_int(double f, i64 i) {
+	i64 c = 0;
+	return float_to_integer(std::floor(f), c) ? c < i : f < 0.0;
+}
+
+inline bool float_less_equal_int(double f, i64 i) {
+	i64 c = 0;
+	return float_to_integer(std::ceil(f), c) ? c <= i : f < 0.0;
+}
+
+inline i64 int_add(i64 a, i64 b) {
+	return i64(u64(a) + u64(b));
+}
+
+inline i64 int_sub(i64 a, i64 b) {
+	return i64(u64(a) - u64(b));
+}
+
+inline i64 int_mul(i64 a, i64 b) {
+	return i64(u64(a) * u64(b));
+}
+
+// floored, like float_mod
+inline i64 int_mod(i64 a, i64 b) {
+	if(b == -1) {
+		return 0;
+	}
+	i64 r = a % b;
+	if(r && (r ^ b) < 0) {
+		r += b;
+	}
+	return r;
+}
+
+inline i64 int_idiv(i64 a, i64 b) {
+	if(b == -1) {
+		return int_sub(0, a);
+	}
+	i64 r = a / b;
+	if((a % b) && (a ^ b) < 0) {
+		--r;
+	}
+	return r;
+}
+
+inline double float_mod(double a, double b) {
+	double r = std::fmod(a, b);
+	if(r * b < 0.0) {
+		r += b;
+	}
+	return r;
+}
+
+inline double float_idiv(double a, double b) {
+	return std::floor(a / b);
+}
+
+inline i64 shift_left(i64 x, i64 y) {
+	if(y <= -64 || y >= 64) {
+		return 0;
+	}
+	return y >= 0 ? i64(u64(x) << y) : i64(u64(x) >> -y);
+}
+
+inline i64 shift_right(i64 x, i64 y) {
+	return shift_left(x, y == std::numeric_limits<i64>::min() ? 64 : -y);
+}
+
+}
+
+#endif // JIT_ARITHMETIC_H
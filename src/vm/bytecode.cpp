@@ -24,7 +24,9 @@ const char* op_name(OpCode op) {
 		"SETUPVAL", "SETTABLE", "NEWTABLE", "SELF", "ADD", "SUB", "MUL", "MOD", "POW", "DIV", "IDIV", "BAND",
 		"BOR", "BXOR", "SHL", "SHR", "UNM", "BNOT", "NOT", "LEN", "CONCAT", "JMP", "EQ", "LT", "LE", "TEST",
 		"TESTSET", "CALL", "TAILCALL", "RETURN", "FORLOOP", "FORPREP", "TFORCALL", "TFORLOOP", "SETLIST",
-		"CLOSURE", "VARARG", "EXTRAARG"
+		"CLOSURE", "VARARG", "EXTRAARG",
+		"FORLOOPUP", "FORLOOPDOWN",
+		"EQJMP", "LTJMP", "LEJMP", "TESTJMP", "GETTABLEGETTABLE", "MULADD", "SUBMUL", "ADDSETTABLE"
 	};
 	if(usize(op) >= sizeof(names) / sizeof(names[0])) {
 		fatal("Invalid op code.");
@@ -32,4 +34,45 @@ const char* op_name(OpCode op) {
 	return names[usize(op)];
 }
 
+OpCode unfused(OpCode op) {
+	switch(op) {
+		case OpCode::Eqjmp:
+			return OpCode::Eq;
+		case OpCode::Ltjmp:
+			return OpCode::Lt;
+		case OpCode::Lejmp:
+			return OpCode::Le;
+		case OpCode::Testjmp:
+			return OpCode::Test;
+		case OpCode::Gettablegettable:
+			return OpCode::Gettable;
+		case OpCode::Muladd:
+			return OpCode::Mul;
+		case OpCode::Submul:
+			return OpCode::Sub;
+		case OpCode::Addsettable:
+			return OpCode::Add;
+		default:
+			return op;
+	}
+}
+
+// source names follow luac: "@file", "=name" or the source itself
+std::string_view source_name(const Function& function) {
+	std::string_view src = function.src;
+	if(!src.empty() && (src[0] == '@' || src[0] == '=')) {
+		return src.substr(1);
+	}
+	return src.empty() ? "?" : "[string]";
+}
+
+// Same names as Lua's tracebacks, bytecode doesn't keep function names
+std::string function_name(const Function& function) {
+	std::string name(source_name(function));
+	if(!function.line) {
+		return "main chunk <" + name + ">";
+	}
+	return "function <" + name + ":" + std::to_string(function.line) + ">";
+}
+
 }
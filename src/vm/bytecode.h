@@ -25,6 +25,8 @@ SOFTWARE.
 
 #include <utils.h>
 
+#include <string>
+#include <string_view>
 #include <vector>
 
 namespace jit {
@@ -92,12 +94,29 @@ enum class OpCode : i32 {
 
 	Vararg,			//	A B			R(A), R(A+1), ..., R(A+B-2) = vararg
 
-	Extraarg		//	Ax			extra (larger) argument for previous opcode
+	Extraarg,		//	Ax			extra (larger) argument for previous opcode
+
+	// Internal opcodes, only produced by optimize_bytecode
+	Forloopup,		//	A sBx		Forloop with a step known to be positive
+	Forloopdown,	//	A sBx		Forloop with a step known to be negative
+
+	// Superinstructions, they also run the next instruction without dispatching it
+	Eqjmp,			//	A B C		Eq followed by a Jmp
+	Ltjmp,			//	A B C		Lt followed by a Jmp
+	Lejmp,			//	A B C		Le followed by a Jmp
+	Testjmp,		//	A C			Test followed by a Jmp
+	Gettablegettable,	//	A B C		Gettable followed by a Gettable
+	Muladd,			//	A B C		Mul followed by an Add
+	Submul,			//	A B C		Sub followed by a Mul
+	Addsettable		//	A B C		Add followed by a Settable
 };
 
 
 const char* op_name(OpCode op);
 
+// The opcode that a superinstruction starts with, other opcodes are returned as is
+OpCode unfused(OpCode op);
+
 // https://the-ravi-programming-language.readthedocs.io/en/latest/lua_bytecode_reference.html
 struct Instruction {
 	static constexpr i32 max_k = 1 << 8;
@@ -154,6 +173,34 @@ struct UpValue {
 
 static_assert(sizeof(UpValue) == sizeof(u16));
 
+// Collected by the interpreter when profiling, one per instruction
+struct TypeFeedback {
+	static constexpr usize max_operands = 3;
+
+	// one bit per observed ValueType for each register operand, constants are not recorded
+	u16 types[max_operands] = {};
+
+	// callee for calls, table for table accesses, until a second one is seen
+	const void* target = nullptr;
+	bool polymorphic = false;
+
+	void observe(usize operand, u32 type) {
+		types[operand] |= u16(1 << type);
+	}
+
+	void observe_target(const void* t) {
+		if(polymorphic || target == t) {
+			return;
+		}
+		if(target) {
+			polymorphic = true;
+			target = nullptr;
+		} else {
+			target = t;
+		}
+	}
+};
+
 struct Function {
 	ArrayView<Instruction> instructions;
 	std::vector<Constant> constants;
@@ -167,9 +214,29 @@ struct Function {
 	std::string_view info;
 	std::string_view src;
 	ArrayView<u32> lines;
+	// line of the definition, 0 for the main function
+	u32 line = 0;
+
+	// set until the function is parsed by Program::load
+	const u8* lazy_data = nullptr;
+	bool optimize = false;
+
+	// empty until the function runs with profiling enabled
+	mutable std::vector<TypeFeedback> feedback;
+
+	// instructions and lines point here once the function has been optimized
+	std::vector<Instruction> instruction_buffer;
+	std::vector<u32> line_buffer;
 };
 
 
+// Source file of the function, without luac's prefix
+std::string_view source_name(const Function& function);
+
+// "function <file:line>", or "main chunk <file>"
+std::string function_name(const Function& function);
+
+
 }
 
 #endif // JIT_BYTECODE_H
@@ -68,6 +68,20 @@ struct InvalidArgCountException : public ExecutionException {
 	const u32 actual_numer;
 };
 
+struct SyntaxErrorException : public std::exception {
+	SyntaxErrorException(const char* what, u32 at_line) : line(at_line), _w(what) {
+	}
+
+	const char* what() const noexcept override {
+		return _w;
+	}
+
+	const u32 line;
+
+	private:
+		const char* _w;
+};
+
 
 }
 
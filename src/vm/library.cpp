@@ -23,15 +23,28 @@ SOFTWARE.
 #include "library.h"
 
 #include "exceptions.h"
+#include "arithmetic.h"
+#include "pattern.h"
+#include "File.h"
+#include "VM.h"
+#include "sort.h"
+#include "native.h"
 
 #include <cmath>
 #include <cstdio>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
 #include <algorithm>
 #include <chrono>
+#include <limits>
+#include <string>
 
 namespace jit {
 namespace lib {
 
+static constexpr double pi = 3.14159265358979323846;
+
 static void check_params(usize expected, usize len) {
 	if(len != expected) {
 		throw InvalidArgCountException(u32(expected), u32(len));
@@ -48,43 +61,102 @@ static void check_type(const Value& v, ValueType expected) {
 	}
 }
 
-template<typename T, typename... Args>
-[[nodiscard]] static u32 build_out(MutableSpan<Value> out, T&& t, Args&&... args) {
-	if(out.size()) {
-		out[0] = std::forward<decltype(t)>(t);
-		if constexpr(sizeof...(args)) {
-			return 1 + build_out({out.data() + 1, out.size() - 1}, std::forward<decltype(args)>(args)...);
-		}
-		return 1;
-	}
-	return 0;
+
+static Table* file_methods() {
+	static Table* t = [] {
+		Table* methods = new Table();
+
+		methods->set(Value("read"), &file_read);
+		methods->set(Value("write"), &file_write);
+		methods->set(Value("lines"), &file_lines);
+		methods->set(Value("flush"), &file_flush);
+		methods->set(Value("close"), &file_close);
+
+		return methods;
+	}();
+	return t;
 }
 
+static File* new_file(std::FILE* f, bool owned, OutputBuffer* out = nullptr) {
+	File* file = new File(f, owned, out);
+	file->methods = file_methods();
+	return file;
+}
 
-static Table* default_io() {
-	Table* t = new Table();
+static File* standard_input() {
+	static File* file = [] {
+		File* in = new_file(stdin, false);
+		in->tie(&output());
+		return in;
+	}();
+	return file;
+}
 
-	t->set(Value("read"),  &io_read);
+static File* standard_output() {
+	static File* file = new_file(stdout, false, &output());
+	return file;
+}
 
-	return t;
+static File* standard_error() {
+	static File* file = new_file(stderr, false);
+	return file;
 }
 
-static Table* default_math() {
+static Table* default_io() {
 	Table* t = new Table();
 
-	t->set(Value("sqrt"), &math_sqrt);
+	t->set(Value("open"), &io_open);
+	t->set(Value("close"), &io_close);
+	t->set(Value("read"), &io_read);
+	t->set(Value("write"), &io_write);
+	t->set(Value("lines"), &io_lines);
+	t->set(Value("flush"), &io_flush);
+	t->set(Value("stdin"), standard_input());
+	t->set(Value("stdout"), standard_output());
+	t->set(Value("stderr"), standard_error());
 
 	return t;
 }
 
+// after the math functions, to register their typed versions
+static Table* default_math();
+
 static Table* default_table() {
 	Table* t = new Table();
 
 	t->set(Value("insert"), &table_insert);
+	t->set(Value("remove"), &table_remove);
+	t->set(Value("sort"), &table_sort);
+	t->set(Value("concat"), &table_concat);
+	t->set(Value("unpack"), &table_unpack);
+	t->set(Value("move"), &table_move);
 
 	return t;
 }
 
+Table* string_library() {
+	static Table* t = [] {
+		Table* lib = new Table();
+
+		lib->set(Value("len"), &string_len);
+		lib->set(Value("sub"), &string_sub);
+		lib->set(Value("byte"), &string_byte);
+		lib->set(Value("char"), &string_char);
+		lib->set(Value("rep"), &string_rep);
+		lib->set(Value("reverse"), &string_reverse);
+		lib->set(Value("upper"), &string_upper);
+		lib->set(Value("lower"), &string_lower);
+		lib->set(Value("find"), &string_find);
+		lib->set(Value("match"), &string_match);
+		lib->set(Value("gmatch"), &string_gmatch);
+		lib->set(Value("gsub"), &string_gsub);
+		lib->set(Value("format"), &string_format);
+
+		return lib;
+	}();
+	return t;
+}
+
 static Table* default_os() {
 	Table* t = new Table();
 
@@ -98,12 +170,14 @@ Table default_env() {
 
 	env.set(Value("print"), &print);
 	env.set(Value("tonumber"), &to_number);
+	env.set(Value("tostring"), &to_string);
 	env.set(Value("pairs"), &pairs);
 	env.set(Value("ipairs"), &ipairs);
 
 	env.set(Value("math"), default_math());
 	env.set(Value("io"), default_io());
 	env.set(Value("table"), default_table());
+	env.set(Value("string"), string_library());
 	env.set(Value("os"), default_os());
 
 	return env;
@@ -116,56 +190,153 @@ void print(const Value& v) {
 
 
 
+OutputBuffer& output() {
+	static OutputBuffer out(stdout);
+	return out;
+}
+
 u32 print(MutableSpan<Value>, Span<Value> in) {
+	OutputBuffer& out = output();
 	for(const Value& v : in) {
-		switch(v.type) {
-			case ValueType::None:
-				std::printf("nil ");
-			break;
+		out.write(v);
+		out.write(' ');
+	}
+	out.write('\n');
 
-			// See https://stackoverflow.com/questions/277772/avoid-trailing-zeroes-in-printf
-			case ValueType::Number: {
-				double f = v.number;
-				//std::printf("%lf ", f);
-				using ll = long long;
-				char buffer[64];
-				int max_decimals = 10;
-				double positive = std::abs(f);
-				double order = std::pow(10, max_decimals);
-				double frac = positive - ll(positive);
-				assert(frac >= 0.0 && frac < 1.0);
-				std::sprintf(buffer,"%.*g", max_decimals, std::ceil(order * frac) / order);
-				std::printf(f < 0.0 ? "-%lld%s " : "%lld%s ", ll(positive), buffer + 1);
-			} break;
+	return 0;
+}
 
-			case ValueType::Bool:
-				std::printf(v.integer ? "true " : "false ");
-			break;
+u32 pairs(MutableSpan<Value> out, Span<Value> in) {
+	check_params(1, in);
 
-			case ValueType::String:
-				std::printf("%s ", v.string().data());
-			break;
+	FunctionPtr iterate = [](MutableSpan<Value> it_out, Span<Value> it_in) -> u32 {
+		check_params(2, it_in);
+		check_type(it_in[0], ValueType::Table);
 
-			default:
-				std::printf("%s: %p ", v.type_str(), v.ptr);
+		auto [key, value] = it_in[0].table().next(it_in[1]);
+		if(key.type == ValueType::None) {
+			return build_out(it_out, Value());
 		}
+
+		return build_out(it_out, key, value);
+	};
+
+	return build_out(out, iterate, in[0], Value());
+}
+
+u32 ipairs(MutableSpan<Value> out, Span<Value> in) {
+	check_params(1, in);
+
+	FunctionPtr iterate = [](MutableSpan<Value> it_out, Span<Value> it_in) -> u32 {
+		check_params(2, it_in);
+		check_type(it_in[0], ValueType::Table);
+		check_type(it_in[1], ValueType::Number);
+
+		Table& table = it_in[0].table();
+		i64 index = 0;
+		if(!it_in[1].to_integer(index)) {
+			return build_out(it_out, Value());
+		}
+		Value next = Value::from_integer(index + 1);
+		Value v = table.get(next);
+		if(v.type == ValueType::None) {
+			return build_out(it_out, Value());
+		}
+		return build_out(it_out, next, v);
+	};
+
+	return build_out(out, iterate, in[0], Value::from_integer(0));
+}
+
+// numbers are accepted where strings are expected, like in Lua
+static const String& to_string_arg(const Value& v) {
+	if(v.type == ValueType::Number) {
+		char buffer[32];
+		return *String::create(std::string_view(buffer, number_to_string(v, buffer)));
 	}
-	std::printf("\n");
+	check_type(v, ValueType::String);
+	return v.string();
+}
 
-	return 0;
+// and strings where numbers are expected
+static Value to_number_arg(const Value& v) {
+	Value number;
+	if(v.type == ValueType::String && string_to_number(v.string().view(), number)) {
+		return number;
+	}
+	check_type(v, ValueType::Number);
+	return v;
+}
+
+static i64 to_integer_arg(const Value& v) {
+	i64 i = 0;
+	if(!to_number_arg(v).to_integer(i)) {
+		throw ExecutionException("Number has no integer representation");
+	}
+	return i;
+}
+
+static const String& string_arg(Span<Value> in, usize index) {
+	if(index >= in.size()) {
+		throw InvalidArgCountException(u32(index + 1), u32(in.size()));
+	}
+	return to_string_arg(in[index]);
+}
+
+static i64 integer_arg(Span<Value> in, usize index, i64 def) {
+	if(index >= in.size() || in[index].type == ValueType::None) {
+		return def;
+	}
+	return to_integer_arg(in[index]);
+}
+
+// with a base only integers are read, digits past 9 are letters in either case and overflows wrap around
+static Value to_number_base(const Value& v, i64 base) {
+	check_type(v, ValueType::String);
+	if(base < 2 || base > 36) {
+		throw ExecutionException("Base out of range");
+	}
+
+	const std::string_view str = v.string().view();
+	auto skip_spaces = [&](usize i) {
+		while(i != str.size() && std::isspace(u8(str[i]))) {
+			++i;
+		}
+		return i;
+	};
+
+	usize i = skip_spaces(0);
+	const bool negative = i != str.size() && str[i] == '-';
+	if(i != str.size() && (str[i] == '-' || str[i] == '+')) {
+		++i;
+	}
+	const usize first_digit = i;
+	u64 n = 0;
+	for(; i != str.size() && std::isalnum(u8(str[i])); ++i) {
+		const int c = u8(str[i]);
+		const i64 digit = std::isdigit(c) ? c - '0' : std::toupper(c) - 'A' + 10;
+		if(digit >= base) {
+			return Value();
+		}
+		n = n * u64(base) + u64(digit);
+	}
+	if(i == first_digit || skip_spaces(i) != str.size()) {
+		return Value();
+	}
+	return Value::from_integer(i64(negative ? 0 - n : n));
 }
 
 u32 to_number(MutableSpan<Value> out, Span<Value> in) {
-	check_params(1, in);
+	if(in.size() == 2 && in[1].type != ValueType::None) {
+		return build_out(out, to_number_base(in[0], to_integer_arg(in[1])));
+	}
+	// tonumber(v, nil) is tonumber(v)
+	check_params(1, in.size() == 2 ? 1 : in.size());
 
 	if(in[0].type == ValueType::String) {
-		const char* str = in[0].string().c_str();
-		char* end = nullptr;
-		double d = std::strtod(str, &end);
-		if(end == str) {
-			return build_out(out, Value());
-		}
-		return build_out(out, d);
+		Value number;
+		string_to_number(in[0].string().view(), number);
+		return build_out(out, number);
 	}
 	if(in[0].type == ValueType::Number) {
 		return build_out(out, in[0]);
@@ -174,84 +345,1213 @@ u32 to_number(MutableSpan<Value> out, Span<Value> in) {
 
 }
 
-u32 pairs(MutableSpan<Value> out, Span<Value> in) {
-	check_params(1, in);
+// negative positions count from the end of the string
+static i64 string_position(i64 pos, usize size) {
+	if(pos >= 0) {
+		return pos;
+	}
+	if(usize(-(pos + 1)) >= size) {
+		return 0;
+	}
+	return i64(size) + pos + 1;
+}
+
+static void append_value(std::string& str, const Value& v) {
+	if(v.type == ValueType::Number) {
+		char buffer[32];
+		str.append(buffer, number_to_string(v, buffer));
+	} else {
+		check_type(v, ValueType::String);
+		str.append(v.string().view());
+	}
+}
+
+template<typename F>
+static Value map_chars(const String& str, F&& f) {
+	return String::build(str.size(), [&](char* data) {
+		std::transform(str.data(), str.data() + str.size(), data, [&](char c) { return char(f(u8(c))); });
+	});
+}
+
+u32 string_len(MutableSpan<Value> out, Span<Value> in) {
+	return build_out(out, Value::from_integer(i64(string_arg(in, 0).size())));
+}
+
+u32 string_sub(MutableSpan<Value> out, Span<Value> in) {
+	const String& str = string_arg(in, 0);
+	i64 size = i64(str.size());
+	i64 begin = std::max(string_position(integer_arg(in, 1, 1), str.size()), i64(1));
+	i64 end = std::min(string_position(integer_arg(in, 2, -1), str.size()), size);
+	if(begin > end) {
+		return build_out(out, Value(std::string_view()));
+	}
+	return build_out(out, Value(str.view().substr(usize(begin - 1), usize(end - begin + 1))));
+}
+
+u32 string_byte(MutableSpan<Value> out, Span<Value> in) {
+	const String& str = string_arg(in, 0);
+	i64 begin = std::max(string_position(integer_arg(in, 1, 1), str.size()), i64(1));
+	i64 end = std::min(string_position(integer_arg(in, 2, begin), str.size()), i64(str.size()));
+	u32 count = 0;
+	for(i64 i = begin; i <= end && count != out.size(); ++i) {
+		out[count++] = Value::from_integer(u8(str.data()[i - 1]));
+	}
+	return count;
+}
+
+u32 string_char(MutableSpan<Value> out, Span<Value> in) {
+	return build_out(out, String::build(in.size(), [&](char* data) {
+		for(usize i = 0; i != in.size(); ++i) {
+			i64 c = to_integer_arg(in[i]);
+			if(c < 0 || c > 255) {
+				throw ExecutionException("Value out of range");
+			}
+			data[i] = char(c);
+		}
+	}));
+}
+
+u32 string_rep(MutableSpan<Value> out, Span<Value> in) {
+	const String& str = string_arg(in, 0);
+	i64 count = integer_arg(in, 1, 0);
+	std::string_view sep = in.size() > 2 ? string_arg(in, 2).view() : std::string_view();
+	if(count <= 0) {
+		return build_out(out, Value(std::string_view()));
+	}
+
+	const usize part = str.size() + sep.size();
+	if(part && usize(count) > std::numeric_limits<u32>::max() / part) {
+		throw ExecutionException("Resulting string too large");
+	}
+	return build_out(out, String::build(part * usize(count) - sep.size(), [&](char* data) {
+		for(i64 i = 0; i != count; ++i) {
+			data = std::copy_n(str.data(), str.size(), data);
+			if(i + 1 != count) {
+				data = std::copy_n(sep.data(), sep.size(), data);
+			}
+		}
+	}));
+}
+
+u32 string_reverse(MutableSpan<Value> out, Span<Value> in) {
+	const String& str = string_arg(in, 0);
+	return build_out(out, String::build(str.size(), [&](char* data) {
+		std::reverse_copy(str.data(), str.data() + str.size(), data);
+	}));
+}
+
+u32 string_upper(MutableSpan<Value> out, Span<Value> in) {
+	return build_out(out, map_chars(string_arg(in, 0), [](int c) { return std::toupper(c); }));
+}
+
+u32 string_lower(MutableSpan<Value> out, Span<Value> in) {
+	return build_out(out, map_chars(string_arg(in, 0), [](int c) { return std::tolower(c); }));
+}
+
+static Value capture_value(const PatternMatcher& matcher, u32 index, const char* begin, const char* end) {
+	PatternMatcher::Capture cap = matcher.capture(index, begin, end);
+	if(cap.size == PatternMatcher::position) {
+		return Value::from_integer(cap.begin - matcher.source_begin() + 1);
+	}
+	return Value(std::string_view(cap.begin, usize(cap.size)));
+}
+
+// find only returns the explicit captures, match returns the whole match if there are none
+static u32 push_captures(const PatternMatcher& matcher, const char* begin, const char* end, MutableSpan<Value> out, bool whole) {
+	u32 count = matcher.capture_count() || !whole ? matcher.capture_count() : 1;
+	u32 pushed = 0;
+	for(; pushed != count && pushed != out.size(); ++pushed) {
+		out[pushed] = capture_value(matcher, pushed, begin, end);
+	}
+	return pushed;
+}
+
+static u32 find(MutableSpan<Value> out, Span<Value> in, bool find) {
+	const String& str = string_arg(in, 0);
+	const String& pattern = string_arg(in, 1);
+	i64 init = std::max(string_position(integer_arg(in, 2, 1), str.size()), i64(1));
+	if(init > i64(str.size()) + 1) {
+		return build_out(out, Value());
+	}
+
+	const char* from = str.data() + init - 1;
+	const char* str_end = str.data() + str.size();
+	if(find && ((in.size() > 3 && in[3].to_bool()) || PatternMatcher::is_plain(pattern.view()))) {
+		const char* begin = find_plain(from, str_end, pattern.view());
+		if(begin == str_end && pattern.size()) {
+			return build_out(out, Value());
+		}
+		i64 offset = begin - str.data();
+		return build_out(out, Value::from_integer(offset + 1), Value::from_integer(offset + i64(pattern.size())));
+	}
+
+	PatternMatcher matcher(str, pattern);
+	const char* begin = nullptr;
+	const char* end = matcher.find(from, begin);
+	if(!end) {
+		return build_out(out, Value());
+	}
+	if(!find) {
+		return push_captures(matcher, begin, end, out, true);
+	}
+	u32 count = build_out(out, Value::from_integer(begin - str.data() + 1), Value::from_integer(end - str.data()));
+	if(count == 2) {
+		count += push_captures(matcher, begin, end, MutableSpan<Value>(out.data() + 2, out.size() - 2), false);
+	}
+	return count;
+}
+
+u32 string_find(MutableSpan<Value> out, Span<Value> in) {
+	return find(out, in, true);
+}
+
+u32 string_match(MutableSpan<Value> out, Span<Value> in) {
+	return find(out, in, false);
+}
+
+// the iterator state is a table holding the string, the pattern, the next position and the end of the last match
+u32 string_gmatch(MutableSpan<Value> out, Span<Value> in) {
+	Table* state = new Table();
+	state->set(Value::from_integer(1), &string_arg(in, 0));
+	state->set(Value::from_integer(2), &string_arg(in, 1));
+	state->set(Value::from_integer(3), Value::from_integer(0));
+	state->set(Value::from_integer(4), Value::from_integer(-1));
 
 	FunctionPtr iterate = [](MutableSpan<Value> it_out, Span<Value> it_in) -> u32 {
-		check_params(2, it_in);
 		check_type(it_in[0], ValueType::Table);
+		Table& it_state = it_in[0].table();
+		Value str = it_state.get(Value::from_integer(1));
+		Value pattern = it_state.get(Value::from_integer(2));
+		i64 position = 0;
+		i64 last_match = 0;
+		it_state.get(Value::from_integer(3)).to_integer(position);
+		it_state.get(Value::from_integer(4)).to_integer(last_match);
+
+		PatternMatcher matcher(str.string(), pattern.string());
+		const char* data = matcher.source_begin();
+		for(const char* from = data + position; from <= matcher.source_end();) {
+			const char* begin = nullptr;
+			const char* end = matcher.find(from, begin);
+			if(!end) {
+				break;
+			}
+			// an empty match right after the previous one doesn't count
+			if(end - data == last_match) {
+				from = begin + 1;
+				continue;
+			}
+			it_state.set(Value::from_integer(3), Value::from_integer(end - data));
+			it_state.set(Value::from_integer(4), Value::from_integer(end - data));
+			return push_captures(matcher, begin, end, it_out, true);
+		}
+		it_state.set(Value::from_integer(3), Value::from_integer(matcher.source_end() - data + 1));
+		return build_out(it_out, Value());
+	};
 
-		Table& table = it_in[0].table();
-		auto it = it_in[1].type == ValueType::None
-			? table.begin()
-			: std::next(table.find(it_in[1]));
+	return build_out(out, iterate, state, Value());
+}
 
-		if(it == table.end()) {
-			return build_out(it_out, Value());
+static void add_replacement(std::string& result, const PatternMatcher& matcher, const char* begin, const char* end, const Value& repl) {
+	switch(repl.type) {
+		case ValueType::String:
+		case ValueType::Number: {
+			if(repl.type == ValueType::Number) {
+				append_value(result, repl);
+				break;
+			}
+			std::string_view str = repl.string().view();
+			for(usize i = 0; i < str.size(); ++i) {
+				if(str[i] != '%') {
+					result.push_back(str[i]);
+					continue;
+				}
+				if(++i == str.size()) {
+					throw ExecutionException("Invalid use of '%' in replacement string");
+				}
+				if(str[i] == '%') {
+					result.push_back('%');
+				} else if(std::isdigit(u8(str[i]))) {
+					u32 index = str[i] == '0' ? 0 : u32(str[i] - '1');
+					Value cap = str[i] == '0' ? Value(std::string_view(begin, usize(end - begin))) : capture_value(matcher, index, begin, end);
+					append_value(result, cap);
+				} else {
+					throw ExecutionException("Invalid use of '%' in replacement string");
+				}
+			}
+		} break;
+
+		case ValueType::Table:
+		case ValueType::ExternalFunction:
+		case ValueType::FastFunction:
+		case ValueType::Closure: {
+			Value key = capture_value(matcher, 0, begin, end);
+			Value value;
+			if(repl.type == ValueType::Table) {
+				value = repl.table().get(key);
+			} else {
+				// Lua functions run in the VM that called gsub, like table.sort's comparators
+				Value args[PatternMatcher::max_captures];
+				u32 count = push_captures(matcher, begin, end, args, true);
+				VM::current()->call(repl, Span<Value>(args, count), MutableSpan<Value>(value));
+			}
+			// nil and false keep the original text
+			if(!value.to_bool()) {
+				result.append(begin, end);
+			} else {
+				append_value(result, value);
+			}
+		} break;
+
+		default:
+			throw ExecutionException("gsub replacements must be strings, tables or functions");
+	}
+}
+
+u32 string_gsub(MutableSpan<Value> out, Span<Value> in) {
+	const String& str = string_arg(in, 0);
+	const String& pattern = string_arg(in, 1);
+	if(in.size() < 3) {
+		throw InvalidArgCountException(3, u32(in.size()));
+	}
+	const Value& repl = in[2];
+	i64 max = integer_arg(in, 3, i64(str.size()) + 1);
+
+	PatternMatcher matcher(str, pattern);
+	std::string result;
+	result.reserve(str.size());
+
+	const char* from = str.data();
+	const char* str_end = str.data() + str.size();
+	const char* last_match = nullptr;
+	i64 count = 0;
+	while(count < max) {
+		const char* begin = nullptr;
+		const char* end = matcher.find(from, begin);
+		if(!end) {
+			break;
 		}
+		if(end == last_match) {
+			// empty match right after the previous one, keep one char and go on
+			if(begin == str_end) {
+				break;
+			}
+			result.append(from, begin + 1);
+			from = begin + 1;
+		} else {
+			result.append(from, begin);
+			add_replacement(result, matcher, begin, end, repl);
+			from = last_match = end;
+			++count;
+		}
+		if(matcher.is_anchored()) {
+			break;
+		}
+	}
+	result.append(from, str_end);
 
-		return build_out(it_out, it->first, it->second);
-	};
+	return build_out(out, Value(std::string_view(result)), Value::from_integer(count));
+}
 
-	return build_out(out, iterate, in[0], Value());
+// same as tostring for the types print knows
+static void append_string(std::string& str, const Value& v) {
+	switch(v.type) {
+		case ValueType::None:
+			str.append("nil");
+		break;
+		case ValueType::Bool:
+			str.append(v.integer ? "true" : "false");
+		break;
+		case ValueType::Number:
+		case ValueType::String:
+			append_value(str, v);
+		break;
+		default: {
+			char buffer[64];
+			str.append(buffer, usize(std::snprintf(buffer, sizeof(buffer), "%s: %p", v.type_str(), v.ptr)));
+		}
+	}
 }
 
-u32 ipairs(MutableSpan<Value> out, Span<Value> in) {
+u32 to_string(MutableSpan<Value> out, Span<Value> in) {
 	check_params(1, in);
 
+	const Value& v = in[0];
+	if(v.type == ValueType::String) {
+		return build_out(out, v);
+	}
+	if(v.type == ValueType::Number) {
+		char buffer[32];
+		return build_out(out, Value(std::string_view(buffer, number_to_string(v, buffer))));
+	}
+	std::string str;
+	append_string(str, v);
+	return build_out(out, Value(std::string_view(str)));
+}
+
+static void append_quoted(std::string& str, std::string_view value) {
+	str.push_back('"');
+	for(usize i = 0; i != value.size(); ++i) {
+		char c = value[i];
+		if(c == '"' || c == '\\' || c == '\n') {
+			str.push_back('\\');
+			str.push_back(c);
+		} else if(c == '\r') {
+			str.append("\\r");
+		} else if(!c || std::iscntrl(u8(c))) {
+			char buffer[8];
+			bool digit_next = i + 1 != value.size() && std::isdigit(u8(value[i + 1]));
+			str.append(buffer, usize(std::snprintf(buffer, sizeof(buffer), digit_next ? "\\%03d" : "\\%d", u8(c))));
+		} else {
+			str.push_back(c);
+		}
+	}
+	str.push_back('"');
+}
+
+u32 string_format(MutableSpan<Value> out, Span<Value> in) {
+	std::string_view format = string_arg(in, 0).view();
+	std::string result;
+	usize arg = 1;
+
+	auto next_arg = [&]() -> const Value& {
+		if(arg >= in.size()) {
+			throw ExecutionException("Bad argument to format (no value)");
+		}
+		return in[arg++];
+	};
+
+	for(usize i = 0; i < format.size(); ++i) {
+		if(format[i] != '%') {
+			result.push_back(format[i]);
+			continue;
+		}
+		if(++i == format.size()) {
+			throw ExecutionException("Invalid conversion to format");
+		}
+		if(format[i] == '%') {
+			result.push_back('%');
+			continue;
+		}
+
+		// flags, width and precision are passed to snprintf as is
+		usize spec_begin = i;
+		while(i < format.size() && std::strchr("-+ #0", format[i])) {
+			++i;
+		}
+		for(u32 digits = 0; i < format.size() && std::isdigit(u8(format[i])) && digits != 2; ++digits) {
+			++i;
+		}
+		if(i < format.size() && format[i] == '.') {
+			++i;
+			for(u32 digits = 0; i < format.size() && std::isdigit(u8(format[i])) && digits != 2; ++digits) {
+				++i;
+			}
+		}
+		if(i == format.size() || i - spec_begin > 16) {
+			throw ExecutionException("Invalid conversion to format");
+		}
+
+		char spec[32] = "%";
+		std::copy(format.begin() + spec_begin, format.begin() + i, spec + 1);
+		usize spec_size = i - spec_begin + 1;
+
+		char buffer[512];
+		int len = 0;
+		switch(format[i]) {
+			case 'c':
+				result.push_back(char(to_integer_arg(next_arg())));
+			continue;
+
+			case 'd':
+			case 'i':
+			case 'o':
+			case 'u':
+			case 'x':
+			case 'X': {
+				i64 value = to_integer_arg(next_arg());
+				spec[spec_size++] = 'l';
+				spec[spec_size++] = 'l';
+				spec[spec_size++] = format[i] == 'i' || format[i] == 'u' ? 'd' : format[i];
+				spec[spec_size] = 0;
+				len = std::snprintf(buffer, sizeof(buffer), spec, static_cast<long long>(value));
+			} break;
+
+			case 'a':
+			case 'A':
+			case 'e':
+			case 'E':
+			case 'f':
+			case 'F':
+			case 'g':
+			case 'G': {
+				double value = 0.0;
+				to_number_arg(next_arg()).to_double(value);
+				spec[spec_size++] = format[i];
+				spec[spec_size] = 0;
+				len = std::snprintf(buffer, sizeof(buffer), spec, value);
+			} break;
+
+			case 'q':
+				append_quoted(result, to_string_arg(next_arg()).view());
+			continue;
+
+			case 's': {
+				std::string str;
+				append_string(str, next_arg());
+				if(spec_size == 1) {
+					result.append(str);
+					continue;
+				}
+				spec[spec_size++] = 's';
+				spec[spec_size] = 0;
+				len = std::snprintf(buffer, sizeof(buffer), spec, str.c_str());
+			} break;
+
+			default:
+				throw ExecutionException("Invalid conversion to format");
+		}
+		result.append(buffer, usize(std::clamp(len, 0, int(sizeof(buffer) - 1))));
+	}
+
+	return build_out(out, Value(std::string_view(result)));
+}
+
+static File& file_arg(Span<Value> in, usize index) {
+	if(index >= in.size()) {
+		throw InvalidArgCountException(u32(index + 1), u32(in.size()));
+	}
+	check_type(in[index], ValueType::Userdata);
+	File* file = dynamic_cast<File*>(&in[index].userdata());
+	if(!file) {
+		throw ExecutionException("File expected");
+	}
+	if(file->is_closed()) {
+		throw ExecutionException("Attempt to use a closed file");
+	}
+	return *file;
+}
+
+// reading stops at the first format that fails, which returns nil
+static u32 read_formats(File& file, MutableSpan<Value> out, Span<Value> formats) {
+	if(formats.is_empty()) {
+		return build_out(out, file.read_line(false));
+	}
+
+	u32 count = 0;
+	for(const Value& format : formats) {
+		Value value;
+		if(format.type == ValueType::Number) {
+			value = file.read_bytes(usize(std::max(to_integer_arg(format), i64(0))));
+		} else {
+			std::string_view f = to_string_arg(format).view();
+			// Lua 5.3 still accepts the Lua 5.1 formats
+			if(!f.empty() && f[0] == '*') {
+				f.remove_prefix(1);
+			}
+			switch(f.empty() ? 0 : f[0]) {
+				case 'l': value = file.read_line(false); break;
+				case 'L': value = file.read_line(true); break;
+				case 'n': value = file.read_number(); break;
+				case 'a': value = file.read_all(); break;
+				default:
+					throw ExecutionException("Invalid format");
+			}
+		}
+		if(count == out.size()) {
+			break;
+		}
+		out[count++] = value;
+		if(value.type == ValueType::None) {
+			break;
+		}
+	}
+	return count;
+}
+
+static void write_values(File& file, Span<Value> values) {
+	OutputBuffer& out = file.output();
+	for(const Value& v : values) {
+		if(v.type == ValueType::Number) {
+			out.write_number(v);
+		} else {
+			out.write(to_string_arg(v).view());
+		}
+	}
+	// stderr isn't buffered, like in C
+	if(&file == standard_error()) {
+		file.flush();
+	}
+}
+
+// the iterator state is a table holding the file, whether to close it at the end and the formats
+static u32 lines(File* file, bool close, MutableSpan<Value> out, Span<Value> formats) {
+	Table* state = new Table();
+	state->set(Value::from_integer(1), file);
+	state->set(Value::from_integer(2), Value::from_bool(close));
+	for(usize i = 0; i != formats.size(); ++i) {
+		state->set(Value::from_integer(i64(i) + 3), formats[i]);
+	}
+
 	FunctionPtr iterate = [](MutableSpan<Value> it_out, Span<Value> it_in) -> u32 {
-		check_params(2, it_in);
 		check_type(it_in[0], ValueType::Table);
-		check_type(it_in[1], ValueType::Number);
-
-		Table& table = it_in[0].table();
-		double next = it_in[1].number + 1.0;
+		Table& it_state = it_in[0].table();
+		Value file_value = it_state.get(Value::from_integer(1));
+		File& it_file = file_arg(file_value, 0);
 
-		if(next >= table.size()) {
-			return build_out(it_out, Value());
+		std::vector<Value> it_formats;
+		for(Value f; (f = it_state.get(Value::from_integer(i64(it_formats.size()) + 3))).type != ValueType::None;) {
+			it_formats.push_back(f);
 		}
 
-		Value v = table.get(next);
-		if(v.type == ValueType::None) {
-			return build_out(it_out, Value());
+		u32 count = read_formats(it_file, it_out, Span<Value>(it_formats.data(), it_formats.size()));
+		if((!count || it_out[0].type == ValueType::None) && it_state.get(Value::from_integer(2)).to_bool()) {
+			it_file.close();
 		}
-		return build_out(it_out, next, v);
+		return count;
 	};
 
-	return build_out(out, iterate, in[0], 0);
+	return build_out(out, iterate, state, Value());
 }
 
-u32 math_sqrt(MutableSpan<Value> out, Span<Value> in) {
-	check_params(1, in);
-	check_type(in[0], ValueType::Number);
+static bool is_valid_mode(std::string_view mode) {
+	if(mode.empty() || (mode[0] != 'r' && mode[0] != 'w' && mode[0] != 'a')) {
+		return false;
+	}
+	mode.remove_prefix(1);
+	if(!mode.empty() && mode[0] == '+') {
+		mode.remove_prefix(1);
+	}
+	return mode.find_first_not_of('b') == std::string_view::npos;
+}
 
-	return build_out(out, std::sqrt(in[0].number));
+u32 io_open(MutableSpan<Value> out, Span<Value> in) {
+	const String& filename = string_arg(in, 0);
+	const char* mode = in.size() > 1 ? string_arg(in, 1).data() : "r";
+	if(!is_valid_mode(mode)) {
+		throw ExecutionException("Invalid mode");
+	}
+
+	std::FILE* f = std::fopen(filename.data(), mode);
+	if(!f) {
+		int error = errno;
+		std::string message(filename.view());
+		message.append(": ").append(std::strerror(error));
+		return build_out(out, Value(), Value(std::string_view(message)), Value::from_integer(error));
+	}
+	return build_out(out, new_file(f, true));
+}
+
+u32 io_close(MutableSpan<Value> out, Span<Value> in) {
+	if(in.is_empty()) {
+		Value file = standard_output();
+		return file_close(out, file);
+	}
+	return file_close(out, in);
 }
 
 u32 io_read(MutableSpan<Value> out, Span<Value> in) {
-	if(in.size()) {
-		if(in.size() != 1 || in[0].type != ValueType::String || in[0].string() != "*number") {
-			print(in[0]);
-			fatal("Unsupported");
-		}
+	return read_formats(*standard_input(), out, in);
+}
+
+u32 io_write(MutableSpan<Value> out, Span<Value> in) {
+	write_values(*standard_output(), in);
+	return build_out(out, standard_output());
+}
+
+u32 io_lines(MutableSpan<Value> out, Span<Value> in) {
+	if(in.is_empty() || in[0].type == ValueType::None) {
+		return lines(standard_input(), false, out, {});
 	}
 
+	const String& filename = string_arg(in, 0);
+	std::FILE* f = std::fopen(filename.data(), "r");
+	if(!f) {
+		throw ExecutionException("Unable to open file");
+	}
+	return lines(new_file(f, true), true, out, Span<Value>(in.begin() + 1, in.size() - 1));
+}
+
+u32 io_flush(MutableSpan<Value>, Span<Value> in) {
+	check_params(0, in);
+	standard_output()->flush();
+	return 0;
+}
+
+u32 file_read(MutableSpan<Value> out, Span<Value> in) {
+	File& file = file_arg(in, 0);
+	return read_formats(file, out, Span<Value>(in.begin() + 1, in.size() - 1));
+}
+
+u32 file_write(MutableSpan<Value> out, Span<Value> in) {
+	File& file = file_arg(in, 0);
+	write_values(file, Span<Value>(in.begin() + 1, in.size() - 1));
+	return build_out(out, in[0]);
+}
+
+u32 file_lines(MutableSpan<Value> out, Span<Value> in) {
+	File& file = file_arg(in, 0);
+	return lines(&file, false, out, Span<Value>(in.begin() + 1, in.size() - 1));
+}
+
+u32 file_flush(MutableSpan<Value>, Span<Value> in) {
+	file_arg(in, 0).flush();
+	return 0;
+}
+
+u32 file_close(MutableSpan<Value> out, Span<Value> in) {
+	File& file = file_arg(in, 0);
+	if(!file.is_owned()) {
+		file.flush();
+		return build_out(out, Value(), Value("cannot close standard file"));
+	}
+	return build_out(out, Value::from_bool(file.close()));
+}
+
+static double to_float_arg(const Value& v) {
 	double d = 0.0;
-	std::scanf("%lf", &d);
+	to_number_arg(v).to_double(d);
+	return d;
+}
 
-	return build_out(out, d);
+// strings are converted to floats, like luaL_checknumber
+static Value number_arg(const Value& v) {
+	return v.type == ValueType::Number ? v : Value(to_float_arg(v));
 }
 
-u32 table_insert(MutableSpan<Value>, Span<Value> in) {
+static bool is_integer(const Value& v) {
+	return v.subtype == NumberType::Integer;
+}
+
+// floats that fit are converted to integers, like the results of math.floor and math.ceil
+static Value float_to_value(double f) {
+	i64 i = 0;
+	return float_to_integer(f, i) ? Value::from_integer(i) : Value(f);
+}
+
+// typed versions of the math functions, registered with fast_function or fast_native so that the interpreter can call them directly
+namespace typed {
+static double sqrt(double x) { return std::sqrt(x); }
+static double exp(double x) { return std::exp(x); }
+static double log(double x) { return std::log(x); }
+static double sin(double x) { return std::sin(x); }
+static double cos(double x) { return std::cos(x); }
+static double tan(double x) { return std::tan(x); }
+static double asin(double x) { return std::asin(x); }
+static double acos(double x) { return std::acos(x); }
+static double atan(double x) { return std::atan(x); }
+static double deg(double x) { return x * (180.0 / pi); }
+static double rad(double x) { return x * (pi / 180.0); }
+
+static Number abs(Number n) {
+	const Value& v = n.value;
+	if(is_integer(v)) {
+		return {Value::from_integer(v.integer < 0 ? i64(0 - u64(v.integer)) : v.integer)};
+	}
+	return {std::fabs(v.number)};
+}
+
+static Number floor(Number n) {
+	return is_integer(n.value) ? n : Number{float_to_value(std::floor(n.value.number))};
+}
+
+static Number ceil(Number n) {
+	return is_integer(n.value) ? n : Number{float_to_value(std::ceil(n.value.number))};
+}
+
+// only compares as floats or as integers until both subtypes are seen
+static bool less(const Value& a, const Value& b) {
+	if(a.subtype == b.subtype) {
+		return is_integer(a) ? a.integer < b.integer : a.number < b.number;
+	}
+	return a < b;
+}
+
+static Number min(Number a, Number b) {
+	return less(b.value, a.value) ? b : a;
+}
+
+static Number max(Number a, Number b) {
+	return less(a.value, b.value) ? b : a;
+}
+
+// integers use C's truncated modulo, unlike the % operator
+static Number fmod(Number a, Number b) {
+	if(is_integer(a.value) && is_integer(b.value)) {
+		if(!b.value.integer) {
+			throw ExecutionException("Bad argument to fmod (zero)");
+		}
+		// -1 is a special case to avoid overflowing with the smallest integer
+		return {Value::from_integer(b.value.integer == -1 ? 0 : a.value.integer % b.value.integer)};
+	}
+	return {std::fmod(to_float_arg(a.value), to_float_arg(b.value))};
+}
+
+// strings are converted, but unlike for arguments non numbers are not an error
+static Value tointeger(Value v) {
+	Value number;
+	if(v.type == ValueType::String && string_to_number(v.string().view(), number)) {
+		v = number;
+	}
+	i64 i = 0;
+	return v.type == ValueType::Number && v.to_integer(i) ? Value::from_integer(i) : Value();
+}
+
+static bool ult(i64 a, i64 b) {
+	return u64(a) < u64(b);
+}
+
+static Value type(const Value& v) {
+	if(v.type != ValueType::Number) {
+		return Value();
+	}
+	return Value(is_integer(v) ? "integer" : "float");
+}
+}
+
+static u32 math_unary(MutableSpan<Value> out, Span<Value> in, double (*f)(double)) {
+	check_params(1, in);
+	return build_out(out, f(to_float_arg(in[0])));
+}
+
+static u32 math_unary(MutableSpan<Value> out, Span<Value> in, Number (*f)(Number)) {
+	check_params(1, in);
+	return build_out(out, f(Number{number_arg(in[0])}).value);
+}
+
+u32 math_abs(MutableSpan<Value> out, Span<Value> in) {
+	return math_unary(out, in, typed::abs);
+}
+
+u32 math_floor(MutableSpan<Value> out, Span<Value> in) {
+	return math_unary(out, in, typed::floor);
+}
+
+u32 math_ceil(MutableSpan<Value> out, Span<Value> in) {
+	return math_unary(out, in, typed::ceil);
+}
+
+// a single pass over all the arguments
+template<bool Max>
+static u32 math_min_max(MutableSpan<Value> out, Span<Value> in) {
+	if(in.is_empty()) {
+		throw ExecutionException("Number expected");
+	}
+	Number best{number_arg(in[0])};
+	for(usize i = 1; i != in.size(); ++i) {
+		const Number n{number_arg(in[i])};
+		best = Max ? typed::max(best, n) : typed::min(best, n);
+	}
+	return build_out(out, best.value);
+}
+
+u32 math_min(MutableSpan<Value> out, Span<Value> in) {
+	return math_min_max<false>(out, in);
+}
+
+u32 math_max(MutableSpan<Value> out, Span<Value> in) {
+	return math_min_max<true>(out, in);
+}
+
+u32 math_sqrt(MutableSpan<Value> out, Span<Value> in) {
+	return math_unary(out, in, typed::sqrt);
+}
+
+u32 math_exp(MutableSpan<Value> out, Span<Value> in) {
+	return math_unary(out, in, typed::exp);
+}
+
+u32 math_log(MutableSpan<Value> out, Span<Value> in) {
+	if(in.size() == 1) {
+		return math_unary(out, in, typed::log);
+	}
 	check_params(2, in);
+	const double x = to_float_arg(in[0]);
+	const double base = to_float_arg(in[1]);
+	if(base == 2.0) {
+		return build_out(out, std::log2(x));
+	}
+	if(base == 10.0) {
+		return build_out(out, std::log10(x));
+	}
+	return build_out(out, std::log(x) / std::log(base));
+}
+
+u32 math_sin(MutableSpan<Value> out, Span<Value> in) {
+	return math_unary(out, in, typed::sin);
+}
+
+u32 math_cos(MutableSpan<Value> out, Span<Value> in) {
+	return math_unary(out, in, typed::cos);
+}
+
+u32 math_tan(MutableSpan<Value> out, Span<Value> in) {
+	return math_unary(out, in, typed::tan);
+}
+
+u32 math_asin(MutableSpan<Value> out, Span<Value> in) {
+	return math_unary(out, in, typed::asin);
+}
+
+u32 math_acos(MutableSpan<Value> out, Span<Value> in) {
+	return math_unary(out, in, typed::acos);
+}
+
+u32 math_atan(MutableSpan<Value> out, Span<Value> in) {
+	if(in.size() == 1) {
+		return math_unary(out, in, typed::atan);
+	}
+	check_params(2, in);
+	return build_out(out, std::atan2(to_float_arg(in[0]), to_float_arg(in[1])));
+}
+
+u32 math_deg(MutableSpan<Value> out, Span<Value> in) {
+	return math_unary(out, in, typed::deg);
+}
+
+u32 math_rad(MutableSpan<Value> out, Span<Value> in) {
+	return math_unary(out, in, typed::rad);
+}
+
+u32 math_fmod(MutableSpan<Value> out, Span<Value> in) {
+	check_params(2, in);
+	return build_out(out, typed::fmod(Number{number_arg(in[0])}, Number{number_arg(in[1])}).value);
+}
+
+u32 math_modf(MutableSpan<Value> out, Span<Value> in) {
+	check_params(1, in);
+	const Value v = number_arg(in[0]);
+	if(is_integer(v)) {
+		return build_out(out, v, 0.0);
+	}
+	const double integral = v.number < 0.0 ? std::ceil(v.number) : std::floor(v.number);
+	return build_out(out, float_to_value(integral), v.number == integral ? 0.0 : v.number - integral);
+}
+
+// xoshiro256**, seeded like Lua 5.4 so that a seed gives the same sequence
+namespace rng {
+static u64 state[4] = {};
+
+static u64 rotate(u64 x, int n) {
+	return (x << n) | (x >> (64 - n));
+}
+
+static u64 next() {
+	const u64 result = rotate(state[1] * 5, 7) * 9;
+	const u64 t = state[1] << 17;
+	state[2] ^= state[0];
+	state[3] ^= state[1];
+	state[1] ^= state[2];
+	state[0] ^= state[3];
+	state[2] ^= t;
+	state[3] = rotate(state[3], 45);
+	return result;
+}
+
+static void seed(u64 n) {
+	state[0] = n;
+	state[1] = 0xff;
+	state[2] = 0;
+	state[3] = 0;
+	for(usize i = 0; i != 16; ++i) {
+		next();
+	}
+}
+
+// uniform integer in [0, n], by rejecting the values above the smallest 2^b - 1 >= n
+static u64 project(u64 n) {
+	if(!(n & (n + 1))) {
+		return next() & n;
+	}
+	u64 mask = n;
+	for(usize shift = 1; shift != 64; shift *= 2) {
+		mask |= mask >> shift;
+	}
+	u64 r = 0;
+	while((r = next() & mask) > n) {
+	}
+	return r;
+}
+
+// [0, 1) from the 53 high bits
+static double next_float() {
+	return double(next() >> 11) * (0.5 / (u64(1) << 52));
+}
+}
+
+u32 math_random(MutableSpan<Value> out, Span<Value> in) {
+	i64 low = 1;
+	i64 up = 0;
+	switch(in.size()) {
+		case 0:
+			return build_out(out, rng::next_float());
+		case 1:
+			up = to_integer_arg(in[0]);
+		break;
+		case 2:
+			low = to_integer_arg(in[0]);
+			up = to_integer_arg(in[1]);
+		break;
+		default:
+			throw InvalidArgCountException(2, u32(in.size()));
+	}
+	if(low > up) {
+		throw ExecutionException("Interval is empty");
+	}
+	return build_out(out, Value::from_integer(i64(rng::project(u64(up) - u64(low)) + u64(low))));
+}
+
+u32 math_randomseed(MutableSpan<Value>, Span<Value> in) {
+	check_params(1, in);
+	const Value v = to_number_arg(in[0]);
+	u64 n = u64(v.integer);
+	if(!is_integer(v)) {
+		std::memcpy(&n, &v.number, sizeof(n));
+	}
+	rng::seed(n);
+	return 0;
+}
+
+static Table* default_math() {
+	Table* t = new Table();
+
+	t->set(Value("abs"), fast_function<&math_abs, &typed::abs>());
+	t->set(Value("floor"), fast_function<&math_floor, &typed::floor>());
+	t->set(Value("ceil"), fast_function<&math_ceil, &typed::ceil>());
+	t->set(Value("min"), fast_function<&math_min, &typed::min>());
+	t->set(Value("max"), fast_function<&math_max, &typed::max>());
+	t->set(Value("sqrt"), fast_function<&math_sqrt, &typed::sqrt>());
+	t->set(Value("exp"), fast_function<&math_exp, &typed::exp>());
+	t->set(Value("log"), fast_function<&math_log, &typed::log>());
+	t->set(Value("sin"), fast_function<&math_sin, &typed::sin>());
+	t->set(Value("cos"), fast_function<&math_cos, &typed::cos>());
+	t->set(Value("tan"), fast_function<&math_tan, &typed::tan>());
+	t->set(Value("asin"), fast_function<&math_asin, &typed::asin>());
+	t->set(Value("acos"), fast_function<&math_acos, &typed::acos>());
+	t->set(Value("atan"), fast_function<&math_atan, &typed::atan>());
+	t->set(Value("deg"), fast_function<&math_deg, &typed::deg>());
+	t->set(Value("rad"), fast_function<&math_rad, &typed::rad>());
+	t->set(Value("fmod"), fast_function<&math_fmod, &typed::fmod>());
+	t->set(Value("modf"), &math_modf);
+	t->set(Value("tointeger"), fast_native<&typed::tointeger>());
+	t->set(Value("type"), fast_native<&typed::type>());
+	t->set(Value("ult"), fast_native<&typed::ult>());
+	t->set(Value("random"), &math_random);
+	t->set(Value("randomseed"), &math_randomseed);
+
+	// a fixed seed, like C's rand
+	const Value seed = Value::from_integer(0);
+	math_randomseed({}, Span<Value>(seed));
+
+	t->set(Value("pi"), pi);
+	t->set(Value("huge"), std::numeric_limits<double>::infinity());
+	t->set(Value("maxinteger"), Value::from_integer(std::numeric_limits<i64>::max()));
+	t->set(Value("mininteger"), Value::from_integer(std::numeric_limits<i64>::min()));
+
+	return t;
+}
+
+static Table& table_arg(Span<Value> in) {
+	if(in.is_empty()) {
+		throw InvalidArgCountException(1, 0);
+	}
 	check_type(in[0], ValueType::Table);
+	return in[0].table();
+}
 
-	Table& t = in[0].table();
-	t.set(Value(t.size() + 1), in[1]);
+u32 table_insert(MutableSpan<Value>, Span<Value> in) {
+	Table& t = table_arg(in);
+	if(in.size() == 2) {
+		t.insert(t.size() + 1, in[1]);
+		return 0;
+	}
+	check_params(3, in);
 
+	i64 pos = to_integer_arg(in[1]);
+	if(pos < 1 || u64(pos) > t.size() + 1) {
+		throw ExecutionException("Position out of bounds");
+	}
+	t.insert(usize(pos), in[2]);
 	return 0;
 }
 
+u32 table_remove(MutableSpan<Value> out, Span<Value> in) {
+	Table& t = table_arg(in);
+	const usize size = t.size();
+	i64 pos = integer_arg(in, 1, i64(size));
+	if(pos >= 1 && u64(pos) <= size) {
+		return build_out(out, t.remove(usize(pos)));
+	}
+	// like Lua, #t + 1 and 0 for an empty table are accepted and simply cleared
+	if(u64(pos) != size + 1 && u64(pos) != size) {
+		throw ExecutionException("Position out of bounds");
+	}
+	Value key = Value::from_integer(pos);
+	Value value = t.get(key);
+	t.set(key, Value());
+	return build_out(out, value);
+}
+
+template<typename F>
+static bool all_of(MutableSpan<Value> values, F&& f) {
+	return std::all_of(values.begin(), values.end(), f);
+}
+
+u32 table_sort(MutableSpan<Value>, Span<Value> in) {
+	Table& t = table_arg(in);
+	MutableSpan<Value> array = t.array();
+
+	if(in.size() < 2 || in[1].type == ValueType::None) {
+		// Value::operator< can't touch the table, so the array part is sorted in place
+		if(all_of(array, [](const Value& v) { return v.type == ValueType::Number && v.subtype == NumberType::Integer; })) {
+			sort(array.begin(), array.end(), [](const Value& a, const Value& b) { return a.integer < b.integer; });
+		} else if(all_of(array, [](const Value& v) { return v.type == ValueType::Number && v.subtype == NumberType::Float && !std::isnan(v.number); })) {
+			sort(array.begin(), array.end(), [](const Value& a, const Value& b) { return a.number < b.number; });
+		} else if(all_of(array, [](const Value& v) { return v.type == ValueType::String; })) {
+			for(const Value& v : array) {
+				v.string();
+			}
+			sort(array.begin(), array.end(), [](const Value& a, const Value& b) { return a.string().view() < b.string().view(); });
+		} else {
+			sort(array.begin(), array.end(), [](const Value& a, const Value& b) { return a < b; });
+		}
+		return 0;
+	}
+
+	// the order function can modify the table, so it sorts a copy
+	check_params(2, in);
+	const Value less = in[1];
+	std::vector<Value> values(array.begin(), array.end());
+	sort(values.data(), values.data() + values.size(), [&](const Value& a, const Value& b) {
+		Value args[] = {a, b};
+		Value result;
+		return VM::current()->call(less, Span<Value>(args, 2), MutableSpan<Value>(result)) && result.to_bool();
+	});
+	for(usize i = 0; i != values.size(); ++i) {
+		t.set(Value::from_integer(i64(i) + 1), values[i]);
+	}
+	return 0;
+}
+
+u32 table_concat(MutableSpan<Value> out, Span<Value> in) {
+	Table& t = table_arg(in);
+	const String* sep = in.size() > 1 && in[1].type != ValueType::None ? &to_string_arg(in[1]) : nullptr;
+	const i64 first = integer_arg(in, 2, 1);
+	const i64 last = integer_arg(in, 3, i64(t.size()));
+	if(first > last) {
+		return build_out(out, Value(std::string_view()));
+	}
+
+	// the values are checked and measured first so that the result is built in a single allocation.
+	// The range can be anything until its values are checked, so only the array part is reserved.
+	std::vector<Value> values;
+	values.reserve(std::min(u64(last - first), u64(t.size())) + 1);
+	usize size = 0;
+	for(i64 i = first;; ++i) {
+		Value v = t.get(Value::from_integer(i));
+		if(v.type == ValueType::Number) {
+			char buffer[32];
+			size += number_to_string(v, buffer);
+		} else if(v.type == ValueType::String) {
+			size += v.string().size();
+		} else {
+			throw ExecutionException("Invalid value in table for concat");
+		}
+		if(sep && i != first) {
+			size += sep->size();
+		}
+		values.push_back(v);
+		if(i == last) {
+			break;
+		}
+	}
+
+	return build_out(out, String::build(size, [&](char* data) {
+		for(usize i = 0; i != values.size(); ++i) {
+			if(i && sep) {
+				data = std::copy_n(sep->data(), sep->size(), data);
+			}
+			if(values[i].type == ValueType::Number) {
+				data += number_to_string(values[i], data);
+			} else {
+				const String& str = values[i].string();
+				data = std::copy_n(str.data(), str.size(), data);
+			}
+		}
+	}));
+}
+
+// results past the end of out are dropped
+u32 table_unpack(MutableSpan<Value> out, Span<Value> in) {
+	Table& t = table_arg(in);
+	const i64 first = integer_arg(in, 1, 1);
+	const i64 last = integer_arg(in, 2, i64(t.size()));
+	if(first > last) {
+		return 0;
+	}
+	const u64 count = std::min(u64(last) - u64(first) + 1, u64(out.size()));
+
+	MutableSpan<Value> array = t.array();
+	if(first >= 1 && u64(first) + count - 1 <= array.size()) {
+		std::copy_n(array.begin() + (first - 1), count, out.begin());
+	} else {
+		for(u64 i = 0; i != count; ++i) {
+			out[i] = t.get(Value::from_integer(i64(u64(first) + i)));
+		}
+	}
+	return u32(count);
+}
+
+u32 table_move(MutableSpan<Value> out, Span<Value> in) {
+	if(in.size() < 4) {
+		throw InvalidArgCountException(4, u32(in.size()));
+	}
+	Table& src = table_arg(in);
+	const i64 first = to_integer_arg(in[1]);
+	const i64 last = to_integer_arg(in[2]);
+	const i64 dst_first = to_integer_arg(in[3]);
+	const Value dst_table = in.size() > 4 && in[4].type != ValueType::None ? in[4] : in[0];
+	check_type(dst_table, ValueType::Table);
+	Table& dst = dst_table.table();
+
+	if(last >= first) {
+		if(first <= 0 && last >= std::numeric_limits<i64>::max() + first) {
+			throw ExecutionException("Too many elements to move");
+		}
+		const i64 count = last - first + 1;
+		if(dst_first > std::numeric_limits<i64>::max() - count + 1) {
+			throw ExecutionException("Destination wrap around");
+		}
+
+		MutableSpan<Value> src_array = src.array();
+		MutableSpan<Value> dst_array = dst.array();
+		if(first >= 1 && u64(last) <= src_array.size() && dst_first >= 1 && u64(dst_first + count - 1) <= dst_array.size()) {
+			// both ranges are in the array parts: a memmove, which has to keep the last value non nil
+			const Value* begin = src_array.begin() + (first - 1);
+			const Value* end = src_array.begin() + last;
+			Value* dst_begin = dst_array.begin() + (dst_first - 1);
+			if(dst_begin <= begin) {
+				std::copy(begin, end, dst_begin);
+			} else {
+				std::copy_backward(begin, end, dst_begin + count);
+			}
+			const usize size = dst_array.size();
+			if(dst_array[size - 1].type == ValueType::None) {
+				dst.set(Value::from_integer(i64(size)), Value());
+			}
+		} else if(dst_first > last || dst_first <= first || &src != &dst) {
+			for(i64 i = 0; i != count; ++i) {
+				dst.set(Value::from_integer(dst_first + i), src.get(Value::from_integer(first + i)));
+			}
+		} else {
+			for(i64 i = count; i-- != 0;) {
+				dst.set(Value::from_integer(dst_first + i), src.get(Value::from_integer(first + i)));
+			}
+		}
+	}
+
+	return build_out(out, dst_table);
+}
+
 u32 os_clock(MutableSpan<Value> out, Span<Value> in) {
 	check_params(0, in);
 	static auto start = std::chrono::high_resolution_clock::now();
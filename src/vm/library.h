@@ -24,6 +24,7 @@ SOFTWARE.
 
 #include "Value.h"
 #include "Table.h"
+#include "OutputBuffer.h"
 
 namespace jit {
 namespace lib {
@@ -34,18 +35,75 @@ Table default_env();
 
 void print(const Value& v);
 
+// Everything the library writes to stdout goes through this buffer
+OutputBuffer& output();
+
 
 u32 print(MutableSpan<Value>, Span<Value> in);
 u32 to_number(MutableSpan<Value> out, Span<Value> in);
+u32 to_string(MutableSpan<Value> out, Span<Value> in);
 u32 pairs(MutableSpan<Value> out, Span<Value> in);
 u32 ipairs(MutableSpan<Value> out, Span<Value> in);
 
 
+u32 math_abs(MutableSpan<Value> out, Span<Value> in);
+u32 math_floor(MutableSpan<Value> out, Span<Value> in);
+u32 math_ceil(MutableSpan<Value> out, Span<Value> in);
+u32 math_min(MutableSpan<Value> out, Span<Value> in);
+u32 math_max(MutableSpan<Value> out, Span<Value> in);
 u32 math_sqrt(MutableSpan<Value> out, Span<Value> in);
-
+u32 math_exp(MutableSpan<Value> out, Span<Value> in);
+u32 math_log(MutableSpan<Value> out, Span<Value> in);
+u32 math_sin(MutableSpan<Value> out, Span<Value> in);
+u32 math_cos(MutableSpan<Value> out, Span<Value> in);
+u32 math_tan(MutableSpan<Value> out, Span<Value> in);
+u32 math_asin(MutableSpan<Value> out, Span<Value> in);
+u32 math_acos(MutableSpan<Value> out, Span<Value> in);
+u32 math_atan(MutableSpan<Value> out, Span<Value> in);
+u32 math_deg(MutableSpan<Value> out, Span<Value> in);
+u32 math_rad(MutableSpan<Value> out, Span<Value> in);
+u32 math_fmod(MutableSpan<Value> out, Span<Value> in);
+u32 math_modf(MutableSpan<Value> out, Span<Value> in);
+u32 math_random(MutableSpan<Value> out, Span<Value> in);
+u32 math_randomseed(MutableSpan<Value> out, Span<Value> in);
+
+u32 io_open(MutableSpan<Value> out, Span<Value> in);
+u32 io_close(MutableSpan<Value> out, Span<Value> in);
 u32 io_read(MutableSpan<Value> out, Span<Value> in);
+u32 io_write(MutableSpan<Value> out, Span<Value> in);
+u32 io_lines(MutableSpan<Value> out, Span<Value> in);
+u32 io_flush(MutableSpan<Value> out, Span<Value> in);
+
+// methods of the files returned by io.open, the file is the first argument
+u32 file_read(MutableSpan<Value> out, Span<Value> in);
+u32 file_write(MutableSpan<Value> out, Span<Value> in);
+u32 file_lines(MutableSpan<Value> out, Span<Value> in);
+u32 file_flush(MutableSpan<Value> out, Span<Value> in);
+u32 file_close(MutableSpan<Value> out, Span<Value> in);
 
 u32 table_insert(MutableSpan<Value> out, Span<Value> in);
+u32 table_remove(MutableSpan<Value> out, Span<Value> in);
+u32 table_sort(MutableSpan<Value> out, Span<Value> in);
+u32 table_concat(MutableSpan<Value> out, Span<Value> in);
+u32 table_unpack(MutableSpan<Value> out, Span<Value> in);
+u32 table_move(MutableSpan<Value> out, Span<Value> in);
+
+u32 string_len(MutableSpan<Value> out, Span<Value> in);
+u32 string_sub(MutableSpan<Value> out, Span<Value> in);
+u32 string_byte(MutableSpan<Value> out, Span<Value> in);
+u32 string_char(MutableSpan<Value> out, Span<Value> in);
+u32 string_rep(MutableSpan<Value> out, Span<Value> in);
+u32 string_reverse(MutableSpan<Value> out, Span<Value> in);
+u32 string_upper(MutableSpan<Value> out, Span<Value> in);
+u32 string_lower(MutableSpan<Value> out, Span<Value> in);
+u32 string_find(MutableSpan<Value> out, Span<Value> in);
+u32 string_match(MutableSpan<Value> out, Span<Value> in);
+u32 string_gmatch(MutableSpan<Value> out, Span<Value> in);
+u32 string_gsub(MutableSpan<Value> out, Span<Value> in);
+u32 string_format(MutableSpan<Value> out, Span<Value> in);
+
+// The string table, strings also look up their methods in it
+Table* string_library();
 
 u32 os_clock(MutableSpan<Value> out, Span<Value> in);
 
@@ -0,0 +1,506 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_NATIVE_H
+#define JIT_NATIVE_H
+
+#include "Value.h"
+#include "Table.h"
+#include "exceptions.h"
+
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace jit {
+
+// Writes the results of a native function, the ones that don't fit in out are dropped
+template<typename T, typename... Args>
+[[nodiscard]] u32 build_out(MutableSpan<Value> out, T&& t, Args&&... args) {
+	if(out.size()) {
+		out[0] = std::forward<decltype(t)>(t);
+		if constexpr(sizeof...(args)) {
+			return 1 + build_out({out.data() + 1, out.size() - 1}, std::forward<decltype(args)>(args)...);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+// A number as it is, for natives that keep integers and floats apart
+struct Number {
+	Value value;
+};
+
+// Userdata holding any C++ object, objects of the same type share the methods table returned by object_methods
+template<typename T>
+Table* object_methods() {
+	static Table* methods = new Table();
+	return methods;
+}
+
+template<typename T>
+struct Object : Userdata {
+	template<typename... Args>
+	Object(Args&&... args) : value(std::forward<Args>(args)...) {
+		methods = object_methods<T>();
+	}
+
+	T value;
+};
+
+namespace detail {
+
+template<typename T>
+struct is_optional : std::false_type {};
+
+template<typename T>
+struct is_optional<std::optional<T>> : std::true_type {};
+
+template<typename T>
+struct is_tuple : std::false_type {};
+
+template<typename... Args>
+struct is_tuple<std::tuple<Args...>> : std::true_type {};
+
+template<typename A, typename B>
+struct is_tuple<std::pair<A, B>> : std::true_type {};
+
+// classes that are passed to scripts as userdata
+template<typename T>
+inline constexpr bool is_object_v = std::is_class_v<T> && !is_optional<T>::value && !is_tuple<T>::value &&
+	!std::is_same_v<T, Value> && !std::is_same_v<T, Number> && !std::is_same_v<T, Table> &&
+	!std::is_same_v<T, String> && !std::is_same_v<T, std::string> && !std::is_same_v<T, std::string_view>;
+
+// like Lua, strings are accepted where numbers are expected
+inline Value to_number(const Value& v) {
+	Value number;
+	if(v.type == ValueType::String && string_to_number(v.string().view(), number)) {
+		return number;
+	}
+	if(v.type != ValueType::Number) {
+		throw TypeErrorException(ValueType::Number, v.type);
+	}
+	return v;
+}
+
+// and numbers where strings are expected
+inline const String& to_string(const Value& v) {
+	if(v.type == ValueType::Number) {
+		char buffer[32];
+		return *String::create(std::string_view(buffer, number_to_string(v, buffer)));
+	}
+	if(v.type != ValueType::String) {
+		throw TypeErrorException(ValueType::String, v.type);
+	}
+	return v.string();
+}
+
+}
+
+// Argument and result conversions of natives.
+// to converts an argument of a generic native and throws like the library does if it can't.
+// get is used by typed natives and fails for the values they can't take as they are, the call then goes through the generic version.
+// set writes a result in place to avoid copies.
+template<typename T, typename = void>
+struct NativeType;
+
+template<typename T>
+struct NativeType<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+	static T to(const Value& v) {
+		double d = 0.0;
+		detail::to_number(v).to_double(d);
+		return T(d);
+	}
+
+	static bool get(const Value& v, T& t) {
+		if(v.type != ValueType::Number) {
+			return false;
+		}
+		t = T(v.subtype == NumberType::Integer ? double(v.integer) : v.number);
+		return true;
+	}
+
+	static void set(Value& v, T t) {
+		v.type = ValueType::Number;
+		v.subtype = NumberType::Float;
+		v.number = double(t);
+	}
+};
+
+template<typename T>
+struct NativeType<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+	static T to(const Value& v) {
+		i64 i = 0;
+		if(!detail::to_number(v).to_integer(i)) {
+			throw ExecutionException("Number has no integer representation");
+		}
+		return T(i);
+	}
+
+	static bool get(const Value& v, T& t) {
+		i64 i = 0;
+		if(v.type != ValueType::Number || !v.to_integer(i)) {
+			return false;
+		}
+		t = T(i);
+		return true;
+	}
+
+	static void set(Value& v, T t) {
+		v.type = ValueType::Number;
+		v.subtype = NumberType::Integer;
+		v.integer = i64(t);
+	}
+};
+
+template<>
+struct NativeType<bool> {
+	static bool to(const Value& v) {
+		return v.to_bool();
+	}
+
+	static bool get(const Value& v, bool& b) {
+		b = v.to_bool();
+		return true;
+	}
+
+	static void set(Value& v, bool b) {
+		v = Value::from_bool(b);
+	}
+};
+
+// strings are converted to floats, like luaL_checknumber
+template<>
+struct NativeType<Number> {
+	static Number to(const Value& v) {
+		return {v.type == ValueType::Number ? v : Value(NativeType<double>::to(v))};
+	}
+
+	static bool get(const Value& v, Number& n) {
+		n.value = v;
+		return v.type == ValueType::Number;
+	}
+
+	static void set(Value& v, const Number& n) {
+		v = n.value;
+	}
+};
+
+template<>
+struct NativeType<Value> {
+	static const Value& to(const Value& v) {
+		return v;
+	}
+
+	static bool get(const Value& v, Value& value) {
+		value = v;
+		return true;
+	}
+
+	static void set(Value& v, const Value& value) {
+		v = value;
+	}
+};
+
+template<>
+struct NativeType<String> {
+	static const String& to(const Value& v) {
+		return detail::to_string(v);
+	}
+
+	static void set(Value& v, const String& s) {
+		v = Value(&s);
+	}
+};
+
+template<>
+struct NativeType<std::string_view> {
+	static std::string_view to(const Value& v) {
+		return detail::to_string(v).view();
+	}
+
+	static void set(Value& v, std::string_view s) {
+		v = Value(s);
+	}
+};
+
+template<>
+struct NativeType<std::string> {
+	static std::string to(const Value& v) {
+		return std::string(detail::to_string(v).view());
+	}
+
+	static void set(Value& v, const std::string& s) {
+		v = Value(std::string_view(s));
+	}
+};
+
+// strings are followed by a NUL
+template<>
+struct NativeType<const char*> {
+	static const char* to(const Value& v) {
+		return detail::to_string(v).data();
+	}
+
+	static void set(Value& v, const char* s) {
+		v = Value(std::string_view(s));
+	}
+};
+
+template<>
+struct NativeType<Table> {
+	static Table& to(const Value& v) {
+		if(v.type != ValueType::Table) {
+			throw TypeErrorException(ValueType::Table, v.type);
+		}
+		return v.table();
+	}
+
+	static void set(Value& v, Table& t) {
+		v = Value(&t);
+	}
+};
+
+// Userdata classes are passed as they are, other classes are copied in an Object
+template<typename T>
+struct NativeType<T, std::enable_if_t<detail::is_object_v<T>>> {
+	static T& to(const Value& v) {
+		if(v.type != ValueType::Userdata) {
+			throw TypeErrorException(ValueType::Userdata, v.type);
+		}
+		if constexpr(std::is_base_of_v<Userdata, T>) {
+			if(T* t = dynamic_cast<T*>(&v.userdata())) {
+				return *t;
+			}
+		} else {
+			if(Object<T>* object = dynamic_cast<Object<T>*>(&v.userdata())) {
+				return object->value;
+			}
+		}
+		throw ExecutionException("Invalid userdata type");
+	}
+
+	static void set(Value& v, T& t) {
+		if constexpr(std::is_base_of_v<Userdata, T>) {
+			v = Value(static_cast<Userdata*>(&t));
+		} else {
+			v = Value(static_cast<Userdata*>(new Object<T>(t)));
+		}
+	}
+
+	static void set(Value& v, T&& t) {
+		if constexpr(std::is_base_of_v<Userdata, T>) {
+			v = Value(static_cast<Userdata*>(new T(std::move(t))));
+		} else {
+			v = Value(static_cast<Userdata*>(new Object<T>(std::move(t))));
+		}
+	}
+};
+
+// nil is a null pointer
+template<typename T>
+struct NativeType<T*, std::enable_if_t<std::is_same_v<T, Table> || std::is_base_of_v<Userdata, T>>> {
+	static T* to(const Value& v) {
+		return v.type == ValueType::None ? nullptr : &NativeType<T>::to(v);
+	}
+
+	static void set(Value& v, T* t) {
+		if(t) {
+			NativeType<T>::set(v, *t);
+		} else {
+			v = Value();
+		}
+	}
+};
+
+// nil or a missing argument is an empty optional
+template<typename T>
+struct NativeType<std::optional<T>> {
+	static std::optional<T> to(const Value& v) {
+		if(v.type == ValueType::None) {
+			return std::nullopt;
+		}
+		return NativeType<T>::to(v);
+	}
+
+	static void set(Value& v, std::optional<T> t) {
+		if(t) {
+			NativeType<T>::set(v, std::move(*t));
+		} else {
+			v = Value();
+		}
+	}
+};
+
+namespace detail {
+
+template<typename R, typename... Args>
+constexpr usize arity(R(*)(Args...)) {
+	return sizeof...(Args);
+}
+
+template<typename T>
+decltype(auto) arg(Span<Value> in, usize index) {
+	static const Value nil;
+	return NativeType<std::decay_t<T>>::to(index < in.size() ? in[index] : nil);
+}
+
+// trailing optional arguments can be left out
+template<typename... Args>
+void check_arg_count(usize count) {
+	constexpr bool optional[] = {is_optional<std::decay_t<Args>>::value..., false};
+	usize required = 0;
+	for(usize i = 0; i != sizeof...(Args); ++i) {
+		if(!optional[i]) {
+			required = i + 1;
+		}
+	}
+	if(count < required || count > sizeof...(Args)) {
+		throw InvalidArgCountException(u32(count < required ? required : sizeof...(Args)), u32(count));
+	}
+}
+
+template<typename T>
+Value to_value(T&& t) {
+	Value v;
+	NativeType<std::decay_t<T>>::set(v, std::forward<T>(t));
+	return v;
+}
+
+// void gives no results, tuples and pairs give one result per element
+template<typename F>
+u32 results(MutableSpan<Value> out, F&& call) {
+	using R = decltype(call());
+	if constexpr(std::is_void_v<R>) {
+		call();
+		return 0;
+	} else if constexpr(is_tuple<std::decay_t<R>>::value) {
+		if constexpr(std::tuple_size_v<std::decay_t<R>> == 0) {
+			call();
+			return 0;
+		} else {
+			return std::apply([&](auto&&... values) {
+				return build_out(out, to_value(std::forward<decltype(values)>(values))...);
+			}, call());
+		}
+	} else {
+		return build_out(out, to_value(call()));
+	}
+}
+
+template<auto F, typename R, typename... Args, usize... I>
+u32 call_generic(MutableSpan<Value> out, Span<Value> in, R(*)(Args...), std::index_sequence<I...>) {
+	check_arg_count<Args...>(in.size());
+	return results(out, [&]() -> R { return F(arg<Args>(in, I)...); });
+}
+
+// the object is the first argument, like with a method call
+template<auto F, typename C, typename R, typename... Args, usize... I>
+u32 call_method(MutableSpan<Value> out, Span<Value> in, std::index_sequence<I...>) {
+	check_arg_count<C&, Args...>(in.size());
+	C& self = arg<C>(in, 0);
+	return results(out, [&]() -> R { return (self.*F)(arg<Args>(in, I + 1)...); });
+}
+
+template<auto F, typename R, typename... Args>
+u32 call_generic(MutableSpan<Value> out, Span<Value> in, R(*function)(Args...)) {
+	return call_generic<F>(out, in, function, std::index_sequence_for<Args...>());
+}
+
+template<auto F, typename C, typename R, typename... Args>
+u32 call_generic(MutableSpan<Value> out, Span<Value> in, R(C::*)(Args...)) {
+	return call_method<F, C, R, Args...>(out, in, std::index_sequence_for<Args...>());
+}
+
+template<auto F, typename C, typename R, typename... Args>
+u32 call_generic(MutableSpan<Value> out, Span<Value> in, R(C::*)(Args...) const) {
+	return call_method<F, const C, R, Args...>(out, in, std::index_sequence_for<Args...>());
+}
+
+template<typename F, typename R, typename... Args, usize... I>
+u32 call_functor(const F& function, MutableSpan<Value> out, Span<Value> in, std::index_sequence<I...>) {
+	check_arg_count<Args...>(in.size());
+	return results(out, [&]() -> R { return function(arg<Args>(in, I)...); });
+}
+
+template<typename F, typename R, typename... Args>
+u32 call_functor(const F& function, MutableSpan<Value> out, Span<Value> in, R(F::*)(Args...) const) {
+	return call_functor<F, R, Args...>(function, out, in, std::index_sequence_for<Args...>());
+}
+
+template<auto F, typename R, typename... Args, usize... I>
+bool call_fast(Value& ret, const Value* args, R(*)(Args...), std::index_sequence<I...>) {
+	std::tuple<std::decay_t<Args>...> values;
+	if(!(NativeType<std::decay_t<Args>>::get(args[I], std::get<I>(values)) && ...)) {
+		return false;
+	}
+	NativeType<R>::set(ret, F(std::get<I>(values)...));
+	return true;
+}
+
+template<auto F>
+bool call_fast(Value& ret, const Value* args) {
+	return call_fast<F>(ret, args, F, std::make_index_sequence<arity(F)>());
+}
+
+}
+
+// Generic native for a function or a method, the object being the first argument.
+// Arguments are checked and converted by NativeType, missing trailing arguments can be std::optional.
+// Results are void, a single value or a tuple of values.
+template<auto F>
+FunctionPtr native() {
+	return [](MutableSpan<Value> out, Span<Value> in) -> u32 {
+		return detail::call_generic<F>(out, in, F);
+	};
+}
+
+// Same for lambdas, which can't capture anything
+template<typename F>
+FunctionPtr native(F function) {
+	static_assert(std::is_empty_v<F>, "Natives can't capture");
+	static const F f = function;
+	return [](MutableSpan<Value> out, Span<Value> in) -> u32 {
+		return detail::call_functor(f, out, in, &F::operator());
+	};
+}
+
+// Pairs a generic native with a typed version of its most common form, called without any span or argument count check.
+// Fast is a plain function, for example double(double) for math.sqrt, its arguments and result are converted by NativeType.
+template<FunctionPtr Function, auto Fast>
+const FastFunction* fast_function() {
+	static const FastFunction function = {Function, &detail::call_fast<Fast>, u32(detail::arity(Fast))};
+	return &function;
+}
+
+// Both versions generated from the same function
+template<auto F>
+const FastFunction* fast_native() {
+	static const FastFunction function = {native<F>(), &detail::call_fast<F>, u32(detail::arity(F))};
+	return &function;
+}
+
+}
+
+#endif // JIT_NATIVE_H
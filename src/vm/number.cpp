@@ -0,0 +1,508 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "number.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+
+namespace jit {
+
+// Lua prints floats with 14 significant digits
+static constexpr i32 float_digits = 14;
+
+static const char digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const u32 pow10_u32[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+// exactly representable, used by the parsing fast path
+static const double pow10_f64[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static bool is_hex_digit(char c) {
+	return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static u32 hex_value(char c) {
+	return is_digit(c) ? u32(c - '0') : u32((c | 0x20) - 'a' + 10);
+}
+
+static char* write_u64(u64 value, char* out) {
+	char tmp[20];
+	char* t = tmp + sizeof(tmp);
+	while(value >= 100) {
+		usize pair = usize(value % 100) * 2;
+		value /= 100;
+		*--t = digit_pairs[pair + 1];
+		*--t = digit_pairs[pair];
+	}
+	if(value >= 10) {
+		*--t = digit_pairs[value * 2 + 1];
+		*--t = digit_pairs[value * 2];
+	} else {
+		*--t = char('0' + value);
+	}
+	usize len = usize(tmp + sizeof(tmp) - t);
+	std::memcpy(out, t, len);
+	return out + len;
+}
+
+usize format_integer(i64 value, char* buffer) {
+	char* out = buffer;
+	u64 abs = u64(value);
+	if(value < 0) {
+		*out++ = '-';
+		abs = 0 - abs;
+	}
+	out = write_u64(abs, out);
+	*out = 0;
+	return usize(out - buffer);
+}
+
+
+
+// Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers").
+// It produces the shortest digits that read back as the same double in about 99.9% of the cases,
+// and a slightly longer but still exact representation otherwise.
+namespace grisu {
+
+struct DiyFp {
+	u64 f;
+	i32 e;
+};
+
+static constexpr u64 hidden_bit = u64(1) << 52;
+static constexpr u64 significand_mask = hidden_bit - 1;
+static constexpr i32 exponent_bias = 0x3FF + 52;
+
+// normalized 10^k for k = -348, -340, ..., 340
+static const u64 cached_f[] = {
+	0xfa8fd5a0081c0288, 0xbaaee17fa23ebf76, 0x8b16fb203055ac76, 0xcf42894a5dce35ea,
+	0x9a6bb0aa55653b2d, 0xe61acf033d1a45df, 0xab70fe17c79ac6ca, 0xff77b1fcbebcdc4f,
+	0xbe5691ef416bd60c, 0x8dd01fad907ffc3c, 0xd3515c2831559a83, 0x9d71ac8fada6c9b5,
+	0xea9c227723ee8bcb, 0xaecc49914078536d, 0x823c12795db6ce57, 0xc21094364dfb5637,
+	0x9096ea6f3848984f, 0xd77485cb25823ac7, 0xa086cfcd97bf97f4, 0xef340a98172aace5,
+	0xb23867fb2a35b28e, 0x84c8d4dfd2c63f3b, 0xc5dd44271ad3cdba, 0x936b9fcebb25c996,
+	0xdbac6c247d62a584, 0xa3ab66580d5fdaf6, 0xf3e2f893dec3f126, 0xb5b5ada8aaff80b8,
+	0x87625f056c7c4a8b, 0xc9bcff6034c13053, 0x964e858c91ba2655, 0xdff9772470297ebd,
+	0xa6dfbd9fb8e5b88f, 0xf8a95fcf88747d94, 0xb94470938fa89bcf, 0x8a08f0f8bf0f156b,
+	0xcdb02555653131b6, 0x993fe2c6d07b7fac, 0xe45c10c42a2b3b06, 0xaa242499697392d3,
+	0xfd87b5f28300ca0e, 0xbce5086492111aeb, 0x8cbccc096f5088cc, 0xd1b71758e219652c,
+	0x9c40000000000000, 0xe8d4a51000000000, 0xad78ebc5ac620000, 0x813f3978f8940984,
+	0xc097ce7bc90715b3, 0x8f7e32ce7bea5c70, 0xd5d238a4abe98068, 0x9f4f2726179a2245,
+	0xed63a231d4c4fb27, 0xb0de65388cc8ada8, 0x83c7088e1aab65db, 0xc45d1df942711d9a,
+	0x924d692ca61be758, 0xda01ee641a708dea, 0xa26da3999aef774a, 0xf209787bb47d6b85,
+	0xb454e4a179dd1877, 0x865b86925b9bc5c2, 0xc83553c5c8965d3d, 0x952ab45cfa97a0b3,
+	0xde469fbd99a05fe3, 0xa59bc234db398c25, 0xf6c69a72a3989f5c, 0xb7dcbf5354e9bece,
+	0x88fcf317f22241e2, 0xcc20ce9bd35c78a5, 0x98165af37b2153df, 0xe2a0b5dc971f303a,
+	0xa8d9d1535ce3b396, 0xfb9b7cd9a4a7443c, 0xbb764c4ca7a44410, 0x8bab8eefb6409c1a,
+	0xd01fef10a657842c, 0x9b10a4e5e9913129, 0xe7109bfba19c0c9d, 0xac2820d9623bf429,
+	0x80444b5e7aa7cf85, 0xbf21e44003acdd2d, 0x8e679c2f5e44ff8f, 0xd433179d9c8cb841,
+	0x9e19db92b4e31ba9, 0xeb96bf6ebadf77d9, 0xaf87023b9bf0ee6b
+};
+
+static const i16 cached_e[] = {
+	-1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+	-954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+	-688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+	-422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+	-157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+	109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+	375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+	641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+	907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static DiyFp decompose(double value) {
+	u64 bits = 0;
+	std::memcpy(&bits, &value, sizeof(bits));
+	i32 biased_e = i32((bits >> 52) & 0x7FF);
+	u64 significand = bits & significand_mask;
+	if(biased_e) {
+		return {significand + hidden_bit, biased_e - exponent_bias};
+	}
+	return {significand, 1 - exponent_bias};
+}
+
+static DiyFp normalize(DiyFp x) {
+	while(!(x.f & (u64(1) << 63))) {
+		x.f <<= 1;
+		--x.e;
+	}
+	return x;
+}
+
+// upper 64 bits of the product, rounded
+static DiyFp multiply(DiyFp x, DiyFp y) {
+	const u64 mask = 0xFFFFFFFF;
+	u64 a = x.f >> 32;
+	u64 b = x.f & mask;
+	u64 c = y.f >> 32;
+	u64 d = y.f & mask;
+	u64 ac = a * c;
+	u64 bc = b * c;
+	u64 ad = a * d;
+	u64 bd = b * d;
+	u64 tmp = (bd >> 32) + (ad & mask) + (bc & mask) + (u64(1) << 31);
+	return {ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64};
+}
+
+static i32 count_digits(u32 n) {
+	i32 count = 1;
+	while(count < 10 && n >= pow10_u32[count]) {
+		++count;
+	}
+	return count;
+}
+
+static void round_weed(char* buffer, i32 len, u64 delta, u64 rest, u64 ten_kappa, u64 wp_w) {
+	while(rest < wp_w && delta - rest >= ten_kappa &&
+		  (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+		--buffer[len - 1];
+		rest += ten_kappa;
+	}
+}
+
+static void generate_digits(DiyFp w, DiyFp mp, u64 delta, char* buffer, i32& len, i32& k) {
+	const DiyFp one = {u64(1) << -mp.e, mp.e};
+	const u64 wp_w = mp.f - w.f;
+	u32 p1 = u32(mp.f >> -one.e);
+	u64 p2 = mp.f & (one.f - 1);
+	i32 kappa = count_digits(p1);
+	len = 0;
+
+	while(kappa > 0) {
+		u32 div = pow10_u32[kappa - 1];
+		u32 d = p1 / div;
+		p1 %= div;
+		if(d || len) {
+			buffer[len++] = char('0' + d);
+		}
+		--kappa;
+		u64 rest = (u64(p1) << -one.e) + p2;
+		if(rest <= delta) {
+			k += kappa;
+			round_weed(buffer, len, delta, rest, u64(pow10_u32[kappa]) << -one.e, wp_w);
+			return;
+		}
+	}
+
+	for(;;) {
+		p2 *= 10;
+		delta *= 10;
+		char d = char(p2 >> -one.e);
+		if(d || len) {
+			buffer[len++] = char('0' + d);
+		}
+		p2 &= one.f - 1;
+		--kappa;
+		if(p2 < delta) {
+			k += kappa;
+			i32 index = -kappa;
+			round_weed(buffer, len, delta, p2, one.f, wp_w * (index < 10 ? pow10_u32[index] : 0));
+			return;
+		}
+	}
+}
+
+// value has to be positive and finite, the result is buffer[0, len) * 10^k
+static void shortest(double value, char* buffer, i32& len, i32& k) {
+	const DiyFp v = decompose(value);
+
+	DiyFp plus = {(v.f << 1) + 1, v.e - 1};
+	while(!(plus.f & (hidden_bit << 1))) {
+		plus.f <<= 1;
+		--plus.e;
+	}
+	plus.f <<= 64 - 52 - 2;
+	plus.e -= 64 - 52 - 2;
+
+	DiyFp minus = v.f == hidden_bit ? DiyFp{(v.f << 2) - 1, v.e - 2} : DiyFp{(v.f << 1) - 1, v.e - 1};
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+
+	// find a cached power so the scaled exponent ends up in [-60, -32]
+	double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+	i32 ik = i32(dk);
+	if(dk - ik > 0.0) {
+		++ik;
+	}
+	usize index = usize((ik >> 3) + 1);
+	k = -(-348 + i32(index) * 8);
+	const DiyFp c_mk = {cached_f[index], cached_e[index]};
+
+	const DiyFp w = multiply(normalize(v), c_mk);
+	DiyFp wp = multiply(plus, c_mk);
+	DiyFp wm = multiply(minus, c_mk);
+	++wm.f;
+	--wp.f;
+	generate_digits(w, wp, wp.f - wm.f, buffer, len, k);
+}
+
+}
+
+
+
+static usize format_float_libc(double value, char* buffer) {
+	return usize(std::snprintf(buffer, max_number_size, "%.14g", value));
+}
+
+// rounds digits to float_digits, returns false if the shortest digits are too close to
+// the midpoint to know which way the exact value rounds
+static bool round_digits(char* digits, i32& len, i32& k) {
+	i32 tail_len = len - float_digits;
+	u32 tail = 0;
+	for(i32 i = 0; i != 3; ++i) {
+		tail = tail * 10 + (i < tail_len ? u32(digits[float_digits + i] - '0') : 0);
+	}
+	// the shortest digits are within an ulp of the value, which is less than 0.03 units of the last digit
+	if(tail >= 470 && tail <= 530) {
+		return false;
+	}
+	len = float_digits;
+	k += tail_len;
+	if(tail > 500) {
+		i32 i = len - 1;
+		for(; i >= 0 && digits[i] == '9'; --i) {
+			digits[i] = '0';
+		}
+		if(i < 0) {
+			digits[0] = '1';
+			++k;
+		} else {
+			++digits[i];
+		}
+	}
+	while(len > 1 && digits[len - 1] == '0') {
+		--len;
+		++k;
+	}
+	return true;
+}
+
+usize format_float(double value, char* buffer) {
+	if(!std::isfinite(value) || (value != 0.0 && std::abs(value) < std::numeric_limits<double>::min())) {
+		return format_float_libc(value, buffer);
+	}
+
+	char* out = buffer;
+	if(std::signbit(value)) {
+		*out++ = '-';
+	}
+	if(value == 0.0) {
+		std::memcpy(out, "0", 2);
+		return usize(out - buffer) + 1;
+	}
+
+	char digits[24];
+	i32 len = 0;
+	i32 k = 0;
+	grisu::shortest(std::abs(value), digits, len, k);
+	while(len > 1 && digits[len - 1] == '0') {
+		--len;
+		++k;
+	}
+	if(len > float_digits && !round_digits(digits, len, k)) {
+		return format_float_libc(value, buffer);
+	}
+
+	// same choice between fixed and scientific notation as %g
+	i32 exponent = len + k - 1;
+	if(exponent < -4 || exponent >= float_digits) {
+		*out++ = digits[0];
+		if(len > 1) {
+			*out++ = '.';
+			std::memcpy(out, digits + 1, usize(len - 1));
+			out += len - 1;
+		}
+		*out++ = 'e';
+		*out++ = exponent < 0 ? '-' : '+';
+		u32 abs_exp = u32(exponent < 0 ? -exponent : exponent);
+		if(abs_exp < 10) {
+			*out++ = '0';
+		}
+		out = write_u64(abs_exp, out);
+	} else if(exponent < 0) {
+		*out++ = '0';
+		*out++ = '.';
+		for(i32 i = -1; i != exponent; --i) {
+			*out++ = '0';
+		}
+		std::memcpy(out, digits, usize(len));
+		out += len;
+	} else {
+		i32 int_len = exponent + 1;
+		for(i32 i = 0; i != int_len; ++i) {
+			*out++ = i < len ? digits[i] : '0';
+		}
+		if(len > int_len) {
+			*out++ = '.';
+			std::memcpy(out, digits + int_len, usize(len - int_len));
+			out += len - int_len;
+		}
+	}
+	*out = 0;
+	return usize(out - buffer);
+}
+
+
+
+bool parse_integer(std::string_view str, i64& result) {
+	const char* s = str.data();
+	const char* end = s + str.size();
+	bool negative = false;
+	if(s != end && (*s == '-' || *s == '+')) {
+		negative = *s++ == '-';
+	}
+
+	u64 value = 0;
+	const char* digits = s;
+	if(end - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+		digits = s += 2;
+		for(; s != end && is_hex_digit(*s); ++s) {
+			value = value * 16 + hex_value(*s);
+		}
+	} else {
+		const u64 max = u64(std::numeric_limits<i64>::max()) + (negative ? 1 : 0);
+		for(; s != end && is_digit(*s); ++s) {
+			u64 d = u64(*s - '0');
+			if(value > (max - d) / 10) {
+				return false;
+			}
+			value = value * 10 + d;
+		}
+	}
+	if(s == digits || s != end) {
+		return false;
+	}
+	result = i64(negative ? 0 - value : value);
+	return true;
+}
+
+// Decimal numbers with up to 19 significant digits and a small exponent are exact
+// with a single floating point operation (Clinger's fast path), the others use strtod.
+bool parse_float(std::string_view str, double& result) {
+	const char* s = str.data();
+	const char* end = s + str.size();
+	bool negative = false;
+	if(s != end && (*s == '-' || *s == '+')) {
+		negative = *s++ == '-';
+	}
+
+	bool fast = true;
+	if(end - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+		// hexadecimal floats are rare enough, strtod would also accept inf and nan
+		if(str.find_first_of("nN") != std::string_view::npos) {
+			return false;
+		}
+		fast = false;
+	} else {
+		u64 mantissa = 0;
+		i32 significant = 0;
+		i32 exponent = 0;
+		bool any = false;
+
+		auto add_digit = [&](char c, bool fraction) {
+			any = true;
+			if(!mantissa && c == '0') {
+				exponent -= fraction;
+			} else if(significant < 19) {
+				mantissa = mantissa * 10 + u64(c - '0');
+				++significant;
+				exponent -= fraction;
+			} else {
+				exponent += !fraction;
+				fast &= c == '0';
+			}
+		};
+
+		for(; s != end && is_digit(*s); ++s) {
+			add_digit(*s, false);
+		}
+		if(s != end && *s == '.') {
+			for(++s; s != end && is_digit(*s); ++s) {
+				add_digit(*s, true);
+			}
+		}
+		if(!any) {
+			return false;
+		}
+		if(s != end && (*s == 'e' || *s == 'E')) {
+			++s;
+			bool negative_exp = false;
+			if(s != end && (*s == '-' || *s == '+')) {
+				negative_exp = *s++ == '-';
+			}
+			if(s == end || !is_digit(*s)) {
+				return false;
+			}
+			i32 e = 0;
+			for(; s != end && is_digit(*s); ++s) {
+				e = e < 100000 ? e * 10 + (*s - '0') : e;
+			}
+			exponent += negative_exp ? -e : e;
+		}
+		if(s != end) {
+			return false;
+		}
+
+		if(fast && mantissa <= (u64(1) << 53) && exponent >= -22 && exponent <= 22) {
+			double m = double(mantissa);
+			m = exponent < 0 ? m / pow10_f64[-exponent] : m * pow10_f64[exponent];
+			result = negative ? -m : m;
+			return true;
+		}
+		if(!mantissa) {
+			result = negative ? -0.0 : 0.0;
+			return true;
+		}
+	}
+
+	std::string copy(str);
+	char* copy_end = nullptr;
+	result = std::strtod(copy.c_str(), &copy_end);
+	return copy_end == copy.c_str() + copy.size();
+}
+
+}
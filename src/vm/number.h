@@ -0,0 +1,47 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_NUMBER_H
+#define JIT_NUMBER_H
+
+#include <utils.h>
+
+#include <string_view>
+
+namespace jit {
+
+// Conversions between numbers and text, without going through the C locale.
+// Buffers need at least max_number_size bytes, outputs are NUL terminated.
+static constexpr usize max_number_size = 32;
+
+usize format_integer(i64 value, char* buffer);
+
+// Same output as "%.14g", tostring adds ".0" to integral floats on top of that
+usize format_float(double value, char* buffer);
+
+// Both need the whole string to be a number, without spaces.
+// Decimal integers that overflow are rejected, hexadecimal ones wrap around.
+bool parse_integer(std::string_view str, i64& result);
+bool parse_float(std::string_view str, double& result);
+
+}
+
+#endif // JIT_NUMBER_H
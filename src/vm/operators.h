@@ -0,0 +1,147 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_OPERATORS_H
+#define JIT_OPERATORS_H
+
+#include "Value.h"
+#include "exceptions.h"
+#include "arithmetic.h"
+
+#include <cmath>
+#include <limits>
+
+namespace jit {
+
+// Operators of the interpreter on values, shared with the IR evaluator so that both fail in the same way
+
+// numbers are read and written without going through Value's out of line constructors and assignment
+inline void set_number(Value& value, double number) {
+	value.type = ValueType::Number;
+	value.subtype = NumberType::Float;
+	value.number = number;
+}
+
+inline void set_integer(Value& value, i64 integer) {
+	value.type = ValueType::Number;
+	value.subtype = NumberType::Integer;
+	value.integer = integer;
+}
+
+inline bool is_integer(const Value& value) {
+	return value.type == ValueType::Number && value.subtype == NumberType::Integer;
+}
+
+// strings are converted, arithmetic on them is always done on floats like in Lua 5.3
+inline double float_value(const Value& value) {
+	if(value.type != ValueType::Number) {
+		Value number;
+		if(value.type != ValueType::String || !string_to_number(value.string().view(), number)) {
+			throw TypeErrorException(ValueType::Number, value.type);
+		}
+		return float_value(number);
+	}
+	return value.subtype == NumberType::Integer ? double(value.integer) : value.number;
+}
+
+// bitwise operators accept floats with an exact integer value
+inline i64 integer_value(const Value& value) {
+	if(is_integer(value)) {
+		return value.integer;
+	}
+	i64 i = 0;
+	if(!float_to_integer(float_value(value), i)) {
+		throw ExecutionException("Number has no integer representation");
+	}
+	return i;
+}
+
+inline i64 nonzero(i64 divisor) {
+	if(!divisor) {
+		throw ExecutionException("Integer division by zero");
+	}
+	return divisor;
+}
+
+// integers stay integers and wrap around, anything else is computed on floats
+template<typename I, typename F>
+inline void arithmetic(Value& dst, const Value& a, const Value& b, I&& int_op, F&& float_op) {
+	if(is_integer(a) && is_integer(b)) {
+		set_integer(dst, int_op(a.integer, b.integer));
+	} else {
+		double x = float_value(a);
+		double y = float_value(b);
+		set_number(dst, float_op(x, y));
+	}
+}
+
+// Numbers of the same subtype are compared inline, everything else goes through Value
+inline bool less_than(const Value& a, const Value& b) {
+	if(a.type == ValueType::Number && b.type == ValueType::Number && a.subtype == b.subtype) {
+		return a.subtype == NumberType::Integer ? a.integer < b.integer : a.number < b.number;
+	}
+	return a < b;
+}
+
+inline bool less_equal(const Value& a, const Value& b) {
+	if(a.type == ValueType::Number && b.type == ValueType::Number && a.subtype == b.subtype) {
+		return a.subtype == NumberType::Integer ? a.integer <= b.integer : a.number <= b.number;
+	}
+	return a <= b;
+}
+
+// Loops with an integer start and step count on integers, the limit is rounded toward the inside of the range.
+// Other loops count on floats. Forloop relies on all three registers having the same subtype.
+// Returns false if the loop can't run because its limit is past the end of the integer range.
+inline bool prepare_loop(Value& index, Value& limit, Value& step) {
+	if(is_integer(index) && is_integer(step)) {
+		if(!step.integer) {
+			throw ExecutionException("'for' step is zero");
+		}
+		i64 last = 0;
+		if(is_integer(limit)) {
+			last = limit.integer;
+		} else {
+			double f = float_value(limit);
+			f = step.integer > 0 ? std::floor(f) : std::ceil(f);
+			if(!float_to_integer(f, last)) {
+				if((f > 0.0) != (step.integer > 0)) {
+					return false;
+				}
+				last = f > 0.0 ? std::numeric_limits<i64>::max() : std::numeric_limits<i64>::min();
+			}
+		}
+		set_integer(limit, last);
+		set_integer(index, int_sub(index.integer, step.integer));
+	} else {
+		double start = float_value(index);
+		double last = float_value(limit);
+		double increment = float_value(step);
+		set_number(limit, last);
+		set_number(step, increment);
+		set_number(index, start - increment);
+	}
+	return true;
+}
+
+}
+
+#endif // JIT_OPERATORS_H
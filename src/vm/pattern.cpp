@@ -0,0 +1,533 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+
+#include "pattern.h"
+#include "exceptions.h"
+
+#include <cctype>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace jit {
+
+static constexpr char escape = '%';
+static constexpr const char* specials = "^$*+?.([%-";
+static constexpr u32 max_depth = 200;
+static constexpr i64 unfinished = -1;
+
+static void pattern_error(const char* msg) {
+	throw ExecutionException(msg);
+}
+
+#ifdef __SSE2__
+static __m128i load(const char* p) {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+static u32 first_bit(u32 mask) {
+	return u32(__builtin_ctz(mask));
+}
+
+static __m128i in_range(__m128i bytes, char first, char last) {
+	// signed compares, bytes above 127 are never in range
+	return _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(char(first - 1))), _mm_cmplt_epi8(bytes, _mm_set1_epi8(char(last + 1))));
+}
+#endif
+
+const char* find_byte(const char* begin, const char* end, char c) {
+#ifdef __SSE2__
+	const __m128i value = _mm_set1_epi8(c);
+	for(; end - begin >= 16; begin += 16) {
+		if(u32 mask = u32(_mm_movemask_epi8(_mm_cmpeq_epi8(load(begin), value)))) {
+			return begin + first_bit(mask);
+		}
+	}
+#endif
+	for(; begin != end; ++begin) {
+		if(*begin == c) {
+			return begin;
+		}
+	}
+	return end;
+}
+
+// candidates are the positions where both the first and the last characters of the needle match
+const char* find_plain(const char* begin, const char* end, std::string_view needle) {
+	const usize size = needle.size();
+	if(!size) {
+		return begin;
+	}
+	if(usize(end - begin) < size) {
+		return end;
+	}
+	if(size == 1) {
+		return find_byte(begin, end, needle[0]);
+	}
+
+	const char* last = end - size;
+#ifdef __SSE2__
+	const __m128i first_char = _mm_set1_epi8(needle.front());
+	const __m128i last_char = _mm_set1_epi8(needle.back());
+	for(; last - begin >= 15; begin += 16) {
+		__m128i first = _mm_cmpeq_epi8(load(begin), first_char);
+		__m128i final = _mm_cmpeq_epi8(load(begin + size - 1), last_char);
+		for(u32 mask = u32(_mm_movemask_epi8(_mm_and_si128(first, final))); mask; mask &= mask - 1) {
+			const char* candidate = begin + first_bit(mask);
+			if(!std::memcmp(candidate + 1, needle.data() + 1, size - 2)) {
+				return candidate;
+			}
+		}
+	}
+#endif
+	for(; begin <= last; ++begin) {
+		if(*begin == needle.front() && !std::memcmp(begin, needle.data(), size)) {
+			return begin;
+		}
+	}
+	return end;
+}
+
+static bool match_class(int c, int cl) {
+	bool res = false;
+	switch(std::tolower(cl)) {
+		case 'a': res = std::isalpha(c); break;
+		case 'c': res = std::iscntrl(c); break;
+		case 'd': res = std::isdigit(c); break;
+		case 'g': res = std::isgraph(c); break;
+		case 'l': res = std::islower(c); break;
+		case 'p': res = std::ispunct(c); break;
+		case 's': res = std::isspace(c); break;
+		case 'u': res = std::isupper(c); break;
+		case 'w': res = std::isalnum(c); break;
+		case 'x': res = std::isxdigit(c); break;
+		default:
+			return cl == c;
+	}
+	return std::isupper(cl) ? !res : res;
+}
+
+// p points to the '[' and ec to the ']'
+static bool match_bracket_class(int c, const char* p, const char* ec) {
+	bool sig = true;
+	if(*(p + 1) == '^') {
+		sig = false;
+		++p;
+	}
+	while(++p < ec) {
+		if(*p == escape) {
+			++p;
+			if(match_class(c, u8(*p))) {
+				return sig;
+			}
+		} else if(*(p + 1) == '-' && p + 2 < ec) {
+			p += 2;
+			if(u8(*(p - 2)) <= c && c <= u8(*p)) {
+				return sig;
+			}
+		} else if(u8(*p) == c) {
+			return sig;
+		}
+	}
+	return !sig;
+}
+
+// skips the characters of a %x class, blocks of 16 are tested at once for the common ones
+static const char* skip_class(const char* s, const char* end, char cl) {
+#ifdef __SSE2__
+	const char lower = char(std::tolower(cl));
+	const bool negate = std::isupper(cl);
+	auto class_mask = [&](__m128i bytes) -> int {
+		switch(lower) {
+			case 'd':
+				return _mm_movemask_epi8(in_range(bytes, '0', '9'));
+			case 's':
+				return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')), in_range(bytes, '\t', '\r')));
+			case 'a':
+				return _mm_movemask_epi8(in_range(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a', 'z'));
+			case 'w':
+				return _mm_movemask_epi8(_mm_or_si128(in_range(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a', 'z'), in_range(bytes, '0', '9')));
+			default:
+				return 0;
+		}
+	};
+	if(lower == 'd' || lower == 's' || lower == 'a' || lower == 'w') {
+		for(; end - s >= 16; s += 16) {
+			u32 mask = u32(class_mask(load(s)));
+			u32 mismatch = (negate ? mask : ~mask) & 0xFFFF;
+			if(mismatch) {
+				return s + first_bit(mismatch);
+			}
+		}
+	}
+#endif
+	while(s < end && match_class(u8(*s), u8(cl))) {
+		++s;
+	}
+	return s;
+}
+
+
+PatternMatcher::PatternMatcher(const String& source, const String& pattern) :
+		_src_begin(source.data()),
+		_src_end(source.data() + source.size()),
+		_pattern(pattern.data()),
+		_pattern_end(pattern.data() + pattern.size()),
+		_anchored(pattern.size() && pattern.data()[0] == '^') {
+
+	if(_anchored) {
+		++_pattern;
+	}
+}
+
+bool PatternMatcher::is_plain(std::string_view pattern) {
+	return pattern.find_first_of(specials) == std::string_view::npos;
+}
+
+const char* PatternMatcher::source_begin() const {
+	return _src_begin;
+}
+
+const char* PatternMatcher::source_end() const {
+	return _src_end;
+}
+
+bool PatternMatcher::is_anchored() const {
+	return _anchored;
+}
+
+u32 PatternMatcher::capture_count() const {
+	return _level;
+}
+
+PatternMatcher::Capture PatternMatcher::capture(u32 index, const char* begin, const char* end) const {
+	if(index >= _level) {
+		if(index) {
+			pattern_error("invalid capture index");
+		}
+		return Capture{begin, end - begin};
+	}
+	if(_captures[index].size == unfinished) {
+		pattern_error("unfinished capture");
+	}
+	return _captures[index];
+}
+
+const char* PatternMatcher::match(const char* s) {
+	_level = 0;
+	_depth = max_depth;
+	return do_match(s, _pattern);
+}
+
+const char* PatternMatcher::find(const char* from, const char*& begin) {
+	// a first character that has to be there lets us jump straight to the candidates, anchored patterns only try from
+	const char* p = _pattern;
+	const bool literal_first = !_anchored && p != _pattern_end && !std::strchr(specials, *p) && (p + 1 == _pattern_end || !std::strchr("*?-", *(p + 1)));
+	do {
+		if(literal_first) {
+			from = find_byte(from, _src_end, *p);
+			if(from == _src_end) {
+				return nullptr;
+			}
+		}
+		if(const char* end = match(from)) {
+			begin = from;
+			return end;
+		}
+	} while(from++ < _src_end && !_anchored);
+	return nullptr;
+}
+
+u32 PatternMatcher::check_capture(char index) const {
+	u32 l = u32(index - '1');
+	if(index < '1' || l >= _level || _captures[l].size == unfinished) {
+		pattern_error("invalid capture index");
+	}
+	return l;
+}
+
+u32 PatternMatcher::capture_to_close() const {
+	for(u32 level = _level; level--;) {
+		if(_captures[level].size == unfinished) {
+			return level;
+		}
+	}
+	pattern_error("invalid pattern capture");
+	return 0;
+}
+
+const char* PatternMatcher::class_end(const char* p) const {
+	switch(*p++) {
+		case escape:
+			if(p == _pattern_end) {
+				pattern_error("malformed pattern (ends with '%')");
+			}
+			return p + 1;
+
+		case '[':
+			if(*p == '^') {
+				++p;
+			}
+			// look for a ']'
+			do {
+				if(p == _pattern_end) {
+					pattern_error("malformed pattern (missing ']')");
+				}
+				if(*(p++) == escape && p < _pattern_end) {
+					++p;
+				}
+			} while(*p != ']');
+			return p + 1;
+
+		default:
+			return p;
+	}
+}
+
+bool PatternMatcher::single_match(const char* s, const char* p, const char* ep) const {
+	if(s >= _src_end) {
+		return false;
+	}
+	int c = u8(*s);
+	switch(*p) {
+		case '.':
+			return true;
+		case escape:
+			return match_class(c, u8(*(p + 1)));
+		case '[':
+			return match_bracket_class(c, p, ep - 1);
+		default:
+			return u8(*p) == c;
+	}
+}
+
+// returns the first character from s that single_match rejects
+const char* PatternMatcher::skip_matching(const char* s, const char* p, const char* ep) const {
+	if(ep - p == 1) {
+		if(*p == '.') {
+			return _src_end;
+		}
+		while(s < _src_end && *s == *p) {
+			++s;
+		}
+		return s;
+	}
+	if(*p == escape) {
+		return skip_class(s, _src_end, *(p + 1));
+	}
+	while(single_match(s, p, ep)) {
+		++s;
+	}
+	return s;
+}
+
+const char* PatternMatcher::match_balance(const char* s, const char* p) const {
+	if(p >= _pattern_end - 1) {
+		pattern_error("malformed pattern (missing arguments to '%b')");
+	}
+	if(s >= _src_end || *s != *p) {
+		return nullptr;
+	}
+	char b = *p;
+	char e = *(p + 1);
+	u32 count = 1;
+	while(++s < _src_end) {
+		if(*s == e) {
+			if(!--count) {
+				return s + 1;
+			}
+		} else if(*s == b) {
+			++count;
+		}
+	}
+	return nullptr;
+}
+
+const char* PatternMatcher::max_expand(const char* s, const char* p, const char* ep) {
+	// keeps trying to match with the maximum repetitions
+	for(const char* last = skip_matching(s, p, ep);; --last) {
+		if(const char* res = do_match(last, ep + 1)) {
+			return res;
+		}
+		if(last == s) {
+			return nullptr;
+		}
+	}
+}
+
+const char* PatternMatcher::min_expand(const char* s, const char* p, const char* ep) {
+	for(;;) {
+		if(const char* res = do_match(s, ep + 1)) {
+			return res;
+		}
+		if(!single_match(s, p, ep)) {
+			return nullptr;
+		}
+		++s;
+	}
+}
+
+const char* PatternMatcher::start_capture(const char* s, const char* p, i64 what) {
+	if(_level >= max_captures) {
+		pattern_error("too many captures");
+	}
+	_captures[_level].begin = s;
+	_captures[_level].size = what;
+	++_level;
+	const char* res = do_match(s, p);
+	if(!res) {
+		--_level;
+	}
+	return res;
+}
+
+const char* PatternMatcher::end_capture(const char* s, const char* p) {
+	u32 l = capture_to_close();
+	_captures[l].size = s - _captures[l].begin;
+	const char* res = do_match(s, p);
+	if(!res) {
+		_captures[l].size = unfinished;
+	}
+	return res;
+}
+
+const char* PatternMatcher::match_capture(const char* s, char index) {
+	const Capture& cap = _captures[check_capture(index)];
+	usize size = usize(cap.size);
+	if(usize(_src_end - s) >= size && !std::memcmp(cap.begin, s, size)) {
+		return s + size;
+	}
+	return nullptr;
+}
+
+// follows lstrlib.c, tail calls are gotos
+const char* PatternMatcher::do_match(const char* s, const char* p) {
+	if(!_depth--) {
+		pattern_error("pattern too complex");
+	}
+
+	init:
+	if(p != _pattern_end) {
+		switch(*p) {
+			case '(':
+				s = *(p + 1) == ')' ? start_capture(s, p + 2, position) : start_capture(s, p + 1, unfinished);
+			break;
+
+			case ')':
+				s = end_capture(s, p + 1);
+			break;
+
+			case '$':
+				if(p + 1 != _pattern_end) {
+					goto single;
+				}
+				s = s == _src_end ? s : nullptr;
+			break;
+
+			case escape:
+				switch(*(p + 1)) {
+					case 'b':
+						s = match_balance(s, p + 2);
+						if(s) {
+							p += 4;
+							goto init;
+						}
+					break;
+
+					case 'f': {
+						p += 2;
+						if(*p != '[') {
+							pattern_error("missing '[' after '%f' in pattern");
+						}
+						const char* ep = class_end(p);
+						char previous = s == _src_begin ? '\0' : *(s - 1);
+						char current = s == _src_end ? '\0' : *s;
+						if(!match_bracket_class(u8(previous), p, ep - 1) && match_bracket_class(u8(current), p, ep - 1)) {
+							p = ep;
+							goto init;
+						}
+						s = nullptr;
+					} break;
+
+					case '0': case '1': case '2': case '3': case '4':
+					case '5': case '6': case '7': case '8': case '9':
+						s = match_capture(s, *(p + 1));
+						if(s) {
+							p += 2;
+							goto init;
+						}
+					break;
+
+					default:
+						goto single;
+				}
+			break;
+
+			default:
+			single: {
+				const char* ep = class_end(p);
+				if(!single_match(s, p, ep)) {
+					// accept empty?
+					if(*ep == '*' || *ep == '?' || *ep == '-') {
+						p = ep + 1;
+						goto init;
+					}
+					s = nullptr;
+				} else {
+					switch(*ep) {
+						case '?': {
+							if(const char* res = do_match(s + 1, ep + 1)) {
+								s = res;
+							} else {
+								p = ep + 1;
+								goto init;
+							}
+						} break;
+
+						case '+':
+							s = max_expand(s + 1, p, ep);
+						break;
+
+						case '*':
+							s = max_expand(s, p, ep);
+						break;
+
+						case '-':
+							s = min_expand(s, p, ep);
+						break;
+
+						default:
+							++s;
+							p = ep;
+							goto init;
+					}
+				}
+			} break;
+		}
+	}
+
+	++_depth;
+	return s;
+}
+
+}
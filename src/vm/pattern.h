@@ -0,0 +1,93 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_PATTERN_H
+#define JIT_PATTERN_H
+
+#include "String.h"
+
+namespace jit {
+
+// SSE2 scans, both return end if nothing is found
+const char* find_byte(const char* begin, const char* end, char c);
+const char* find_plain(const char* begin, const char* end, std::string_view needle);
+
+// Lua 5.3 patterns, captures live in the matcher so matching never allocates.
+// Both strings must outlive the matcher, Strings are used for their trailing NUL.
+class PatternMatcher {
+	public:
+		static constexpr u32 max_captures = 32;
+
+		// marks position captures, their value is the index after the capture
+		static constexpr i64 position = -2;
+
+		struct Capture {
+			const char* begin = nullptr;
+			i64 size = 0;
+		};
+
+		PatternMatcher(const String& source, const String& pattern);
+
+		// true for patterns that can't be anything else than a plain substring search
+		static bool is_plain(std::string_view pattern);
+
+		// returns the first match starting at or after from, begin is set to the start of the match
+		const char* find(const char* from, const char*& begin);
+
+		// only matches at s, returns the end of the match or null
+		const char* match(const char* s);
+
+		// captures of the last match, capture 0 is the whole match if the pattern has none
+		u32 capture_count() const;
+		Capture capture(u32 index, const char* begin, const char* end) const;
+
+		const char* source_begin() const;
+		const char* source_end() const;
+		bool is_anchored() const;
+
+	private:
+		const char* do_match(const char* s, const char* p);
+		const char* class_end(const char* p) const;
+		bool single_match(const char* s, const char* p, const char* ep) const;
+		const char* skip_matching(const char* s, const char* p, const char* ep) const;
+		const char* match_balance(const char* s, const char* p) const;
+		const char* max_expand(const char* s, const char* p, const char* ep);
+		const char* min_expand(const char* s, const char* p, const char* ep);
+		const char* start_capture(const char* s, const char* p, i64 what);
+		const char* end_capture(const char* s, const char* p);
+		const char* match_capture(const char* s, char index);
+		u32 check_capture(char index) const;
+		u32 capture_to_close() const;
+
+		const char* _src_begin;
+		const char* _src_end;
+		const char* _pattern;
+		const char* _pattern_end;
+		bool _anchored;
+
+		u32 _level = 0;
+		u32 _depth = 0;
+		Capture _captures[max_captures];
+};
+
+}
+
+#endif // JIT_PATTERN_H
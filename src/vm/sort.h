@@ -0,0 +1,152 @@
+/*******************************
+Copyright (c) 2016-2018 Gr�goire Angerand
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+**********************************/
+#ifndef JIT_SORT_H
+#define JIT_SORT_H
+
+#include "exceptions.h"
+
+#include <utility>
+
+namespace jit {
+
+// Introsort for table.sort: quicksort with Lua's partitioning, heapsort once the recursion gets
+// too deep and insertion sort for small ranges.
+// less can be anything a script gives, so it is never trusted to keep the scans in bounds:
+// inconsistent orders throw like Lua's "invalid order function for sorting".
+namespace sort_detail {
+
+static constexpr usize insertion_threshold = 16;
+
+template<typename T, typename Less>
+void insertion_sort(T* begin, T* end, Less& less) {
+	for(T* i = begin + 1; i < end; ++i) {
+		T value = *i;
+		T* j = i;
+		for(; j != begin && less(value, *(j - 1)); --j) {
+			*j = *(j - 1);
+		}
+		*j = value;
+	}
+}
+
+template<typename T, typename Less>
+void sift_down(T* begin, usize root, usize size, Less& less) {
+	for(usize child = 2 * root + 1; child < size; root = child, child = 2 * root + 1) {
+		if(child + 1 < size && less(begin[child], begin[child + 1])) {
+			++child;
+		}
+		if(!less(begin[root], begin[child])) {
+			return;
+		}
+		std::swap(begin[root], begin[child]);
+	}
+}
+
+template<typename T, typename Less>
+void heap_sort(T* begin, T* end, Less& less) {
+	usize size = usize(end - begin);
+	for(usize i = size / 2; i-- != 0;) {
+		sift_down(begin, i, size, less);
+	}
+	for(usize i = size; i-- > 1;) {
+		std::swap(begin[0], begin[i]);
+		sift_down(begin, 0, i, less);
+	}
+}
+
+// lo and up are inclusive, lo <= pivot <= up and the pivot is at up - 1
+template<typename T, typename Less>
+T* partition(T* lo, T* up, Less& less) {
+	const T pivot = *(up - 1);
+	T* i = lo;
+	T* j = up - 1;
+	for(;;) {
+		while(less(*++i, pivot)) {
+			if(i == up - 1) {
+				throw ExecutionException("Invalid order function for sorting");
+			}
+		}
+		while(less(pivot, *--j)) {
+			if(j < i) {
+				throw ExecutionException("Invalid order function for sorting");
+			}
+		}
+		if(j < i) {
+			std::swap(*(up - 1), *i);
+			return i;
+		}
+		std::swap(*i, *j);
+	}
+}
+
+template<typename T, typename Less>
+void introsort(T* lo, T* up, usize depth, Less& less) {
+	while(usize(up - lo) >= insertion_threshold) {
+		if(!depth--) {
+			heap_sort(lo, up + 1, less);
+			return;
+		}
+
+		// median of three, which also puts sentinels at both ends for the partition
+		T* mid = lo + (up - lo) / 2;
+		if(less(*up, *lo)) {
+			std::swap(*up, *lo);
+		}
+		if(less(*mid, *lo)) {
+			std::swap(*mid, *lo);
+		} else if(less(*up, *mid)) {
+			std::swap(*mid, *up);
+		}
+		std::swap(*mid, *(up - 1));
+
+		// recurse on the smaller half so the stack stays small
+		T* p = partition(lo, up, less);
+		if(p - lo < up - p) {
+			introsort(lo, p - 1, depth, less);
+			lo = p + 1;
+		} else {
+			introsort(p + 1, up, depth, less);
+			up = p - 1;
+		}
+	}
+	if(lo < up) {
+		insertion_sort(lo, up + 1, less);
+	}
+}
+
+}
+
+template<typename T, typename Less>
+void sort(T* begin, T* end, Less&& less) {
+	if(end - begin < 2) {
+		return;
+	}
+	usize depth = 0;
+	for(usize size = usize(end - begin); size; size >>= 1) {
+		depth += 2;
+	}
+	sort_detail::introsort(begin, end - 1, depth, less);
+}
+
+}
+
+#endif // JIT_SORT_H